@@ -0,0 +1,671 @@
+////////////////////////////////////////////////////////////////////////////////
+// \author   Jonathan Dupuy
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Bake.hpp"
+#include "glm.hpp"
+
+#include <cmath>     // floor ceil acos log2
+#include <algorithm> // std::min std::max std::sort
+#include <map>       // std::map
+#include <utility>   // std::pair
+
+namespace lf {
+////////////////////////////////////////////////////////////////////////////////
+// Exceptions
+//
+////////////////////////////////////////////////////////////////////////////////
+class _MeshFileException : public fw::FWException {
+public:
+	_MeshFileException(const std::string& file) {
+		mMessage = "Failed to load OBJ model " + file;
+	}
+};
+
+class _BakeCancelledException : public fw::FWException {
+public:
+	_BakeCancelledException() {
+		mMessage = "Bake cancelled";
+	}
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local functions
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static const GLfloat _PI = 3.14159265358979323846f;
+static const GLfloat _EMPTY_DEPTH = 1e30f;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Orthographic view of the rasterizer: view space is (x.p, y.p, z.p), the
+// camera looks down -z, and [left,right]x[bottom,top] maps to the image.
+struct _RasterView {
+	Vector3 x, y, z;
+	GLfloat left, right, bottom, top;
+};
+
+// Rasterize a mesh, keeping the depth (-z) and the interpolated normal of
+// the closest triangle of each pixel centre
+static void _rasterize(const Mesh& mesh,
+                       const _RasterView& view,
+                       GLsizei size,
+                       std::vector<GLfloat>& depths,
+                       std::vector<Vector3>& normals) {
+	depths.assign(size*size, _EMPTY_DEPTH);
+	normals.assign(size*size, Vector3(0,0,0));
+	const GLfloat scaleX = size / (view.right-view.left);
+	const GLfloat scaleY = size / (view.top-view.bottom);
+
+	for(size_t t=0; t+2<mesh.indexes.size(); t+=3) {
+		GLfloat sx[3], sy[3], d[3];
+		const Vector3* n[3];
+		for(GLint k=0; k<3; ++k) {
+			const Vector3& p = mesh.positions[mesh.indexes[t+k]];
+			sx[k] = (Vector3::DotProduct(view.x, p)-view.left)*scaleX;
+			sy[k] = (Vector3::DotProduct(view.y, p)-view.bottom)*scaleY;
+			d[k]  = -Vector3::DotProduct(view.z, p);
+			n[k]  = &mesh.normals[mesh.indexes[t+k]];
+		}
+		const GLfloat area = (sx[1]-sx[0])*(sy[2]-sy[0])
+		                   - (sx[2]-sx[0])*(sy[1]-sy[0]);
+		if(fabs(area) < 1e-12f)
+			continue;
+		const GLint x0 = std::max(GLint(floor(std::min(sx[0],
+		                                      std::min(sx[1],sx[2])))), 0);
+		const GLint x1 = std::min(GLint(ceil(std::max(sx[0],
+		                                     std::max(sx[1],sx[2])))),
+		                          size-1);
+		const GLint y0 = std::max(GLint(floor(std::min(sy[0],
+		                                      std::min(sy[1],sy[2])))), 0);
+		const GLint y1 = std::min(GLint(ceil(std::max(sy[0],
+		                                     std::max(sy[1],sy[2])))),
+		                          size-1);
+		for(GLint py=y0; py<=y1; ++py)
+			for(GLint px=x0; px<=x1; ++px) {
+				const GLfloat cx = px+0.5f, cy = py+0.5f;
+				const GLfloat w0 = ((sx[2]-sx[1])*(cy-sy[1])
+				                 -  (sy[2]-sy[1])*(cx-sx[1])) / area;
+				const GLfloat w1 = ((sx[0]-sx[2])*(cy-sy[2])
+				                 -  (sy[0]-sy[2])*(cx-sx[2])) / area;
+				const GLfloat w2 = 1.0f-w0-w1;
+				if(w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+					continue;
+				const GLfloat z = w0*d[0]+w1*d[1]+w2*d[2];
+				const GLint i = py*size+px;
+				if(z >= depths[i])
+					continue;
+				depths[i]  = z;
+				normals[i] = (*n[0])*w0+(*n[1])*w1+(*n[2])*w2;
+			}
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Image plane of the orthographic renders
+static _RasterView _image_view(const Vector3& dir) {
+	_RasterView view;
+	view.z = dir.Normalize();
+	Vector3 up = fabs(view.z[1]) < 0.99f ? Vector3(0,1,0) : Vector3(1,0,0);
+	view.x = Vector3::CrossProduct(up, view.z).Normalize();
+	view.y = Vector3::CrossProduct(view.z, view.x);
+	view.left = view.bottom = -IMAGE_EXTENT;
+	view.right = view.top   =  IMAGE_EXTENT;
+	return view;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Parallel tasks
+struct _BakeTask {
+	const Mesh *mesh;
+	const std::vector<View> *views;
+	GLsizei resolution;
+	GLint normals;
+	GLubyte *texels;
+	const GLint *layers; // views to bake, all if NULL
+};
+
+static GLvoid _bake_view(GLint i, GLvoid *data) {
+	const _BakeTask& task = *reinterpret_cast<_BakeTask*>(data);
+	if(task.layers)
+		i = task.layers[i];
+	bake_view(*task.mesh, (*task.views)[i], task.resolution, task.normals,
+	          task.texels + size_t(4)*task.resolution*task.resolution*i);
+}
+
+
+struct _RenderTask {
+	const Mesh *mesh;    // ground truth if not NULL
+	const Atlas *atlas;  // impostor otherwise
+	const std::vector<Vector3> *dirs;
+	GLsizei size;
+	std::vector< std::vector<GLubyte> > *images;
+};
+
+static GLvoid _render_dir(GLint i, GLvoid *data) {
+	const _RenderTask& task = *reinterpret_cast<_RenderTask*>(data);
+	if(task.mesh)
+		render_mesh(*task.mesh, (*task.dirs)[i], task.size,
+		            (*task.images)[i]);
+	else
+		render_impostor(*task.atlas, (*task.dirs)[i], task.size,
+		                (*task.images)[i]);
+}
+
+// Render a set of directions in parallel
+static void _render_dirs(const Mesh *mesh,
+                         const Atlas *atlas,
+                         const std::vector<Vector3>& dirs,
+                         GLsizei size,
+                         std::vector< std::vector<GLubyte> >& images) {
+	images.resize(dirs.size());
+	_RenderTask task = {mesh, atlas, &dirs, size, &images};
+	fw::parallel_for(GLint(dirs.size()), &_render_dir, &task);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// 32-bit FNV-1a hash of the elements of an array
+template<typename T>
+static GLuint _fnv1a(GLuint hash, const std::vector<T>& array) {
+	const GLubyte *bytes = array.empty()
+	                     ? NULL
+	                     : reinterpret_cast<const GLubyte*>(&array[0]);
+	for(size_t i=0; i<sizeof(T)*array.size(); ++i)
+		hash = (hash ^ bytes[i]) * 16777619u;
+	return hash;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Size of an atlas, with its mip levels
+static GLdouble _atlas_bytes(GLint viewN, GLsizei resolution, GLint format) {
+	GLdouble bytes = 0.0;
+	for(GLint level=0; level<fw::mip_level_count(resolution, resolution);
+	    ++level) {
+		GLsizei size = std::max(resolution >> level, 1);
+		if(format == FORMAT_RGBA8)
+			bytes+= 4.0*size*size;
+		else if(format == FORMAT_BC5)
+			bytes+= 2.0*fw::compressed_image_size(GL_COMPRESSED_RG_RGTC2,
+			                                      size, size);
+		else
+			bytes+= fw::compressed_image_size(GL_COMPRESSED_RGBA_BPTC_UNORM,
+			                                  size, size);
+	}
+	return bytes*view_count(viewN);
+}
+
+static bool _sort_by_bytes(const BakeParameters& a, const BakeParameters& b) {
+	return a.bytes < b.bytes;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions implementation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Load mesh
+void load_mesh(const std::string& filename,
+               Mesh& mesh) throw(fw::FWException) {
+	FW_PROFILE_SCOPE("load_mesh");
+	GLMmodel *model = glmReadOBJ(filename.c_str());
+	if(model == NULL)
+		throw _MeshFileException(filename);
+	glmUnitize(model); // unit scale
+	glmScale(model, 0.5f); // really unit scale
+	if(model->numnormals == 0) {
+		glmFacetNormals(model);
+		glmVertexNormals(model, 90.0f);
+	}
+
+	// one vertex per (position, normal) pair (glm arrays start at 1)
+	std::map<std::pair<GLuint, GLuint>, GLuint> indexMap;
+	mesh.positions.resize(0);
+	mesh.normals.resize(0);
+	mesh.indexes.resize(0);
+	for(GLuint i = 0u; i<model->numtriangles; ++i)
+		for(GLuint j = 0u; j < 3u; ++j) {
+			std::pair<GLuint, GLuint> key(model->triangles[i].vindices[j],
+			                              model->triangles[i].nindices[j]);
+			std::map<std::pair<GLuint, GLuint>, GLuint>::const_iterator it
+				= indexMap.find(key);
+			if(it != indexMap.end()) {
+				mesh.indexes.push_back((*it).second);
+				continue;
+			}
+			indexMap[key] = GLuint(mesh.positions.size());
+			mesh.indexes.push_back(GLuint(mesh.positions.size()));
+			mesh.positions.push_back(Vector3(model->vertices[key.first*3u],
+			                         model->vertices[key.first*3u+1u],
+			                         model->vertices[key.first*3u+2u]));
+			mesh.normals.push_back(Vector3(model->normals[key.second*3u],
+			                       model->normals[key.second*3u+1u],
+			                       model->normals[key.second*3u+2u]));
+		}
+	glmDelete(model);
+}
+
+
+GLuint mesh_hash(const Mesh& mesh) {
+	GLuint hash = 2166136261u; // FNV-1a
+	hash = _fnv1a(hash, mesh.positions);
+	hash = _fnv1a(hash, mesh.normals);
+	return _fnv1a(hash, mesh.indexes);
+}
+
+
+GLuint64 mesh_bytes(const Mesh& mesh) {
+	return sizeof(Vector3)*(mesh.positions.size() + mesh.normals.size())
+	     + sizeof(GLuint)*mesh.indexes.size();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Bake
+void bake_view(const Mesh& mesh,
+               const View& view,
+               GLsizei resolution,
+               GLint normalEncoding,
+               GLubyte *texels) {
+	FW_PROFILE_SCOPE("bake_view");
+	_RasterView raster;
+	// view space rows of the view rotation (axis holds its columns)
+	raster.x = Vector3(view.axis[0][0], view.axis[1][0], view.axis[2][0]);
+	raster.y = Vector3(view.axis[0][1], view.axis[1][1], view.axis[2][1]);
+	raster.z = Vector3(view.axis[0][2], view.axis[1][2], view.axis[2][2]);
+	raster.left   = view.bounds[0];
+	raster.right  = view.bounds[1];
+	raster.bottom = view.bounds[2];
+	raster.top    = view.bounds[3];
+
+	std::vector<GLfloat> depths;
+	std::vector<Vector3> normals;
+	fw::HostResource hostScratch("bake scratch"); // one per thread
+	hostScratch.SetBytes((sizeof(GLfloat)+sizeof(Vector3))
+	                     * resolution*resolution);
+	_rasterize(mesh, raster, resolution, depths, normals);
+
+	const GLint texelCnt = resolution*resolution;
+	for(GLint j=0; j<texelCnt; ++j, texels+=4) {
+		if(depths[j] == _EMPTY_DEPTH) {
+			texels[0] = texels[1] = texels[2] = texels[3] = 0;
+			continue;
+		}
+		GLfloat depth = (depths[j]-view.depth[0])
+		              / (view.depth[1]-view.depth[0]);
+		depth = std::min(std::max(depth, 0.0f), 1.0f);
+		texels[0] = GLubyte(depth*255.0f+0.5f);
+		encode_normal(normals[j], normalEncoding, texels+1);
+		texels[3] = 255;
+	}
+}
+
+
+// Set the parameters and the views of an RGBA8 atlas about to be baked,
+// and track its memory (with its mip levels) in host
+static void _init_atlas(const Mesh& mesh,
+                        GLint viewN,
+                        GLsizei resolution,
+                        GLint normals,
+                        GLenum mipmapFilter,
+                        fw::HostResource& host,
+                        Atlas& atlas) {
+	atlas.viewN        = viewN;
+	atlas.resolution   = resolution;
+	atlas.format       = FORMAT_RGBA8;
+	atlas.normals      = normals;
+	atlas.mipmapFilter = mipmapFilter;
+	atlas.meshHash     = mesh_hash(mesh);
+	build_views(viewN, mesh.positions, atlas.views);
+	host.SetBytes(GLuint64(_atlas_bytes(viewN, resolution, FORMAT_RGBA8)));
+}
+
+
+// Build the mip levels of a baked atlas, alpha weighted so that depth and
+// normals do not bleed into empty texels
+static void _build_atlas_mipmaps(Atlas& atlas) {
+	fw::build_mipmaps(atlas.resolution,
+	                  atlas.resolution,
+	                  GLsizei(atlas.views.size()),
+	                  GL_RGBA,
+	                  GL_UNSIGNED_BYTE,
+	                  atlas.mipmapFilter,
+	                  GL_TRUE,
+	                  atlas.levels);
+}
+
+
+void bake_atlas(const Mesh& mesh,
+                GLint viewN,
+                GLsizei resolution,
+                GLint normals,
+                GLenum mipmapFilter,
+                Atlas& atlas) throw(fw::FWException) {
+	FW_PROFILE_SCOPE("bake_atlas");
+	fw::HostResource hostAtlas("bake atlas");
+	_init_atlas(mesh, viewN, resolution, normals, mipmapFilter,
+	            hostAtlas, atlas);
+
+	const GLint viewCnt = GLint(atlas.views.size());
+	atlas.levels.resize(1);
+	atlas.levels[0].resize(size_t(4)*viewCnt*resolution*resolution);
+	_BakeTask task = {&mesh, &atlas.views, resolution, normals,
+	                  &atlas.levels[0][0], NULL};
+	fw::parallel_for(viewCnt, &_bake_view, &task);
+
+	_build_atlas_mipmaps(atlas);
+}
+
+
+GLint bake_atlas(const Mesh& mesh,
+                 GLint viewN,
+                 GLsizei resolution,
+                 GLint normals,
+                 GLenum mipmapFilter,
+                 const std::string& checkpointFile,
+                 const volatile GLint *cancel,
+                 Atlas& atlas) throw(fw::FWException) {
+	FW_PROFILE_SCOPE("bake_atlas");
+	fw::HostResource hostAtlas("bake atlas");
+	_init_atlas(mesh, viewN, resolution, normals, mipmapFilter,
+	            hostAtlas, atlas);
+
+	AtlasCheckpoint checkpoint;
+	const GLint completedCnt = open_checkpoint(checkpointFile,
+	                                           BAKER_CPU,
+	                                           atlas,
+	                                           checkpoint);
+	std::vector<GLint> pending;
+	for(size_t i=0; i<checkpoint.completed.size(); ++i)
+		if(!checkpoint.completed[i])
+			pending.push_back(GLint(i));
+
+	// a few views per thread between checkpoints
+	const size_t batchSize = size_t(4)*fw::hardware_thread_count();
+	for(size_t first=0; first<pending.size(); first+=batchSize) {
+		if(cancel != NULL && *cancel)
+			throw _BakeCancelledException();
+		std::vector<GLint> batch(pending.begin()+first,
+		                         pending.begin()
+		                         + std::min(first+batchSize, pending.size()));
+		_BakeTask task = {&mesh, &atlas.views, resolution, normals,
+		                  &atlas.levels[0][0], &batch[0]};
+		fw::parallel_for(GLint(batch.size()), &_bake_view, &task);
+		write_checkpoint(checkpoint, atlas, batch);
+	}
+
+	_build_atlas_mipmaps(atlas);
+	return completedCnt;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// View selection (port of lightfield.glsl)
+void find_views(const Vector3& dir,
+                GLint viewN,
+                GLint layers[3],
+                GLfloat weights[3]) {
+	const GLfloat n = GLfloat(viewN);
+	const Vector3 v(dir[0], std::max(dir[1], 0.01f), dir[2]);
+	GLfloat a = 0.0f;
+	if(fabs(v[2]) > fabs(v[0]))
+		a = v[0] / v[2];
+	else if(v[0] != 0.0f)
+		a = -v[2] / v[0];
+	const GLfloat polar = acos(std::min(v[1], 1.0f)) / _PI;
+	const GLfloat nxx = n * (1.0f - a) * polar;
+	const GLfloat nyy = n * (1.0f + a) * polar;
+	const GLint i = GLint(floor(nxx));
+	const GLint j = GLint(floor(nyy));
+	const GLfloat ti = nxx - i;
+	const GLfloat tj = nyy - j;
+	const GLfloat alpha = 1.0f - ti - tj;
+	const bool b = alpha > 0.0f;
+	GLint ii[3] = {b ? i : i + 1, i + 1, i};
+	GLint jj[3] = {b ? j : j + 1, j, j + 1};
+	weights[0] = fabs(alpha);
+	weights[1] = b ? ti : 1.0f - tj;
+	weights[2] = b ? tj : 1.0f - ti;
+	const GLfloat s = v[0] + v[2];
+	const GLint sign = s > 0.0f ? 1 : s < 0.0f ? -1 : 0;
+	for(GLint k=0; k<3; ++k) {
+		if(fabs(v[0]) >= fabs(v[2])) {
+			GLint tmp = ii[k];
+			ii[k] = -jj[k];
+			jj[k] = tmp;
+		}
+		ii[k]*= sign;
+		jj[k]*= sign;
+		layers[k] = ii[k]*((2*viewN+1)-abs(ii[k]))+jj[k]+viewN*(viewN+1);
+		layers[k] = std::min(std::max(layers[k], 0), view_count(viewN)-1);
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Renders
+void render_mesh(const Mesh& mesh,
+                 const Vector3& dir,
+                 GLsizei size,
+                 std::vector<GLubyte>& image) {
+	std::vector<GLfloat> depths;
+	std::vector<Vector3> normals;
+	_rasterize(mesh, _image_view(dir), size, depths, normals);
+	image.assign(4*size*size, 0);
+	for(GLint i=0; i<size*size; ++i) {
+		if(depths[i] == _EMPTY_DEPTH)
+			continue;
+		Vector3 n = normals[i].Normalize();
+		for(GLint c=0; c<3; ++c)
+			image[4*i+c] = GLubyte((n[c]*0.5f+0.5f)*255.0f+0.5f);
+		image[4*i+3] = 255;
+	}
+}
+
+
+void render_impostor(const Atlas& atlas,
+                     const Vector3& dir,
+                     GLsizei size,
+                     std::vector<GLubyte>& image) {
+	const _RasterView image_view = _image_view(dir);
+	GLint layers[3];
+	GLfloat weights[3], lods[3];
+	find_views(image_view.z, atlas.viewN, layers, weights);
+	for(GLint k=0; k<3; ++k) { // texels per pixel, along the axis with the
+	                           // most (as the derivatives of lightfield.glsl)
+		const Vector4& bounds = atlas.views[layers[k]].bounds;
+		GLfloat extent = std::min(bounds[1]-bounds[0], bounds[3]-bounds[2]);
+		GLfloat ratio = atlas.resolution / extent
+		              * (2.0f*IMAGE_EXTENT/size);
+		lods[k] = std::max(GLfloat(log(ratio)/log(2.0f)), 0.0f);
+	}
+
+	image.assign(4*size*size, 0);
+	for(GLint py=0; py<size; ++py)
+		for(GLint px=0; px<size; ++px) {
+			const GLfloat x = ((px+0.5f)/size*2.0f-1.0f)*IMAGE_EXTENT;
+			const GLfloat y = ((py+0.5f)/size*2.0f-1.0f)*IMAGE_EXTENT;
+			const Vector3 p = image_view.x*x + image_view.y*y;
+			GLfloat t[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+			for(GLint k=0; k<3; ++k) {
+				const View& view = atlas.views[layers[k]];
+				const Vector4& bounds = view.bounds;
+				GLfloat s = view.axis[0][0]*p[0] + view.axis[1][0]*p[1]
+				          + view.axis[2][0]*p[2];
+				GLfloat r = view.axis[0][1]*p[0] + view.axis[1][1]*p[1]
+				          + view.axis[2][1]*p[2];
+				GLfloat texel[4];
+				sample_atlas(atlas, layers[k],
+				             (s-bounds[0])/(bounds[1]-bounds[0]),
+				             (r-bounds[2])/(bounds[3]-bounds[2]),
+				             lods[k], texel);
+				for(GLint c=0; c<4; ++c)
+					t[c]+= weights[k]*texel[c];
+			}
+			if(t[3] <= 0.0f)
+				continue;
+			Vector3 n = decode_normal(t[1], t[2], atlas.normals);
+			GLubyte *pixel = &image[4*(py*size+px)];
+			for(GLint c=0; c<3; ++c)
+				pixel[c] = GLubyte(std::min((n[c]*0.5f+0.5f)*t[3], 1.0f)
+				                   *255.0f+0.5f);
+			pixel[3] = GLubyte(std::min(t[3], 1.0f)*255.0f+0.5f);
+		}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// SSIM (8x8 windows, stride 4)
+GLdouble ssim(const std::vector<GLubyte>& a,
+              const std::vector<GLubyte>& b,
+              GLsizei size) {
+	const GLint WINDOW = 8, STRIDE = 4;
+	const GLdouble C1 = 0.01*0.01, C2 = 0.03*0.03;
+	GLdouble sum = 0.0;
+	GLint windowCnt = 0;
+	for(GLint y0=0; y0+WINDOW<=size; y0+=STRIDE)
+		for(GLint x0=0; x0+WINDOW<=size; x0+=STRIDE) {
+			GLdouble ma = 0.0, mb = 0.0, va = 0.0, vb = 0.0, cov = 0.0;
+			for(GLint y=y0; y<y0+WINDOW; ++y)
+				for(GLint x=x0; x<x0+WINDOW; ++x) {
+					const GLint i = 4*(y*size+x);
+					GLdouble la = (a[i]+a[i+1]+a[i+2]) / (3.0*255.0);
+					GLdouble lb = (b[i]+b[i+1]+b[i+2]) / (3.0*255.0);
+					ma+= la;
+					mb+= lb;
+					va+= la*la;
+					vb+= lb*lb;
+					cov+= la*lb;
+				}
+			const GLdouble n = WINDOW*WINDOW;
+			ma/= n;
+			mb/= n;
+			va = va/n - ma*ma;
+			vb = vb/n - mb*mb;
+			cov = cov/n - ma*mb;
+			sum+= ((2.0*ma*mb+C1)*(2.0*cov+C2))
+			    / ((ma*ma+mb*mb+C1)*(va+vb+C2));
+			++windowCnt;
+		}
+	return windowCnt ? sum / windowCnt : 1.0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Tuner
+bool tune_bake_parameters(const Mesh& mesh,
+                          GLdouble targetPsnr,
+                          GLdouble targetSsim,
+                          GLint normals,
+                          GLint dirCnt,
+                          std::ostream& logStream,
+                          BakeParameters& parameters)
+                          throw(fw::FWException) {
+	const GLint viewNs[] = {2, 3, 4, 5, 6, 7, 8, 9, 10, 12};
+	const GLsizei resolutions[] = {32, 48, 64, 96, 128, 192, 256};
+	const GLint formats[] = {FORMAT_BC7, FORMAT_BC5, FORMAT_RGBA8};
+	const char* formatNames[] = {"RGBA8", "BC5", "BC7"};
+	const GLsizei IMAGE_SIZE = 128;
+	dirCnt = std::max(dirCnt, 1);
+
+	// held-out directions: spiral over the upper hemisphere, which do not
+	// match the baked views
+	std::vector<Vector3> dirs(dirCnt);
+	for(GLint i=0; i<dirCnt; ++i) {
+		GLfloat y = 1.0f - 0.95f*(i+0.5f)/dirCnt;
+		GLfloat r = sqrt(1.0f-y*y);
+		GLfloat phi = i*_PI*(3.0f-sqrt(5.0f));
+		dirs[i] = Vector3(r*cos(phi), y, r*sin(phi));
+	}
+	std::vector< std::vector<GLubyte> > truth, images;
+	_render_dirs(&mesh, NULL, dirs, IMAGE_SIZE, truth);
+
+	// candidates by increasing size
+	std::vector<BakeParameters> candidates;
+	for(size_t i=0; i<sizeof(viewNs)/sizeof(viewNs[0]); ++i)
+		for(size_t j=0; j<sizeof(resolutions)/sizeof(resolutions[0]); ++j)
+			for(size_t k=0; k<sizeof(formats)/sizeof(formats[0]); ++k) {
+				BakeParameters candidate;
+				candidate.viewN      = viewNs[i];
+				candidate.resolution = resolutions[j];
+				candidate.format     = formats[k];
+				candidate.bytes      = _atlas_bytes(viewNs[i],
+				                                    resolutions[j],
+				                                    formats[k]);
+				candidate.psnr = candidate.ssim = 0.0;
+				candidates.push_back(candidate);
+			}
+	std::sort(candidates.begin(), candidates.end(), &_sort_by_bytes);
+
+	// each (viewN, resolution) pair is baked once, when its first candidate
+	// comes, and the bake is compressed into each format. RGBA8 quality
+	// bounds the quality of the compressed formats, so they are skipped
+	// (left at 0) for pairs whose RGBA8 bake misses the target.
+	typedef std::pair<GLint, GLsizei> Pair;
+	std::map<Pair, std::vector<BakeParameters> > measured; // per format
+	bool found = false;
+	parameters = candidates[0];
+	logStream << "viewN  resolution  format  size (MB)  PSNR (dB)  SSIM\n";
+	for(size_t i=0; i<candidates.size() && !found; ++i) {
+		BakeParameters& candidate = candidates[i];
+		const Pair pair(candidate.viewN, candidate.resolution);
+		if(!measured.count(pair)) {
+			std::vector<BakeParameters>& results = measured[pair];
+			Atlas baked;
+			bake_atlas(mesh, candidate.viewN, candidate.resolution, normals,
+			           fw::MIPMAP_FILTER_BOX, baked);
+			for(GLint format=FORMAT_RGBA8; format<FORMAT_COUNT; ++format) {
+				BakeParameters result = candidate;
+				result.format = format;
+				result.bytes = _atlas_bytes(candidate.viewN,
+				                            candidate.resolution,
+				                            format);
+				result.psnr = result.ssim = 0.0;
+				results.push_back(result);
+				if(format != FORMAT_RGBA8
+				   && (results[FORMAT_RGBA8].psnr < targetPsnr
+				       || results[FORMAT_RGBA8].ssim < targetSsim))
+					continue;
+
+				Atlas atlas = baked;
+				if(format != FORMAT_RGBA8) {
+					compress_atlas(atlas, format, fw::BC_QUALITY_NORMAL);
+					decompress_atlas(atlas);
+				}
+				_render_dirs(NULL, &atlas, dirs, IMAGE_SIZE, images);
+				GLdouble psnrSum = 0.0, ssimSum = 0.0;
+				for(GLint j=0; j<dirCnt; ++j) {
+					psnrSum+= psnr(truth[j], images[j]);
+					ssimSum+= ssim(truth[j], images[j], IMAGE_SIZE);
+				}
+				results[format].psnr = psnrSum/dirCnt;
+				results[format].ssim = ssimSum/dirCnt;
+				logStream << result.viewN << '\t'
+				          << result.resolution << '\t'
+				          << formatNames[format] << '\t'
+				          << result.bytes / 1e6 << '\t'
+				          << results[format].psnr << '\t'
+				          << results[format].ssim << std::endl;
+			}
+		}
+
+		const BakeParameters& result = measured[pair][candidate.format];
+		candidate.psnr = result.psnr;
+		candidate.ssim = result.ssim;
+		found = candidate.psnr >= targetPsnr && candidate.ssim >= targetSsim;
+		if(found || candidate.psnr > parameters.psnr)
+			parameters = candidate;
+	}
+	return found;
+}
+
+} // namespace lf
+
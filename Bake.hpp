@@ -0,0 +1,126 @@
+////////////////////////////////////////////////////////////////////////////////
+// \author J Dupuy
+// \brief CPU baking of lightfield atlases: a software rasterizer for the
+// views and the ground truth, the impostor reconstruction of lightfield.glsl
+// and a tuner of the bake parameters.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef BAKE_HPP
+#define BAKE_HPP
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include "Algebra.hpp"
+#include "Framework.hpp"
+#include "Lightfield.hpp"
+
+namespace lf {
+	// Indexed triangle mesh, scaled to fit [-0.5,0.5]^3
+	struct Mesh {
+		std::vector<Vector3> positions;
+		std::vector<Vector3> normals;  // one per position
+		std::vector<GLuint>  indexes;  // three per triangle
+	};
+
+
+	// Load an OBJ file (vertices are split where normals differ)
+	void load_mesh(const std::string& filename,
+	               Mesh& mesh) throw(fw::FWException);
+	// Get a hash of the vertices and triangles of a mesh, which identifies
+	// the mesh of a cached atlas
+	GLuint mesh_hash(const Mesh& mesh);
+	// Get the host memory of the arrays of a mesh (in bytes)
+	GLuint64 mesh_bytes(const Mesh& mesh);
+
+
+	// Rasterize and encode one view of a mesh in resolution^2 RGBA8 texels,
+	// as mesh.glsl
+	void bake_view(const Mesh& mesh,
+	               const View& view,
+	               GLsizei resolution,
+	               GLint normalEncoding,
+	               GLubyte *texels);
+	// Bake the RGBA8 atlas of a mesh on the CPU, with the layout and the
+	// texels of mesh.glsl. Views are rasterized in parallel.
+	void bake_atlas(const Mesh& mesh,
+	                GLint viewN,
+	                GLsizei resolution,
+	                GLint normals,
+	                GLenum mipmapFilter,
+	                Atlas& atlas) throw(fw::FWException);
+	// ... resuming from the layers completed in a checkpoint file, which
+	// is written in batches of a few views per thread. The caller removes
+	// the checkpoint once the atlas is saved. If cancel is not NULL, the
+	// bake throws between two batches once *cancel is set (the checkpoint
+	// is kept). Returns the number of layers read from the checkpoint.
+	GLint bake_atlas(const Mesh& mesh,
+	                 GLint viewN,
+	                 GLsizei resolution,
+	                 GLint normals,
+	                 GLenum mipmapFilter,
+	                 const std::string& checkpointFile,
+	                 const volatile GLint *cancel,
+	                 Atlas& atlas) throw(fw::FWException);
+
+
+	// Get the three views and weights lightfield.glsl blends for the unit
+	// direction dir (from the object to the camera)
+	void find_views(const Vector3& dir,
+	                GLint viewN,
+	                GLint layers[3],
+	                GLfloat weights[3]);
+
+
+	// Render an orthographic image of size^2 RGBA8 pixels of the object seen
+	// from dir, as (normal*0.5+0.5)*alpha, alpha. The image covers
+	// [-IMAGE_EXTENT, IMAGE_EXTENT]^2 around the origin.
+	const GLfloat IMAGE_EXTENT = 0.875f;
+	// ... from the mesh (ground truth)
+	void render_mesh(const Mesh& mesh,
+	                 const Vector3& dir,
+	                 GLsizei size,
+	                 std::vector<GLubyte>& image);
+	// ... from an RGBA8 atlas, as lightfield.glsl does
+	void render_impostor(const Atlas& atlas,
+	                     const Vector3& dir,
+	                     GLsizei size,
+	                     std::vector<GLubyte>& image);
+
+
+	// Get the mean SSIM of the luminance of two RGBA8 images of size^2
+	GLdouble ssim(const std::vector<GLubyte>& a,
+	              const std::vector<GLubyte>& b,
+	              GLsizei size);
+
+
+	// Bake parameters
+	struct BakeParameters {
+		GLint   viewN;
+		GLsizei resolution;
+		GLint   format;  // FORMAT_*
+		GLdouble bytes;  // atlas size, with mip levels
+		GLdouble psnr;   // mean over the held-out directions
+		GLdouble ssim;
+	};
+
+	// Search for the smallest atlas meeting a PSNR and an SSIM target,
+	// measured against ground truth renders of dirCnt held-out directions.
+	// Candidates are tried by increasing size; each (viewN, resolution) is
+	// baked once and compressed into each format. Measures are logged to
+	// logStream. Returns false (and the best candidate) if none meets the
+	// target.
+	bool tune_bake_parameters(const Mesh& mesh,
+	                          GLdouble targetPsnr,
+	                          GLdouble targetSsim,
+	                          GLint normals,
+	                          GLint dirCnt,
+	                          std::ostream& logStream,
+	                          BakeParameters& parameters)
+	                          throw(fw::FWException);
+
+} // namespace lf
+
+#endif
+
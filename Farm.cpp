@@ -0,0 +1,580 @@
+////////////////////////////////////////////////////////////////////////////////
+// \author   Jonathan Dupuy
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Farm.hpp"
+#include "Bake.hpp"
+#include "Lightfield.hpp"
+
+#include <deque>     // std::deque
+#include <fstream>   // std::ifstream
+#include <algorithm> // std::min
+
+#ifndef _WIN32
+#	include <cerrno>       // errno
+#	include <unistd.h>     // fork read write close _exit
+#	include <signal.h>     // kill signal
+#	include <poll.h>       // poll
+#	include <sys/socket.h> // socketpair
+#	include <sys/wait.h>   // waitpid
+#endif // _WIN32
+
+namespace lf {
+////////////////////////////////////////////////////////////////////////////////
+// Exceptions
+//
+////////////////////////////////////////////////////////////////////////////////
+class _FarmException : public fw::FWException {
+public:
+	_FarmException(const std::string& reason) {
+		mMessage = "Bake farm: " + reason;
+	}
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local functions
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// Write the cache file of a baked RGBA8 atlas and drop its checkpoint
+static void _save_job(const FarmJob& job,
+                      const FarmParameters& parameters,
+                      const AtlasCheckpoint& checkpoint,
+                      Atlas& atlas) throw(fw::FWException) {
+	compress_atlas(atlas, parameters.format, parameters.quality);
+	save_atlas(atlas, job.cacheFile);
+	remove_checkpoint(checkpoint);
+}
+
+#ifndef _WIN32
+////////////////////////////////////////////////////////////////////////////////
+// Protocol (native byte order)
+static const GLuint _REQUEST_MAGIC = 0x51524C46u; // "LFRQ"
+static const GLuint _REPLY_MAGIC   = 0x50524C46u; // "LFRP"
+static const size_t _MAX_ERROR_BYTES = 4096; // of the message of a failure
+
+// Shard request, followed by the pathLength bytes of the OBJ file name.
+// A worker exits once its socket is closed.
+struct _ShardRequest {
+	GLuint magic;
+	GLint  viewN;
+	GLint  resolution;
+	GLint  normals;
+	GLint  first;      // first view of the shard
+	GLint  count;      // views of the shard
+	GLuint pathLength;
+};
+
+// Shard reply, followed by byteCount bytes: the RGBA8 layers of the views
+// if status is 0, an error message otherwise
+struct _ShardReply {
+	GLuint   magic;
+	GLint    status;
+	GLint    first;
+	GLint    count;
+	GLuint64 byteCount;
+};
+
+
+// Read / write size bytes, false on end of file or error
+static bool _read_all(int fd, GLvoid *data, size_t size) {
+	char *bytes = reinterpret_cast<char*>(data);
+	while(size > 0) {
+		ssize_t n = read(fd, bytes, size);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		bytes+= n;
+		size-= size_t(n);
+	}
+	return true;
+}
+
+static bool _write_all(int fd, const GLvoid *data, size_t size) {
+	const char *bytes = reinterpret_cast<const char*>(data);
+	while(size > 0) {
+		ssize_t n = write(fd, bytes, size);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+		bytes+= n;
+		size-= size_t(n);
+	}
+	return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Worker process: bake the shards read from fd. Views are rasterized one
+// at a time, the workers already occupy the cores.
+static void _farm_worker(int fd) {
+	Mesh mesh;
+	std::vector<View> views;
+	std::string meshFile;
+	GLint viewN = -1;
+	_ShardRequest request;
+	while(_read_all(fd, &request, sizeof(request))
+	      && request.magic == _REQUEST_MAGIC) {
+		std::string file(request.pathLength, '\0');
+		if(request.pathLength > 0u && !_read_all(fd, &file[0], file.size()))
+			break;
+
+		_ShardReply reply = {_REPLY_MAGIC, 0, request.first, request.count, 0};
+		std::vector<GLubyte> bytes;
+		try {
+			if(file != meshFile || request.viewN != viewN) {
+				meshFile.clear();
+				load_mesh(file, mesh);
+				build_views(request.viewN, mesh.positions, views);
+				meshFile = file;
+				viewN = request.viewN;
+			}
+			if(request.first < 0 || request.count < 1
+			   || request.first+request.count > GLint(views.size()))
+				throw _FarmException("views out of range");
+			const size_t layerBytes = size_t(4)*request.resolution
+			                        * request.resolution;
+			bytes.resize(layerBytes*request.count);
+			for(GLint i=0; i<request.count; ++i)
+				bake_view(mesh,
+				          views[request.first+i],
+				          request.resolution,
+				          request.normals,
+				          &bytes[layerBytes*i]);
+		}
+		catch(std::exception& e) {
+			const std::string message = e.what();
+			reply.status = 1;
+			bytes.assign(message.begin(),
+			             message.begin()
+			             + std::min(message.size(), _MAX_ERROR_BYTES));
+		}
+		reply.byteCount = bytes.size();
+		if(!_write_all(fd, &reply, sizeof(reply))
+		   || (!bytes.empty() && !_write_all(fd, &bytes[0], bytes.size())))
+			break;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Coordinator
+struct _Shard {
+	GLint job;
+	GLint first;
+	GLint count;
+	GLint attempts; // failed so far
+};
+
+struct _Worker {
+	pid_t  pid;
+	int    fd;
+	bool   busy;
+	_Shard shard; // being baked, if busy
+};
+
+struct _JobState {
+	Atlas           atlas;
+	AtlasCheckpoint checkpoint;
+	GLint           pendingShards;
+	bool            started;
+	bool            failed;
+	GLuint64        startTime; // fw::clock_nanoseconds
+};
+
+struct _Farm {
+	const std::vector<FarmJob> *jobs;
+	const FarmParameters *parameters;
+	std::ostream *log;
+	std::vector<FarmResult> *results;
+	std::vector<_Worker> workers;
+	std::vector<_JobState> states;
+	std::deque<_Shard> shards;
+	GLint failedCnt;
+};
+
+
+// Fork worker i. The child closes the sockets of the other workers, so
+// that each worker sees the end of its own socket only.
+static void _spawn_worker(_Farm& farm, size_t i) throw(fw::FWException) {
+	int fds[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+		throw _FarmException("cannot create a socket");
+	pid_t pid = fork();
+	if(pid < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		throw _FarmException("cannot fork a worker");
+	}
+	if(pid == 0) {
+		close(fds[0]);
+		for(size_t j=0; j<farm.workers.size(); ++j)
+			if(farm.workers[j].fd >= 0)
+				close(farm.workers[j].fd);
+		_farm_worker(fds[1]);
+		_exit(0);
+	}
+	close(fds[1]);
+	farm.workers[i].pid  = pid;
+	farm.workers[i].fd   = fds[0];
+	farm.workers[i].busy = false;
+}
+
+// Close the socket of worker i and reap it (killing it first if asked)
+static void _stop_worker(_Farm& farm, size_t i, bool kill) {
+	_Worker& worker = farm.workers[i];
+	if(worker.fd < 0)
+		return;
+	close(worker.fd);
+	if(kill)
+		::kill(worker.pid, SIGKILL);
+	int status = 0;
+	while(waitpid(worker.pid, &status, 0) < 0 && errno == EINTR);
+	worker.fd = -1;
+	worker.busy = false;
+}
+
+// Replace a worker whose socket failed
+static void _restart_worker(_Farm& farm, size_t i) throw(fw::FWException) {
+	*farm.log << "farm: worker " << farm.workers[i].pid
+	          << " lost, restarting" << std::endl;
+	_stop_worker(farm, i, true);
+	_spawn_worker(farm, i);
+}
+
+
+static void _fail_job(_Farm& farm, GLint job, const std::string& reason) {
+	_JobState& state = farm.states[job];
+	if(state.failed)
+		return;
+	*farm.log << "farm: " << (*farm.jobs)[job].meshFile << " failed: "
+	          << reason << std::endl;
+	state.failed = true;
+	state.atlas.levels.clear();
+	++farm.failedCnt;
+}
+
+// Queue a failed shard again, or fail its job after maxAttempts
+static void _retry_shard(_Farm& farm, _Shard shard) {
+	++shard.attempts;
+	++(*farm.results)[shard.job].retries;
+	if(shard.attempts >= farm.parameters->maxAttempts)
+		_fail_job(farm, shard.job, "a shard failed too many times");
+	else
+		farm.shards.push_front(shard);
+}
+
+// Allocate the atlas of a job, with the views of the workers, and resume
+// it from its checkpoint
+static void _start_job(_Farm& farm, GLint job) {
+	const FarmParameters& parameters = *farm.parameters;
+	const FarmJob& farmJob = (*farm.jobs)[job];
+	_JobState& state = farm.states[job];
+	state.started = true;
+	state.startTime = fw::clock_nanoseconds();
+	// glmReadOBJ exits on missing files
+	if(!std::ifstream(farmJob.meshFile.c_str())) {
+		_fail_job(farm, job, "cannot open the mesh");
+		return;
+	}
+	try {
+		Mesh mesh;
+		load_mesh(farmJob.meshFile, mesh);
+		state.atlas.viewN        = parameters.viewN;
+		state.atlas.resolution   = parameters.resolution;
+		state.atlas.format       = FORMAT_RGBA8;
+		state.atlas.normals      = parameters.normals;
+		state.atlas.mipmapFilter = parameters.mipmapFilter;
+		state.atlas.meshHash     = mesh_hash(mesh);
+		build_views(parameters.viewN, mesh.positions, state.atlas.views);
+		const std::string file = checkpoint_file(farmJob.cacheFile);
+		GLint completedCnt = open_checkpoint(file,
+		                                     BAKER_CPU,
+		                                     state.atlas,
+		                                     state.checkpoint);
+		(*farm.results)[job].resumedLayers = completedCnt;
+		if(completedCnt > 0)
+			*farm.log << "farm: " << farmJob.meshFile << " resumed ("
+			          << completedCnt << " layers done)" << std::endl;
+	}
+	catch(fw::FWException& e) {
+		_fail_job(farm, job, e.what());
+	}
+}
+
+// Build the mip levels of a job (as bake_atlas) and write its cache file
+static void _finish_job(_Farm& farm, GLint job) {
+	const FarmParameters& parameters = *farm.parameters;
+	_JobState& state = farm.states[job];
+	try {
+		fw::build_mipmaps(parameters.resolution,
+		                  parameters.resolution,
+		                  GLsizei(state.atlas.views.size()),
+		                  GL_RGBA,
+		                  GL_UNSIGNED_BYTE,
+		                  parameters.mipmapFilter,
+		                  GL_TRUE,
+		                  state.atlas.levels);
+		_save_job((*farm.jobs)[job], parameters, state.checkpoint,
+		          state.atlas);
+	}
+	catch(fw::FWException& e) {
+		_fail_job(farm, job, e.what());
+		return;
+	}
+	FarmResult& result = (*farm.results)[job];
+	result.baked = true;
+	result.seconds = 1e-9*(fw::clock_nanoseconds()-state.startTime);
+	for(size_t i=0; i<state.atlas.levels.size(); ++i)
+		result.bytes+= state.atlas.levels[i].size();
+	*farm.log << "farm: " << (*farm.jobs)[job].meshFile << " baked in "
+	          << result.seconds << " s (" << result.retries << " retries)"
+	          << std::endl;
+	state.atlas = Atlas();
+	state.checkpoint = AtlasCheckpoint();
+}
+
+
+// Check if all the layers of a shard are in the checkpoint of its job
+static bool _shard_completed(const _Farm& farm, const _Shard& shard) {
+	const std::vector<GLubyte>& completed
+		= farm.states[shard.job].checkpoint.completed;
+	for(GLint i=0; i<shard.count; ++i)
+		if(!completed[shard.first+i])
+			return false;
+	return true;
+}
+
+
+// Send the next pending shard to idle worker i
+static void _send_shard(_Farm& farm, size_t i) throw(fw::FWException) {
+	while(!farm.shards.empty()) {
+		_Shard shard = farm.shards.front();
+		farm.shards.pop_front();
+		_JobState& state = farm.states[shard.job];
+		if(!state.started)
+			_start_job(farm, shard.job);
+		if(state.failed)
+			continue;
+		if(_shard_completed(farm, shard)) {
+			if(--state.pendingShards == 0)
+				_finish_job(farm, shard.job);
+			continue;
+		}
+
+		const FarmParameters& parameters = *farm.parameters;
+		const std::string& file = (*farm.jobs)[shard.job].meshFile;
+		_ShardRequest request = {_REQUEST_MAGIC,
+		                         parameters.viewN,
+		                         parameters.resolution,
+		                         parameters.normals,
+		                         shard.first,
+		                         shard.count,
+		                         GLuint(file.size())};
+		_Worker& worker = farm.workers[i];
+		if(_write_all(worker.fd, &request, sizeof(request))
+		   && _write_all(worker.fd, file.c_str(), file.size())) {
+			worker.busy  = true;
+			worker.shard = shard;
+			return;
+		}
+		_retry_shard(farm, shard);
+		_restart_worker(farm, i);
+	}
+}
+
+// Read the reply of busy worker i and copy its layers in the atlas
+static void _receive_shard(_Farm& farm, size_t i) throw(fw::FWException) {
+	_Worker& worker = farm.workers[i];
+	const _Shard shard = worker.shard;
+	_JobState& state = farm.states[shard.job];
+	const size_t layerBytes = size_t(4)*farm.parameters->resolution
+	                        * farm.parameters->resolution;
+	worker.busy = false;
+
+	_ShardReply reply;
+	if(!_read_all(worker.fd, &reply, sizeof(reply))
+	   || reply.magic != _REPLY_MAGIC
+	   || reply.first != shard.first
+	   || reply.count != shard.count
+	   || (reply.status == 0
+	       && reply.byteCount != layerBytes*shard.count)
+	   || (reply.status != 0 && reply.byteCount > _MAX_ERROR_BYTES)) {
+		_retry_shard(farm, shard);
+		_restart_worker(farm, i);
+		return;
+	}
+
+	// layers go in place, unless the job failed meanwhile
+	std::vector<GLubyte> bytes;
+	GLubyte *data = NULL;
+	if(reply.status == 0 && !state.failed)
+		data = &state.atlas.levels[0][layerBytes*shard.first];
+	else if(reply.byteCount > 0u) {
+		bytes.resize(size_t(reply.byteCount));
+		data = &bytes[0];
+	}
+	if(reply.byteCount > 0u && !_read_all(worker.fd, data,
+	                                      size_t(reply.byteCount))) {
+		_retry_shard(farm, shard);
+		_restart_worker(farm, i);
+		return;
+	}
+
+	if(reply.status != 0) {
+		*farm.log << "farm: worker " << worker.pid << ": "
+		          << std::string(bytes.begin(), bytes.end()) << std::endl;
+		_retry_shard(farm, shard);
+	}
+	else if(!state.failed) {
+		std::vector<GLint> layers(shard.count);
+		for(GLint j=0; j<shard.count; ++j)
+			layers[j] = shard.first+j;
+		try {
+			write_checkpoint(state.checkpoint, state.atlas, layers);
+		}
+		catch(fw::FWException& e) {
+			_fail_job(farm, shard.job, e.what());
+			return;
+		}
+		if(--state.pendingShards == 0)
+			_finish_job(farm, shard.job);
+	}
+}
+
+
+static void _run_farm(_Farm& farm) throw(fw::FWException) {
+	std::vector<pollfd> fds;
+	std::vector<size_t> polled;
+	for(size_t i=0; i<farm.workers.size(); ++i)
+		_spawn_worker(farm, i);
+	for(;;) {
+		for(size_t i=0; i<farm.workers.size(); ++i)
+			if(!farm.workers[i].busy)
+				_send_shard(farm, i);
+
+		fds.resize(0);
+		polled.resize(0);
+		for(size_t i=0; i<farm.workers.size(); ++i)
+			if(farm.workers[i].busy) {
+				pollfd fd = {farm.workers[i].fd, POLLIN, 0};
+				fds.push_back(fd);
+				polled.push_back(i);
+			}
+		if(fds.empty())
+			return;
+		if(poll(&fds[0], nfds_t(fds.size()), -1) < 0) {
+			if(errno == EINTR)
+				continue;
+			throw _FarmException("poll failed");
+		}
+		for(size_t j=0; j<fds.size(); ++j)
+			if(fds[j].revents != 0)
+				_receive_shard(farm, polled[j]);
+	}
+}
+#endif // _WIN32
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions implementation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Bake farm
+GLint farm_bake(const std::vector<FarmJob>& jobs,
+                const FarmParameters& parameters,
+                std::ostream& logStream,
+                std::vector<FarmResult>& results) throw(fw::FWException) {
+	FW_PROFILE_SCOPE("farm_bake");
+	if(parameters.workerCnt < 1 || parameters.maxAttempts < 1)
+		throw _FarmException("needs a worker and an attempt");
+	const FarmResult pending = {false, 0.0, 0, 0, 0};
+	results.assign(jobs.size(), pending);
+#ifdef _WIN32
+	// no fork: bake in process, the views are rasterized in parallel
+	GLint failedCnt = 0;
+	for(size_t i=0; i<jobs.size(); ++i)
+		try {
+			const GLuint64 startTime = fw::clock_nanoseconds();
+			Mesh mesh;
+			Atlas atlas;
+			AtlasCheckpoint checkpoint;
+			checkpoint.filename = checkpoint_file(jobs[i].cacheFile);
+			load_mesh(jobs[i].meshFile, mesh);
+			results[i].resumedLayers = bake_atlas(mesh,
+			                                      parameters.viewN,
+			                                      parameters.resolution,
+			                                      parameters.normals,
+			                                      parameters.mipmapFilter,
+			                                      checkpoint.filename,
+			                                      NULL,
+			                                      atlas);
+			_save_job(jobs[i], parameters, checkpoint, atlas);
+			results[i].baked = true;
+			results[i].seconds = 1e-9*(fw::clock_nanoseconds()-startTime);
+			for(size_t j=0; j<atlas.levels.size(); ++j)
+				results[i].bytes+= atlas.levels[j].size();
+			logStream << "farm: " << jobs[i].meshFile << " baked" << std::endl;
+		}
+		catch(fw::FWException& e) {
+			logStream << "farm: " << jobs[i].meshFile << " failed: "
+			          << e.what() << std::endl;
+			++failedCnt;
+		}
+	return failedCnt;
+#else
+	const GLint viewCnt = view_count(parameters.viewN);
+	const GLint shardViews = parameters.shardViews > 0
+	                       ? std::min(parameters.shardViews, viewCnt)
+	                       : viewCnt;
+	_Farm farm;
+	farm.jobs = &jobs;
+	farm.parameters = &parameters;
+	farm.log = &logStream;
+	farm.results = &results;
+	farm.failedCnt = 0;
+	farm.states.resize(jobs.size());
+	for(size_t i=0; i<jobs.size(); ++i) {
+		_JobState& state = farm.states[i];
+		state.pendingShards = 0;
+		state.started = state.failed = false;
+		for(GLint first=0; first<viewCnt; first+=shardViews) {
+			_Shard shard = {GLint(i), first,
+			                std::min(shardViews, viewCnt-first), 0};
+			farm.shards.push_back(shard);
+			++state.pendingShards;
+		}
+	}
+	_Worker idle = _Worker();
+	idle.fd = -1;
+	farm.workers.resize(std::min(parameters.workerCnt,
+	                             std::max(GLint(farm.shards.size()), 1)),
+	                    idle);
+
+	// writes to dead workers fail instead of raising SIGPIPE
+	void (*pipeHandler)(int) = signal(SIGPIPE, SIG_IGN);
+	logStream.flush();
+	try {
+		_run_farm(farm);
+	}
+	catch(fw::FWException& e) {
+		for(size_t i=0; i<farm.workers.size(); ++i)
+			_stop_worker(farm, i, true);
+		signal(SIGPIPE, pipeHandler);
+		throw;
+	}
+	for(size_t i=0; i<farm.workers.size(); ++i)
+		_stop_worker(farm, i, false);
+	signal(SIGPIPE, pipeHandler);
+	return farm.failedCnt;
+#endif // _WIN32
+}
+
+} // namespace lf
+
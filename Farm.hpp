@@ -0,0 +1,68 @@
+////////////////////////////////////////////////////////////////////////////////
+// \author J Dupuy
+// \brief Bake farm: bakes the atlases of many assets with a pool of worker
+// processes, each rasterizing shards of views sent over a local socket.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef FARM_HPP
+#define FARM_HPP
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include "Framework.hpp"
+
+namespace lf {
+	// Asset of a bake: an OBJ file and the cache file of its atlas
+	struct FarmJob {
+		std::string meshFile;
+		std::string cacheFile;
+	};
+
+
+	// Bake farm parameters. The atlas parameters are those of bake_atlas
+	// and compress_atlas.
+	struct FarmParameters {
+		GLint   workerCnt;    // worker processes
+		GLint   shardViews;   // views per shard, 0 for whole assets
+		GLint   maxAttempts;  // of a shard before its asset fails
+		GLint   viewN;
+		GLsizei resolution;
+		GLint   normals;      // NORMAL_*
+		GLenum  mipmapFilter; // fw::MIPMAP_FILTER_*
+		GLint   format;       // FORMAT_*
+		GLint   quality;      // fw::BC_QUALITY_*
+	};
+
+
+	// Outcome of a job
+	struct FarmResult {
+		bool     baked;
+		GLdouble seconds;       // from its first shard to its cache file
+		GLint    resumedLayers; // read from its checkpoint
+		GLint    retries;       // of its shards
+		GLuint64 bytes;         // of its mip levels, as stored
+	};
+
+
+	// Bake the atlas of each job and write its cache file. Shards of views
+	// are sent to workerCnt forked worker processes (which rasterize them
+	// one view at a time), their layers are assembled in the atlas of
+	// their job, and the mip levels are built and compressed once all of
+	// them are in, so that the cache files match bake_atlas. A shard whose
+	// worker dies or fails is sent again, to a fresh worker if needed.
+	// Layers are checkpointed next to the cache files as shards come in,
+	// so that an interrupted bake resumes.
+	// Progress and failures are logged to logStream and the outcome of
+	// each job is written to results. Returns the number of jobs that
+	// failed. Without fork (Windows), jobs are baked in process.
+	GLint farm_bake(const std::vector<FarmJob>& jobs,
+	                const FarmParameters& parameters,
+	                std::ostream& logStream,
+	                std::vector<FarmResult>& results) throw(fw::FWException);
+
+} // namespace lf
+
+#endif
+
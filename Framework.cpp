@@ -6,21 +6,34 @@
 #include "Framework.hpp"
 
 #include <fstream> // std::ifstream
-#include <climits> // CHAR_BIT
+#include <climits> // CHAR_BIT INT_MAX
 #include <cstring> // memcpy
 #include <sstream> // std::stringstream
 #include <algorithm> // std::min std::max
+#include <cmath>     // sin sqrt
 
 #ifdef _WIN32
 #	define NOMINMAX
 #	include <windows.h>
 #	include <winbase.h>
 #else
-#	include <sys/time.h>
+#	include <time.h>     // clock_gettime
+#	include <sys/stat.h> // mkdir
+#	include <unistd.h>  // sysconf usleep
+#	include <pthread.h>
 #endif // _WIN32
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define _FW_SSE2
+#	include <emmintrin.h>
+#endif
+
 #ifndef _NO_PNG
 #	include "png.h"
+extern "C" {
+#	include "cpu_features.h" // SIMD paths of zlib's crc32 and adler32
+}
 #endif
 
 namespace fw {
@@ -49,6 +62,20 @@ public:
 	}
 };
 
+class _BackgroundTaskException : public FWException {
+public:
+	_BackgroundTaskException(const std::string& reason) {
+		mMessage = "Background task: " + reason;
+	}
+};
+
+class _UniformRingException : public FWException {
+public:
+	_UniformRingException(const std::string& reason) {
+		mMessage = "Uniform ring: " + reason;
+	}
+};
+
 class _FileNotFoundException : public FWException {
 public:
 	_FileNotFoundException(const std::string& file) {
@@ -133,6 +160,13 @@ public:
 	}
 };
 
+class _UnsupportedPixelFormatException : public FWException {
+public:
+	_UnsupportedPixelFormatException() {
+		mMessage = "Unsupported pixel format or type.";
+	}
+};
+
 #ifndef _NO_PNG
 class _PngInvalidHeaderException : public FWException {
 public:
@@ -187,24 +221,9 @@ public:
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// Get time
+// Get time (in seconds)
 static GLdouble _get_ticks() {
-#ifdef _WIN32
-	__int64 time;
-	__int64 cpuFrequency;
-	QueryPerformanceCounter((LARGE_INTEGER*) &time);
-	QueryPerformanceFrequency((LARGE_INTEGER*) &cpuFrequency);
-	return time / static_cast<GLdouble>(cpuFrequency);
-#else
-	static GLdouble t0 = 0.0;
-	timeval tv;
-	gettimeofday(&tv, 0);
-	if (!t0) 
-		t0 = tv.tv_sec;
-
-	return   static_cast<GLdouble>(tv.tv_sec-t0)
-	       + static_cast<GLdouble>(tv.tv_usec) / 1e6;
-#endif
+	return static_cast<GLdouble>(clock_nanoseconds()) * 1e-9;
 }
 
 
@@ -234,6 +253,102 @@ static void _attach_shader(GLuint program,
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Program binary cache
+// A cache file holds a header (the magic, the key, the binary format and
+// size) followed by the binary.
+static const GLuint _PROGRAM_CACHE_MAGIC = 0x42504746u; // "FGPB"
+static std::string _programCacheDirectory;
+static GLint _programCacheLoads  = 0;
+static GLint _programCacheStores = 0;
+
+// 64-bit FNV-1a hash
+static GLuint64 _fnv1a(GLuint64 hash, const GLvoid *data, size_t size) {
+	const GLubyte *bytes = reinterpret_cast<const GLubyte*>(data);
+	for(size_t i=0; i<size; ++i) {
+		hash^= bytes[i];
+		hash*= 0x100000001B3ull;
+	}
+	return hash;
+}
+
+static GLuint64 _fnv1a(GLuint64 hash, const GLubyte *string) {
+	return string ? _fnv1a(hash, string, strlen((const char*)string)) : hash;
+}
+
+// Get the cache file of a key
+static std::string _program_cache_file(GLuint64 key) {
+	std::stringstream filename;
+	filename << _programCacheDirectory;
+	filename.width(16);
+	filename.fill('0');
+	filename << std::hex << key << ".bin";
+	return filename.str();
+}
+
+// Load and link a cached program, returns false if there is no cache
+// file or if the driver rejects the binary
+static bool _load_program_binary(GLuint program, GLuint64 key) {
+	std::ifstream file(_program_cache_file(key).c_str(),
+	                   std::ifstream::in | std::ifstream::binary);
+	GLuint magic = 0;
+	GLuint64 fileKey = 0;
+	GLenum format = 0;
+	GLint length = 0;
+	file.read(reinterpret_cast<char*>(&magic), sizeof(GLuint));
+	file.read(reinterpret_cast<char*>(&fileKey), sizeof(GLuint64));
+	file.read(reinterpret_cast<char*>(&format), sizeof(GLenum));
+	file.read(reinterpret_cast<char*>(&length), sizeof(GLint));
+	if(!file || magic != _PROGRAM_CACHE_MAGIC || fileKey != key
+	|| length <= 0)
+		return false;
+	std::vector<GLubyte> binary(length);
+	file.read(reinterpret_cast<char*>(&binary[0]), length);
+	if(!file)
+		return false;
+
+	// skip formats the driver no longer lists, rather than raising an error
+	GLint formatCnt = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCnt);
+	std::vector<GLint> formats(std::max(formatCnt, 1), 0);
+	glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, &formats[0]);
+	if(std::find(formats.begin(), formats.begin()+formatCnt, GLint(format))
+	   == formats.begin()+formatCnt)
+		return false;
+
+	// read the error of glProgramBinary once, instead of draining the
+	// errors of earlier calls that check_gl_error reports
+	glProgramBinary(program, format, &binary[0], length);
+	const GLenum error = glGetError();
+	GLint linkStatus = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+	return error == GL_NO_ERROR && linkStatus == GL_TRUE;
+}
+
+// Store a linked program (failures are ignored)
+static void _store_program_binary(GLuint program, GLuint64 key) {
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if(length <= 0)
+		return;
+	std::vector<GLubyte> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, NULL, &format, &binary[0]);
+	if(glGetError() != GL_NO_ERROR)
+		return;
+	std::ofstream file(_program_cache_file(key).c_str(),
+	                   std::ofstream::out | std::ofstream::binary);
+	file.write(reinterpret_cast<const char*>(&_PROGRAM_CACHE_MAGIC),
+	           sizeof(GLuint));
+	file.write(reinterpret_cast<const char*>(&key), sizeof(GLuint64));
+	file.write(reinterpret_cast<const char*>(&format), sizeof(GLenum));
+	file.write(reinterpret_cast<const char*>(&length), sizeof(GLint));
+	file.write(reinterpret_cast<const char*>(&binary[0]), length);
+	if(file)
+		++_programCacheStores;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Convert GL error code to string
 static const std::string _gl_error_to_string(GLenum error) {
@@ -474,8 +589,812 @@ static GLvoid _save_gl_buffer(GLint x,
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// parallel_for internals
+struct _ParallelForTask {
+	GLvoid (*func)(GLint, GLvoid*);
+	GLvoid *data;
+	GLint count;
+	volatile GLint next;
+};
+
+static GLint _fetch_and_increment(volatile GLint *value) {
+#ifdef _WIN32
+	return InterlockedIncrement(reinterpret_cast<volatile LONG*>(value)) - 1;
+#else
+	return __sync_fetch_and_add(value, 1);
+#endif
+}
+
+static GLvoid _parallel_for_work(_ParallelForTask *task) {
+	GLint i;
+	while((i = _fetch_and_increment(&task->next)) < task->count)
+		task->func(i, task->data);
+}
+
+// Persistent worker threads, started by the first parallel_for. Workers
+// join the published task, if any, each time the generation changes.
+struct _ThreadPool {
+#ifdef _WIN32
+	CRITICAL_SECTION mutex;
+	CONDITION_VARIABLE wake;
+	CONDITION_VARIABLE idle;
+#else
+	pthread_mutex_t mutex;
+	pthread_cond_t wake;
+	pthread_cond_t idle;
+#endif
+	_ParallelForTask *task; // NULL when no task accepts workers
+	GLuint generation;
+	GLint workerCnt;
+	GLint active;           // workers inside a task
+	bool busy;              // a parallel_for is running
+};
+
+static _ThreadPool _pool;
+
+static GLvoid _pool_lock() {
+#ifdef _WIN32
+	EnterCriticalSection(&_pool.mutex);
+#else
+	pthread_mutex_lock(&_pool.mutex);
+#endif
+}
+
+static GLvoid _pool_unlock() {
+#ifdef _WIN32
+	LeaveCriticalSection(&_pool.mutex);
+#else
+	pthread_mutex_unlock(&_pool.mutex);
+#endif
+}
+
+static GLvoid _pool_worker() {
+	GLuint generation = 0;
+	_pool_lock();
+	for(;;) {
+		while(_pool.generation == generation)
+#ifdef _WIN32
+			SleepConditionVariableCS(&_pool.wake, &_pool.mutex, INFINITE);
+#else
+			pthread_cond_wait(&_pool.wake, &_pool.mutex);
+#endif
+		generation = _pool.generation;
+		if(!_pool.task)
+			continue; // woke up too late
+		_ParallelForTask *task = _pool.task;
+		++_pool.active;
+		_pool_unlock();
+		_parallel_for_work(task);
+		_pool_lock();
+		if(--_pool.active == 0)
+#ifdef _WIN32
+			WakeAllConditionVariable(&_pool.idle);
+#else
+			pthread_cond_broadcast(&_pool.idle);
+#endif
+	}
+}
+
+#ifdef _WIN32
+static DWORD WINAPI _pool_thread(LPVOID) {
+	_pool_worker();
+	return 0;
+}
+
+static BOOL CALLBACK _pool_init(PINIT_ONCE, PVOID, PVOID*) {
+#else
+static void* _pool_thread(void*) {
+	_pool_worker();
+	return NULL;
+}
+
+static void _pool_init() {
+#endif
+	_pool.task = NULL;
+	_pool.generation = 0;
+	_pool.active = 0;
+	_pool.busy = false;
+	_pool.workerCnt = 0;
+#ifdef _WIN32
+	InitializeCriticalSection(&_pool.mutex);
+	InitializeConditionVariable(&_pool.wake);
+	InitializeConditionVariable(&_pool.idle);
+	for(GLint i=1; i<hardware_thread_count(); ++i) {
+		HANDLE thread = CreateThread(NULL, 0, &_pool_thread, NULL, 0, NULL);
+		if(thread) {
+			CloseHandle(thread);
+			++_pool.workerCnt;
+		}
+	}
+	return TRUE;
+#else
+	pthread_mutex_init(&_pool.mutex, NULL);
+	pthread_cond_init(&_pool.wake, NULL);
+	pthread_cond_init(&_pool.idle, NULL);
+	for(GLint i=1; i<hardware_thread_count(); ++i) {
+		pthread_t thread;
+		if(0 == pthread_create(&thread, NULL, &_pool_thread, NULL)) {
+			pthread_detach(thread);
+			++_pool.workerCnt;
+		}
+	}
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Profiling internals
+struct _ProfileSpan {
+	const char *name;
+	GLdouble start;
+	GLdouble stop;
+};
+
+// Spans of a thread (or of the GPU), written by their owner only: a span
+// is published by incrementing head once it is written.
+struct _ProfileRing {
+	std::vector<_ProfileSpan> spans; // PROFILE_RING_SIZE
+	volatile GLuint head;            // spans recorded since the last clear
+	GLint track;                     // thread number, -1 for the GPU
+};
+
+static volatile bool _profiling = false;
+static std::vector<_ProfileRing*> _profileRings; // never released
+static GLint _profileThreadCnt = 0;
+#ifdef _WIN32
+static SRWLOCK _profileLock = SRWLOCK_INIT;
+static __declspec(thread) _ProfileRing *_threadRing = NULL;
+#else
+static pthread_mutex_t _profileLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread _ProfileRing *_threadRing = NULL;
+#endif
+
+static GLvoid _profile_lock() {
+#ifdef _WIN32
+	AcquireSRWLockExclusive(&_profileLock);
+#else
+	pthread_mutex_lock(&_profileLock);
+#endif
+}
+
+static GLvoid _profile_unlock() {
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(&_profileLock);
+#else
+	pthread_mutex_unlock(&_profileLock);
+#endif
+}
+
+static GLvoid _memory_barrier() {
+#ifdef _WIN32
+	MemoryBarrier();
+#else
+	__sync_synchronize();
+#endif
+}
+
+// register a new ring (once per thread)
+static _ProfileRing *_new_profile_ring(bool gpu) {
+	_ProfileRing *ring = new _ProfileRing;
+	ring->spans.resize(PROFILE_RING_SIZE);
+	ring->head = 0;
+	_profile_lock();
+	ring->track = gpu ? -1 : _profileThreadCnt++;
+	_profileRings.push_back(ring);
+	_profile_unlock();
+	return ring;
+}
+
+static GLvoid _push_profile_span(_ProfileRing *ring,
+                                 const char *name,
+                                 GLdouble start,
+                                 GLdouble stop) {
+	_ProfileSpan& span = ring->spans[ring->head & (PROFILE_RING_SIZE-1)];
+	span.name  = name;
+	span.start = start;
+	span.stop  = stop;
+	_memory_barrier();
+	ring->head = ring->head + 1;
+}
+
+// write a string as a JSON string
+static GLvoid _write_json_string(std::ostream& stream, const char *str) {
+	stream << '"';
+	for(; *str; ++str) {
+		if(*str == '"' || *str == '\\')
+			stream << '\\' << *str;
+		else if(GLubyte(*str) >= 0x20)
+			stream << *str;
+	}
+	stream << '"';
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Resource tracker internals
+struct _Resource {
+	GLuint64 bytes;
+	GLenum format;
+	GLint levels;
+	std::string owner;
+};
+
+typedef std::map<std::pair<GLint, GLuint64>, _Resource> _ResourceMap;
+
+static _ResourceMap _resources;
+static GLuint64 _resourceLive[RESOURCE_COUNT+1]; // kinds, then GL objects
+static GLuint64 _resourcePeak[RESOURCE_COUNT+1];
+#ifdef _WIN32
+static SRWLOCK _resourceLock = SRWLOCK_INIT;
+#else
+static pthread_mutex_t _resourceLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static GLvoid _resource_lock() {
+#ifdef _WIN32
+	AcquireSRWLockExclusive(&_resourceLock);
+#else
+	pthread_mutex_lock(&_resourceLock);
+#endif
+}
+
+static GLvoid _resource_unlock() {
+#ifdef _WIN32
+	ReleaseSRWLockExclusive(&_resourceLock);
+#else
+	pthread_mutex_unlock(&_resourceLock);
+#endif
+}
+
+// add (or remove) bytes to the totals of a kind (lock held)
+static GLvoid _add_resource_bytes(GLint kind, GLuint64 bytes, bool remove) {
+	const GLint totals[2] = {kind, RESOURCE_GL};
+	const GLint totalCnt = kind == RESOURCE_HOST ? 1 : 2;
+	for(GLint i=0; i<totalCnt; ++i) {
+		GLuint64& live = _resourceLive[totals[i]];
+		live = remove ? live - bytes : live + bytes;
+		_resourcePeak[totals[i]] = std::max(_resourcePeak[totals[i]], live);
+	}
+}
+
+// bits per texel of the bound texture or renderbuffer, from its sizes
+static GLint _texel_bits(GLenum target, GLint level, bool renderbuffer) {
+	const GLenum sizes[][2] = {
+		{GL_TEXTURE_RED_SIZE,     GL_RENDERBUFFER_RED_SIZE},
+		{GL_TEXTURE_GREEN_SIZE,   GL_RENDERBUFFER_GREEN_SIZE},
+		{GL_TEXTURE_BLUE_SIZE,    GL_RENDERBUFFER_BLUE_SIZE},
+		{GL_TEXTURE_ALPHA_SIZE,   GL_RENDERBUFFER_ALPHA_SIZE},
+		{GL_TEXTURE_DEPTH_SIZE,   GL_RENDERBUFFER_DEPTH_SIZE},
+		{GL_TEXTURE_STENCIL_SIZE, GL_RENDERBUFFER_STENCIL_SIZE}
+	};
+	GLint bits = 0;
+	for(GLint i=0; i<6; ++i) {
+		GLint size = 0;
+		if(renderbuffer)
+			glGetRenderbufferParameteriv(target, sizes[i][1], &size);
+		else
+			glGetTexLevelParameteriv(target, level, sizes[i][0], &size);
+		bits+= size;
+	}
+	if(!renderbuffer) { // shared exponent
+		GLint shared = 0;
+		glGetTexLevelParameteriv(target, level, GL_TEXTURE_SHARED_SIZE, &shared);
+		bits+= shared;
+	}
+	return bits;
+}
+
+// texture binding of a target
+static GLenum _texture_binding(GLenum target) {
+	switch(target) {
+		case GL_TEXTURE_1D:       return GL_TEXTURE_BINDING_1D;
+		case GL_TEXTURE_1D_ARRAY: return GL_TEXTURE_BINDING_1D_ARRAY;
+		case GL_TEXTURE_2D:       return GL_TEXTURE_BINDING_2D;
+		case GL_TEXTURE_2D_ARRAY: return GL_TEXTURE_BINDING_2D_ARRAY;
+		case GL_TEXTURE_3D:       return GL_TEXTURE_BINDING_3D;
+		case GL_TEXTURE_RECTANGLE: return GL_TEXTURE_BINDING_RECTANGLE;
+		case GL_TEXTURE_CUBE_MAP: return GL_TEXTURE_BINDING_CUBE_MAP;
+		case GL_TEXTURE_CUBE_MAP_ARRAY:
+			return GL_TEXTURE_BINDING_CUBE_MAP_ARRAY;
+		case GL_TEXTURE_2D_MULTISAMPLE:
+			return GL_TEXTURE_BINDING_2D_MULTISAMPLE;
+		case GL_TEXTURE_2D_MULTISAMPLE_ARRAY:
+			return GL_TEXTURE_BINDING_2D_MULTISAMPLE_ARRAY;
+		default: return 0;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Mipmap internals
+// Images are filtered in RGBA float, one pixel per SSE register, with
+// separable filters whose taps are precomputed for each output coordinate.
+struct _MipTaps {
+	std::vector<GLint>   first;   // first source texel (unclamped)
+	std::vector<GLint>   count;   // number of taps
+	std::vector<GLint>   offset;  // offset in weights
+	std::vector<GLfloat> weights;
+};
+
+static GLint _pixel_format_channels(GLenum pixelFormat) {
+	switch(pixelFormat) {
+	case GL_RED:  return 1;
+	case GL_RG:   return 2;
+	case GL_RGB:
+	case GL_BGR:  return 3;
+	case GL_RGBA:
+	case GL_BGRA: return 4;
+	default:      return 0;
+	}
+}
+
+static GLint _pixel_type_size(GLenum pixelType) {
+	switch(pixelType) {
+	case GL_UNSIGNED_BYTE:  return 1;
+	case GL_UNSIGNED_SHORT:
+	case GL_HALF_FLOAT:     return 2;
+	default:                return 0;
+	}
+}
+
+static GLdouble _bessel_i0(GLdouble x) {
+	GLdouble sum = 1.0, term = 1.0;
+	for(GLint k=1; k<32 && term > sum*1e-12; ++k) {
+		term*= (x*0.5/k)*(x*0.5/k);
+		sum += term;
+	}
+	return sum;
+}
+
+static GLdouble _sinc(GLdouble x) {
+	if(fabs(x) < 1e-6)
+		return 1.0;
+	const GLdouble PI = 3.14159265358979323846;
+	return sin(PI*x)/(PI*x);
+}
+
+// Kaiser windowed sinc, as in the NVIDIA texture tools
+static GLdouble _kaiser(GLdouble x, GLdouble width) {
+	const GLdouble ALPHA = 4.0;
+	GLdouble t = x / width;
+	if(t*t >= 1.0)
+		return 0.0;
+	return _sinc(x) * _bessel_i0(ALPHA*sqrt(1.0-t*t)) / _bessel_i0(ALPHA);
+}
+
+static GLvoid _build_mip_taps(GLint srcSize,
+                              GLint dstSize,
+                              GLenum filter,
+                              _MipTaps& taps) {
+	const GLdouble KAISER_WIDTH = 2.0; // in destination texels
+	const GLdouble scale = GLdouble(srcSize) / dstSize;
+	const GLdouble radius = filter == MIPMAP_FILTER_KAISER
+	                      ? KAISER_WIDTH*scale : 0.5*scale;
+	taps.first.resize(dstSize);
+	taps.count.resize(dstSize);
+	taps.offset.resize(dstSize);
+	taps.weights.resize(0);
+	for(GLint x=0; x<dstSize; ++x) {
+		GLdouble centre = (x+0.5)*scale;
+		GLint first = GLint(floor(centre-radius));
+		GLint last  = GLint(ceil(centre+radius));
+		GLdouble sum = 0.0;
+		taps.first[x]  = first;
+		taps.count[x]  = last-first;
+		taps.offset[x] = GLint(taps.weights.size());
+		for(GLint i=first; i<last; ++i) {
+			GLdouble w;
+			if(filter == MIPMAP_FILTER_KAISER)
+				w = _kaiser((i+0.5-centre)/scale, KAISER_WIDTH);
+			else // coverage of [i,i+1] by the box
+				w = std::max(0.0, std::min(i+1.0, centre+radius)
+				                - std::max(GLdouble(i), centre-radius));
+			taps.weights.push_back(GLfloat(w));
+			sum+= w;
+		}
+		for(GLint i=0; i<last-first; ++i)
+			taps.weights[taps.offset[x]+i]/= GLfloat(sum);
+	}
+}
+
+// dst[x] = sum_i w_i * src[clamp(first+i)*stride]
+static inline GLvoid _filter_rgba(const GLfloat *src,
+                                  GLint srcSize,
+                                  GLint stride,
+                                  GLint first,
+                                  GLint count,
+                                  const GLfloat *weights,
+                                  GLfloat *dst) {
+#ifdef _FW_SSE2
+	__m128 acc = _mm_setzero_ps();
+	for(GLint i=0; i<count; ++i) {
+		GLint j = std::min(std::max(first+i, 0), srcSize-1);
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(weights[i]),
+		                                 _mm_loadu_ps(src+j*stride)));
+	}
+	_mm_storeu_ps(dst, acc);
+#else
+	dst[0] = dst[1] = dst[2] = dst[3] = 0.0f;
+	for(GLint i=0; i<count; ++i) {
+		const GLfloat *p = src+std::min(std::max(first+i, 0), srcSize-1)*stride;
+		dst[0]+= weights[i]*p[0];
+		dst[1]+= weights[i]*p[1];
+		dst[2]+= weights[i]*p[2];
+		dst[3]+= weights[i]*p[3];
+	}
+#endif
+}
+
+struct _MipmapTask {
+	GLsizei width, height;
+	GLint channels, typeSize;
+	GLenum pixelType, filter;
+	GLboolean alphaWeighted;
+	std::vector< std::vector<GLubyte> > *levels;
+};
+
+static GLvoid _decode_pixels(const _MipmapTask& task,
+                             const GLubyte *src,
+                             GLint pixelCnt,
+                             GLfloat *dst) {
+	const GLint c = task.channels;
+	for(GLint i=0; i<pixelCnt; ++i) {
+		GLfloat *p = dst+4*i;
+		p[0] = p[1] = p[2] = 0.0f;
+		p[3] = 1.0f;
+		for(GLint k=0; k<c; ++k) {
+			if(task.pixelType == GL_UNSIGNED_BYTE)
+				p[k] = src[c*i+k] / 255.0f;
+			else if(task.pixelType == GL_UNSIGNED_SHORT)
+				p[k] = reinterpret_cast<const GLushort*>(src)[c*i+k] / 65535.0f;
+			else
+				p[k] = half_to_float(reinterpret_cast<const GLhalf*>(src)[c*i+k]);
+		}
+		if(task.alphaWeighted) {
+			p[0]*= p[3];
+			p[1]*= p[3];
+			p[2]*= p[3];
+		}
+	}
+}
+
+static GLvoid _encode_pixels(const _MipmapTask& task,
+                             const GLfloat *src,
+                             GLint pixelCnt,
+                             GLubyte *dst) {
+	const GLint c = task.channels;
+	const GLboolean normalized = task.pixelType != GL_HALF_FLOAT;
+	for(GLint i=0; i<pixelCnt; ++i) {
+		GLfloat p[4] = {src[4*i], src[4*i+1], src[4*i+2], src[4*i+3]};
+		if(task.alphaWeighted) {
+			p[3] = std::max(p[3], 0.0f);
+			GLfloat invAlpha = p[3] > 1e-5f ? 1.0f/p[3] : 0.0f;
+			p[0]*= invAlpha;
+			p[1]*= invAlpha;
+			p[2]*= invAlpha;
+		}
+		for(GLint k=0; k<c; ++k) {
+			GLfloat v = normalized ? std::min(std::max(p[k], 0.0f), 1.0f)
+			                       : p[k];
+			if(task.pixelType == GL_UNSIGNED_BYTE)
+				dst[c*i+k] = GLubyte(v*255.0f+0.5f);
+			else if(task.pixelType == GL_UNSIGNED_SHORT)
+				reinterpret_cast<GLushort*>(dst)[c*i+k] = GLushort(v*65535.0f+0.5f);
+			else
+				reinterpret_cast<GLhalf*>(dst)[c*i+k] = float_to_half(v);
+		}
+	}
+}
+
+// Builds all the levels of one layer
+static GLvoid _build_layer_mipmaps(GLint layer, GLvoid *data) {
+	const _MipmapTask& task = *reinterpret_cast<_MipmapTask*>(data);
+	std::vector< std::vector<GLubyte> >& levels = *task.levels;
+	const GLint pixelSize = task.channels*task.typeSize;
+	GLsizei w = task.width, h = task.height;
+	std::vector<GLfloat> src(4*w*h), tmp, dst;
+	_MipTaps tapsX, tapsY;
+
+	_decode_pixels(task, &levels[0][pixelSize*w*h*layer], w*h, &src[0]);
+	for(size_t level=1; level<levels.size(); ++level) {
+		GLsizei dw = std::max(w>>1, 1), dh = std::max(h>>1, 1);
+		_build_mip_taps(w, dw, task.filter, tapsX);
+		_build_mip_taps(h, dh, task.filter, tapsY);
+		tmp.resize(4*dw*h);
+		dst.resize(4*dw*dh);
+
+		// horizontal then vertical pass
+		for(GLint y=0; y<h; ++y)
+			for(GLint x=0; x<dw; ++x)
+				_filter_rgba(&src[4*w*y], w, 4,
+				             tapsX.first[x], tapsX.count[x],
+				             &tapsX.weights[tapsX.offset[x]],
+				             &tmp[4*(dw*y+x)]);
+		for(GLint y=0; y<dh; ++y)
+			for(GLint x=0; x<dw; ++x)
+				_filter_rgba(&tmp[4*x], h, 4*dw,
+				             tapsY.first[y], tapsY.count[y],
+				             &tapsY.weights[tapsY.offset[y]],
+				             &dst[4*(dw*y+x)]);
+
+		_encode_pixels(task, &dst[0], dw*dh,
+		               &levels[level][pixelSize*dw*dh*layer]);
+		src.swap(dst);
+		w = dw;
+		h = dh;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Block compression internals
+static const GLint _BC7_WEIGHTS[16] = {
+	0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64
+};
+
+// Little endian bit stream
+struct _BitWriter {
+	GLubyte *data;
+	GLint    pos;
+	GLvoid Write(GLuint value, GLint bitCnt) {
+		for(GLint i=0; i<bitCnt; ++i, ++pos)
+			data[pos>>3] |= GLubyte(((value >> i) & 1u) << (pos & 7));
+	}
+};
+
+struct _BitReader {
+	const GLubyte *data;
+	GLint          pos;
+	GLuint Read(GLint bitCnt) {
+		GLuint value = 0;
+		for(GLint i=0; i<bitCnt; ++i, ++pos)
+			value |= GLuint((data[pos>>3] >> (pos & 7)) & 1u) << i;
+		return value;
+	}
+};
+
+static GLvoid _bc4_palette(GLint r0, GLint r1, GLint palette[8]) {
+	palette[0] = r0;
+	palette[1] = r1;
+	if(r0 > r1) {
+		for(GLint i=0; i<6; ++i)
+			palette[2+i] = ((6-i)*r0 + (1+i)*r1 + 3) / 7;
+	}
+	else {
+		for(GLint i=0; i<4; ++i)
+			palette[2+i] = ((4-i)*r0 + (1+i)*r1 + 2) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+}
+
+// Returns the squared error, writes the best indices
+static GLint _bc4_fit(const GLint values[16],
+                      GLint r0,
+                      GLint r1,
+                      GLint indices[16]) {
+	GLint palette[8], error = 0;
+	_bc4_palette(r0, r1, palette);
+	for(GLint i=0; i<16; ++i) {
+		GLint best = 0, bestError = 256*256;
+		for(GLint j=0; j<8; ++j) {
+			GLint e = (values[i]-palette[j])*(values[i]-palette[j]);
+			if(e < bestError) {
+				bestError = e;
+				best = j;
+			}
+		}
+		indices[i] = best;
+		error+= bestError;
+	}
+	return error;
+}
+
+static GLint _bc7_quantize(GLfloat value, GLint pbit) {
+	GLint q = GLint(floor((value - pbit) * 0.5f + 0.5f));
+	return std::min(std::max(q, 0), 127);
+}
+
+// Mode 6 endpoints: 7 bits per channel plus one shared p-bit per endpoint
+struct _Bc7Endpoints {
+	GLint q[2][4];
+	GLint p[2];
+	GLvoid Set(const GLfloat e[2][4]) {
+		for(GLint k=0; k<2; ++k) {
+			GLfloat bestError = 1e30f;
+			for(GLint pbit=0; pbit<2; ++pbit) {
+				GLfloat error = 0.0f;
+				for(GLint c=0; c<4; ++c) {
+					GLfloat d = e[k][c]-((_bc7_quantize(e[k][c], pbit)<<1)|pbit);
+					error+= d*d;
+				}
+				if(error < bestError) {
+					bestError = error;
+					p[k] = pbit;
+				}
+			}
+			for(GLint c=0; c<4; ++c)
+				q[k][c] = _bc7_quantize(e[k][c], p[k]);
+		}
+	}
+	GLint Unquantized(GLint k, GLint c) const {
+		return (q[k][c] << 1) | p[k];
+	}
+};
+
+// Returns the squared error, writes the best indices
+static GLint _bc7_fit(const GLint texels[16][4],
+                      const _Bc7Endpoints& endpoints,
+                      GLint indices[16]) {
+	GLint palette[16][4], error = 0;
+	for(GLint i=0; i<16; ++i)
+		for(GLint c=0; c<4; ++c)
+			palette[i][c] = ((64-_BC7_WEIGHTS[i])*endpoints.Unquantized(0,c)
+			              + _BC7_WEIGHTS[i]*endpoints.Unquantized(1,c)
+			              + 32) >> 6;
+	for(GLint i=0; i<16; ++i) {
+		GLint best = 0, bestError = INT_MAX;
+		for(GLint j=0; j<16; ++j) {
+			GLint e = 0;
+			for(GLint c=0; c<4; ++c)
+				e+= (texels[i][c]-palette[j][c])*(texels[i][c]-palette[j][c]);
+			if(e < bestError) {
+				bestError = e;
+				best = j;
+			}
+		}
+		indices[i] = best;
+		error+= bestError;
+	}
+	return error;
+}
+
+// Least squares endpoints for fixed indices
+static GLvoid _bc7_refit(const GLint texels[16][4],
+                         const GLint indices[16],
+                         GLfloat e[2][4]) {
+	GLfloat aa = 0, ab = 0, bb = 0, ax[4] = {0}, bx[4] = {0};
+	for(GLint i=0; i<16; ++i) {
+		GLfloat b = _BC7_WEIGHTS[indices[i]] / 64.0f, a = 1.0f-b;
+		aa+= a*a;
+		ab+= a*b;
+		bb+= b*b;
+		for(GLint c=0; c<4; ++c) {
+			ax[c]+= a*texels[i][c];
+			bx[c]+= b*texels[i][c];
+		}
+	}
+	GLfloat det = aa*bb-ab*ab;
+	if(fabs(det) < 1e-6f)
+		return;
+	for(GLint c=0; c<4; ++c) {
+		e[0][c] = std::min(std::max((ax[c]*bb-bx[c]*ab)/det, 0.0f), 255.0f);
+		e[1][c] = std::min(std::max((bx[c]*aa-ax[c]*ab)/det, 0.0f), 255.0f);
+	}
+}
+
+struct _CompressTask {
+	GLsizei width, height;
+	GLint texelSize;
+	GLenum internalFormat;
+	GLint quality;
+	const GLubyte *src;
+	GLubyte *dst;
+	GLboolean decode;
+};
+
+// Encodes or decodes one row of blocks of one layer
+static GLvoid _compress_block_row(GLint row, GLvoid *data) {
+	const _CompressTask& task = *reinterpret_cast<_CompressTask*>(data);
+	const GLint blocksX = (task.width+3)/4, blocksY = (task.height+3)/4;
+	const GLint layer = row / blocksY, by = row % blocksY;
+	const GLint blockSize = task.internalFormat == GL_COMPRESSED_RED_RGTC1
+	                      ? 8 : 16;
+	const GLint layerTexels = task.width*task.height;
+	const GLint channels = blockSize == 8 ? 1 : task.internalFormat
+	                     == GL_COMPRESSED_RG_RGTC2 ? 2 : 4;
+	GLubyte texels[16*4];
+
+	for(GLint bx=0; bx<blocksX; ++bx) {
+		GLint blockOffset = blockSize*(blocksX*(blocksY*layer+by)+bx);
+		if(task.decode) {
+			const GLubyte *block = task.src+blockOffset;
+			if(task.internalFormat == GL_COMPRESSED_RED_RGTC1)
+				decode_bc4_block(block, 4, texels);
+			else if(task.internalFormat == GL_COMPRESSED_RG_RGTC2)
+				decode_bc5_block(block, 4, texels);
+			else
+				decode_bc7_block(block, 4, texels);
+		}
+		for(GLint i=0; i<16; ++i) {
+			GLint x = std::min(4*bx+(i&3), task.width-1);
+			GLint y = std::min(4*by+(i>>2), task.height-1);
+			GLint offset = task.texelSize*(layerTexels*layer+task.width*y+x);
+			for(GLint c=0; c<channels; ++c) {
+				if(task.decode) {
+					if(4*bx+(i&3) < task.width && 4*by+(i>>2) < task.height)
+						task.dst[offset+c] = texels[4*i+c];
+				}
+				else
+					texels[4*i+c] = task.src[offset+c];
+			}
+		}
+		if(!task.decode) {
+			GLubyte *block = task.dst+blockOffset;
+			if(task.internalFormat == GL_COMPRESSED_RED_RGTC1)
+				encode_bc4_block(texels, 4, task.quality, block);
+			else if(task.internalFormat == GL_COMPRESSED_RG_RGTC2)
+				encode_bc5_block(texels, 4, task.quality, block);
+			else
+				encode_bc7_block(texels, 4, task.quality, block);
+		}
+	}
+}
+
+static GLvoid _run_compress_task(_CompressTask& task,
+                                 GLsizei layerCnt) throw(FWException) {
+	if(task.internalFormat != GL_COMPRESSED_RED_RGTC1
+	&& task.internalFormat != GL_COMPRESSED_RG_RGTC2
+	&& task.internalFormat != GL_COMPRESSED_RGBA_BPTC_UNORM)
+		throw _UnsupportedPixelFormatException();
+	if(task.internalFormat == GL_COMPRESSED_RGBA_BPTC_UNORM
+	&& task.texelSize != 4)
+		throw _UnsupportedPixelFormatException();
+	if(task.texelSize < 1 || task.texelSize > 4 || (task.internalFormat
+	== GL_COMPRESSED_RG_RGTC2 && task.texelSize < 2))
+		throw _UnsupportedPixelFormatException();
+	parallel_for(layerCnt*((task.height+3)/4), &_compress_block_row, &task);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Generic texture uploads
+// Builds levels 1 and above of layerCnt images on the CPU and uploads them
+// to target (+layer for cube maps). 16 bit pixels are big endian.
+static GLvoid _tex_cpu_mipmaps2D(GLenum target,
+                                 GLsizei width,
+                                 GLsizei height,
+                                 GLsizei layerCnt,
+                                 const GLvoid* const *pixels,
+                                 GLenum internalFormat,
+                                 GLenum pixelFormat,
+                                 GLenum pixelType,
+                                 GLboolean immutable) throw(FWException) {
+	const GLint pixelSize = _pixel_format_channels(pixelFormat)
+	                      * _pixel_type_size(pixelType);
+	const GLint layerSize = pixelSize*width*height;
+	std::vector< std::vector<GLubyte> > levels(1);
+	levels[0].resize(layerSize*layerCnt);
+	for(GLint i=0; i<layerCnt; ++i)
+		memcpy(&levels[0][layerSize*i], pixels[i], layerSize);
+	if(pixelType == GL_UNSIGNED_SHORT) // to native byte order
+		for(size_t i=0; i<levels[0].size(); i+=2)
+			std::swap(levels[0][i], levels[0][i+1]);
+	build_mipmaps(width, height, layerCnt, pixelFormat, pixelType,
+	              MIPMAP_FILTER_BOX, GL_FALSE, levels);
+
+	GLint align(0), swapBytes(0);
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &align);
+	glGetIntegerv(GL_UNPACK_SWAP_BYTES, &swapBytes);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
+	for(size_t level=1; level<levels.size(); ++level) {
+		GLsizei w = std::max(width>>level, 1), h = std::max(height>>level, 1);
+		for(GLint i=0; i<layerCnt; ++i) {
+			const GLubyte *data = &levels[level][pixelSize*w*h*i];
+			if(immutable)
+				glTexSubImage2D(target+i, GLint(level), 0, 0, w, h,
+				                pixelFormat, pixelType, data);
+			else
+				glTexImage2D(target+i, GLint(level), internalFormat, w, h, 0,
+				             pixelFormat, pixelType, data);
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, align);
+	glPixelStorei(GL_UNPACK_SWAP_BYTES, swapBytes);
+}
+
 template <typename IMG_T>
 void tex_img_image2D(const std::string& filename,
                      GLboolean genMipmaps,
@@ -486,8 +1405,7 @@ void tex_img_image2D(const std::string& filename,
 		throw _ImmutableTexturesNotSupportedException();
 
 	IMG_T img(filename);
-	GLsizei size = std::max(img.Width(), img.Height());
-	GLint levels = !genMipmaps ? 1 : next_power_of_two_exponent(size);
+	GLint levels = !genMipmaps ? 1 : mip_level_count(img.Width(), img.Height());
 	GLenum internalFormat, pixelFormat;
 	extract_format_func(img, internalFormat, pixelFormat);
 
@@ -533,8 +1451,16 @@ void tex_img_image2D(const std::string& filename,
 	glPixelStorei(GL_UNPACK_ALIGNMENT,align);
 	glPixelStorei(GL_UNPACK_SWAP_BYTES,swapBytes);
 
-	if(genMipmaps == GL_TRUE)
-		glGenerateMipmap(GL_TEXTURE_2D);
+	if(genMipmaps == GL_TRUE) {
+		const GLvoid *pixels = img.Pixels();
+		_tex_cpu_mipmaps2D(GL_TEXTURE_2D,
+		                   img.Width(), img.Height(), 1,
+		                   &pixels,
+		                   internalFormat,
+		                   pixelFormat,
+		                   pixelData,
+		                   immutable);
+	}
 }
 
 template<typename IMG_T>
@@ -555,8 +1481,8 @@ void tex_img_cube_map(const std::string filenames[6],
 	IMG_T zneg(filenames[5]);
 	/// TODO check consistency
 
-	GLsizei size = std::max(xpos.Width(), xpos.Height());
-	GLint levels = !genMipmaps ? 1 : next_power_of_two_exponent(size);
+	GLint levels = !genMipmaps ? 1 : mip_level_count(xpos.Width(),
+	                                                 xpos.Height());
 	GLenum internalFormat, pixelFormat;
 	extract_format_func(xpos, internalFormat, pixelFormat);
 
@@ -611,7 +1537,13 @@ void tex_img_cube_map(const std::string filenames[6],
 	glPixelStorei(GL_UNPACK_SWAP_BYTES,swapBytes);
 
 	if(genMipmaps == GL_TRUE)
-		glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+		_tex_cpu_mipmaps2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X,
+		                   xpos.Width(), xpos.Height(), 6,
+		                   dataPtr,
+		                   internalFormat,
+		                   pixelFormat,
+		                   pixelData,
+		                   immutable);
 }
 
 template<typename IMG_T>
@@ -730,6 +1662,497 @@ GLuint next_power_of_two_exponent(GLuint number) {
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Hardware threads
+GLint hardware_thread_count() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return std::max(GLint(info.dwNumberOfProcessors), 1);
+#else
+	return std::max(GLint(sysconf(_SC_NPROCESSORS_ONLN)), 1);
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Monotonic clock
+GLuint64 clock_nanoseconds() {
+#ifdef _WIN32
+	LARGE_INTEGER time, frequency;
+	QueryPerformanceCounter(&time);
+	QueryPerformanceFrequency(&frequency);
+	// split to avoid overflowing the product
+	const GLuint64 t = time.QuadPart, f = frequency.QuadPart;
+	return t / f * 1000000000u + t % f * 1000000000u / f;
+#else
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return GLuint64(ts.tv_sec) * 1000000000u + GLuint64(ts.tv_nsec);
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Parallel for
+GLvoid parallel_for(GLint count,
+                    GLvoid (*func)(GLint i, GLvoid *data),
+                    GLvoid *data) {
+	_ParallelForTask task = {func, data, count, 0};
+#ifdef _WIN32
+	static INIT_ONCE once = INIT_ONCE_STATIC_INIT;
+	InitOnceExecuteOnce(&once, &_pool_init, NULL, NULL);
+#else
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, &_pool_init);
+#endif
+
+	// publish the task, unless the pool already runs one (nested or
+	// concurrent calls run on the calling thread only)
+	bool shared = false;
+	if(count > 1 && _pool.workerCnt > 0) {
+		_pool_lock();
+		if(!_pool.busy) {
+			_pool.busy = shared = true;
+			_pool.task = &task;
+			++_pool.generation;
+#ifdef _WIN32
+			WakeAllConditionVariable(&_pool.wake);
+#else
+			pthread_cond_broadcast(&_pool.wake);
+#endif
+		}
+		_pool_unlock();
+	}
+	_parallel_for_work(&task); // the calling thread works too
+	if(!shared)
+		return;
+
+	// every index is taken, wait for the workers still inside the task
+	_pool_lock();
+	_pool.task = NULL;
+	while(_pool.active > 0)
+#ifdef _WIN32
+		SleepConditionVariableCS(&_pool.idle, &_pool.mutex, INFINITE);
+#else
+		pthread_cond_wait(&_pool.idle, &_pool.mutex);
+#endif
+	_pool.busy = false;
+	_pool_unlock();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Profiling
+GLvoid set_profiling(bool enabled) {
+	_profiling = enabled;
+}
+
+
+bool profiling() {
+	return _profiling;
+}
+
+
+GLdouble profile_ticks() {
+	return _get_ticks();
+}
+
+
+GLvoid profile_span(const char *name, GLdouble start, GLdouble stop) {
+	if(!_profiling)
+		return;
+	if(!_threadRing)
+		_threadRing = _new_profile_ring(false);
+	_push_profile_span(_threadRing, name, start, stop);
+}
+
+
+GLvoid clear_profile() {
+	_profile_lock();
+	for(size_t i=0; i<_profileRings.size(); ++i)
+		_profileRings[i]->head = 0;
+	_profile_unlock();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Save profile trace
+GLvoid save_profile_trace(const std::string& filename) throw(FWException) {
+	std::ofstream file(filename.c_str());
+	if(!file)
+		throw _FileNotFoundException(filename);
+
+	_profile_lock();
+	file << "{\"traceEvents\":[\n";
+	file << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,"
+	     << "\"args\":{\"name\":\"lightfield\"}}";
+	file.setf(std::ios::fixed);
+	file.precision(3);
+	for(size_t i=0; i<_profileRings.size(); ++i) {
+		const _ProfileRing& ring = *_profileRings[i];
+		// the GPU track goes last
+		GLint tid = ring.track < 0 ? _profileThreadCnt : ring.track;
+		file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+		     << "\"tid\":" << tid << ",\"args\":{\"name\":\"";
+		if(ring.track < 0)
+			file << "GPU";
+		else
+			file << "thread " << ring.track;
+		file << "\"}}";
+		file << ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":0,"
+		     << "\"tid\":" << tid << ",\"args\":{\"sort_index\":" << tid << "}}";
+
+		// spans, oldest first (timestamps in microseconds)
+		GLuint head = ring.head;
+		_memory_barrier();
+		GLuint first = head > GLuint(PROFILE_RING_SIZE)
+		             ? head - PROFILE_RING_SIZE : 0;
+		for(GLuint j=first; j<head; ++j) {
+			const _ProfileSpan& span = ring.spans[j & (PROFILE_RING_SIZE-1)];
+			file << ",\n{\"name\":";
+			_write_json_string(file, span.name);
+			file << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << tid
+			     << ",\"ts\":" << span.start*1e6
+			     << ",\"dur\":" << (span.stop-span.start)*1e6 << '}';
+		}
+	}
+	_profile_unlock();
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Mip level count
+GLint mip_level_count(GLsizei width, GLsizei height) {
+	GLint levels = 1;
+	for(GLsizei size = std::max(width, height); size > 1; size>>= 1)
+		++levels;
+	return levels;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Build mipmaps on the CPU
+GLvoid build_mipmaps(GLsizei width,
+                     GLsizei height,
+                     GLsizei layerCnt,
+                     GLenum pixelFormat,
+                     GLenum pixelType,
+                     GLenum filter,
+                     GLboolean alphaWeighted,
+                     std::vector< std::vector<GLubyte> >& levels)
+                     throw(FWException) {
+	_MipmapTask task;
+	task.width         = width;
+	task.height        = height;
+	task.channels      = _pixel_format_channels(pixelFormat);
+	task.typeSize      = _pixel_type_size(pixelType);
+	task.pixelType     = pixelType;
+	task.filter        = filter;
+	task.alphaWeighted = alphaWeighted && task.channels == 4;
+	task.levels        = &levels;
+	if(task.channels == 0 || task.typeSize == 0)
+		throw _UnsupportedPixelFormatException();
+	if(levels.empty() || levels[0].size() < size_t(task.channels
+	                                               * task.typeSize
+	                                               * width * height
+	                                               * layerCnt))
+		throw _NullParamException();
+
+	// allocate the levels, then fill them layer by layer
+	GLint levelCnt = mip_level_count(width, height);
+	levels.resize(levelCnt);
+	for(GLint i=1; i<levelCnt; ++i) {
+		GLsizei w = std::max(width>>i, 1), h = std::max(height>>i, 1);
+		levels[i].resize(task.channels*task.typeSize*w*h*layerCnt);
+	}
+	parallel_for(layerCnt, &_build_layer_mipmaps, &task);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Upload mipmaps
+GLvoid tex_mipmaps_image3D(GLsizei width,
+                           GLsizei height,
+                           GLsizei layerCnt,
+                           GLenum pixelFormat,
+                           GLenum pixelType,
+                           const std::vector< std::vector<GLubyte> >& levels) {
+	GLint align(0);
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &align);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	for(size_t i=0; i<levels.size(); ++i)
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY,
+		                GLint(i),
+		                0, 0, 0,
+		                std::max(width>>i, 1),
+		                std::max(height>>i, 1),
+		                layerCnt,
+		                pixelFormat,
+		                pixelType,
+		                &levels[i][0]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, align);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// BC4 (RGTC1) block encoding
+GLvoid encode_bc4_block(const GLubyte *texels,
+                        GLint stride,
+                        GLint quality,
+                        GLubyte block[8]) {
+	GLint values[16], indices[16], best[16];
+	GLint lo = 255, hi = 0, lo6 = 255, hi6 = 0;
+	for(GLint i=0; i<16; ++i) {
+		values[i] = texels[i*stride];
+		lo = std::min(lo, values[i]);
+		hi = std::max(hi, values[i]);
+		if(values[i] != 0 && values[i] != 255) { // 6 value mode extremes
+			lo6 = std::min(lo6, values[i]);
+			hi6 = std::max(hi6, values[i]);
+		}
+	}
+
+	// 8 value mode (r0 > r1) on the bounding range
+	GLint r0 = hi, r1 = lo;
+	GLint bestError = _bc4_fit(values, r0, r1, best);
+	if(quality >= BC_QUALITY_NORMAL && lo6 <= hi6) {
+		// 6 value mode (r0 <= r1), 0 and 255 are free
+		GLint error = _bc4_fit(values, lo6, hi6, indices);
+		if(error < bestError) {
+			bestError = error;
+			r0 = lo6;
+			r1 = hi6;
+			memcpy(best, indices, sizeof(best));
+		}
+	}
+	if(quality >= BC_QUALITY_HIGH && r0 > r1) {
+		// inset / outset the endpoints
+		const GLint hi0 = r0, lo0 = r1;
+		for(GLint d0=-4; d0<=4 && bestError > 0; ++d0)
+			for(GLint d1=-4; d1<=4; ++d1) {
+				GLint e0 = std::min(std::max(hi0+d0, 0), 255);
+				GLint e1 = std::min(std::max(lo0+d1, 0), 255);
+				if(e0 <= e1)
+					continue;
+				GLint error = _bc4_fit(values, e0, e1, indices);
+				if(error < bestError) {
+					bestError = error;
+					r0 = e0;
+					r1 = e1;
+					memcpy(best, indices, sizeof(best));
+				}
+			}
+	}
+
+	memset(block, 0, 8);
+	_BitWriter writer = {block, 0};
+	writer.Write(r0, 8);
+	writer.Write(r1, 8);
+	for(GLint i=0; i<16; ++i)
+		writer.Write(best[i], 3);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// BC5 (RGTC2) block encoding
+GLvoid encode_bc5_block(const GLubyte *texels,
+                        GLint stride,
+                        GLint quality,
+                        GLubyte block[16]) {
+	encode_bc4_block(texels, stride, quality, block);
+	encode_bc4_block(texels+1, stride, quality, block+8);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// BC7 block encoding (mode 6)
+GLvoid encode_bc7_block(const GLubyte *texels,
+                        GLint stride,
+                        GLint quality,
+                        GLubyte block[16]) {
+	GLint values[16][4], indices[16];
+	GLfloat e[2][4], mean[4] = {0,0,0,0};
+	for(GLint i=0; i<16; ++i)
+		for(GLint c=0; c<4; ++c) {
+			values[i][c] = texels[i*stride+c];
+			mean[c]+= values[i][c] / 16.0f;
+		}
+
+	if(quality == BC_QUALITY_FAST) { // bounding box diagonal
+		for(GLint c=0; c<4; ++c) {
+			e[0][c] = 255.0f;
+			e[1][c] = 0.0f;
+			for(GLint i=0; i<16; ++i) {
+				e[0][c] = std::min(e[0][c], GLfloat(values[i][c]));
+				e[1][c] = std::max(e[1][c], GLfloat(values[i][c]));
+			}
+		}
+	}
+	else { // extent along the principal axis (power iteration)
+		GLfloat cov[4][4] = {{0}}, axis[4] = {1,1,1,1};
+		GLfloat tmin = 1e30f, tmax = -1e30f;
+		for(GLint i=0; i<16; ++i)
+			for(GLint r=0; r<4; ++r)
+				for(GLint c=0; c<4; ++c)
+					cov[r][c]+= (values[i][r]-mean[r])*(values[i][c]-mean[c]);
+		for(GLint it=0; it<8; ++it) {
+			GLfloat next[4] = {0,0,0,0}, norm = 0.0f;
+			for(GLint r=0; r<4; ++r) {
+				for(GLint c=0; c<4; ++c)
+					next[r]+= cov[r][c]*axis[c];
+				norm = std::max(norm, fabsf(next[r]));
+			}
+			if(norm < 1e-6f)
+				break;
+			for(GLint r=0; r<4; ++r)
+				axis[r] = next[r] / norm;
+		}
+		GLfloat length = sqrtf(axis[0]*axis[0]+axis[1]*axis[1]
+		                     + axis[2]*axis[2]+axis[3]*axis[3]);
+		for(GLint c=0; c<4; ++c)
+			axis[c]/= length;
+		for(GLint i=0; i<16; ++i) {
+			GLfloat t = 0.0f;
+			for(GLint c=0; c<4; ++c)
+				t+= (values[i][c]-mean[c])*axis[c];
+			tmin = std::min(tmin, t);
+			tmax = std::max(tmax, t);
+		}
+		for(GLint c=0; c<4; ++c) {
+			e[0][c] = std::min(std::max(mean[c]+tmin*axis[c], 0.0f), 255.0f);
+			e[1][c] = std::min(std::max(mean[c]+tmax*axis[c], 0.0f), 255.0f);
+		}
+	}
+
+	_Bc7Endpoints endpoints, candidate;
+	endpoints.Set(e);
+	GLint bestError = _bc7_fit(values, endpoints, indices);
+	for(GLint it=0; quality >= BC_QUALITY_HIGH && it<2 && bestError>0; ++it) {
+		GLint refitIndices[16];
+		_bc7_refit(values, indices, e);
+		candidate.Set(e);
+		GLint error = _bc7_fit(values, candidate, refitIndices);
+		if(error >= bestError)
+			break;
+		bestError = error;
+		endpoints = candidate;
+		memcpy(indices, refitIndices, sizeof(indices));
+	}
+
+	// the anchor index has an implicit zero msb
+	if(indices[0] & 8) {
+		for(GLint c=0; c<4; ++c)
+			std::swap(endpoints.q[0][c], endpoints.q[1][c]);
+		std::swap(endpoints.p[0], endpoints.p[1]);
+		for(GLint i=0; i<16; ++i)
+			indices[i] = 15-indices[i];
+	}
+
+	memset(block, 0, 16);
+	_BitWriter writer = {block, 0};
+	writer.Write(1u << 6, 7); // mode 6
+	for(GLint c=0; c<4; ++c) {
+		writer.Write(endpoints.q[0][c], 7);
+		writer.Write(endpoints.q[1][c], 7);
+	}
+	writer.Write(endpoints.p[0], 1);
+	writer.Write(endpoints.p[1], 1);
+	writer.Write(indices[0], 3);
+	for(GLint i=1; i<16; ++i)
+		writer.Write(indices[i], 4);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Block decoding
+GLvoid decode_bc4_block(const GLubyte block[8],
+                        GLint stride,
+                        GLubyte *texels) {
+	GLint palette[8];
+	_BitReader reader = {block, 16};
+	_bc4_palette(block[0], block[1], palette);
+	for(GLint i=0; i<16; ++i)
+		texels[i*stride] = GLubyte(palette[reader.Read(3)]);
+}
+
+GLvoid decode_bc5_block(const GLubyte block[16],
+                        GLint stride,
+                        GLubyte *texels) {
+	decode_bc4_block(block, stride, texels);
+	decode_bc4_block(block+8, stride, texels+1);
+}
+
+GLvoid decode_bc7_block(const GLubyte block[16],
+                        GLint stride,
+                        GLubyte *texels) {
+	_BitReader reader = {block, 0};
+	GLint endpoints[2][4], p[2];
+	if(reader.Read(7) != (1u << 6)) { // not mode 6
+		for(GLint i=0; i<16; ++i)
+			memset(texels+i*stride, 0, 4);
+		return;
+	}
+	for(GLint c=0; c<4; ++c) {
+		endpoints[0][c] = reader.Read(7);
+		endpoints[1][c] = reader.Read(7);
+	}
+	p[0] = reader.Read(1);
+	p[1] = reader.Read(1);
+	for(GLint i=0; i<16; ++i) {
+		GLint w = _BC7_WEIGHTS[reader.Read(i == 0 ? 3 : 4)];
+		for(GLint c=0; c<4; ++c)
+			texels[i*stride+c] = GLubyte(((64-w)*((endpoints[0][c]<<1)|p[0])
+			                            + w*((endpoints[1][c]<<1)|p[1])
+			                            + 32) >> 6);
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Compressed image size
+GLsizei compressed_image_size(GLenum internalFormat,
+                              GLsizei width,
+                              GLsizei height) {
+	GLsizei blockSize = internalFormat == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+	return blockSize*((width+3)/4)*((height+3)/4);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Compress / decompress images
+GLvoid compress_images(GLsizei width,
+                       GLsizei height,
+                       GLsizei layerCnt,
+                       GLint texelSize,
+                       const GLubyte *texels,
+                       GLenum internalFormat,
+                       GLint quality,
+                       std::vector<GLubyte>& blocks) throw(FWException) {
+	_CompressTask task = {width, height, texelSize, internalFormat, quality,
+	                      texels, NULL, GL_FALSE};
+	blocks.resize(compressed_image_size(internalFormat, width, height)
+	              * layerCnt);
+	task.dst = &blocks[0];
+	_run_compress_task(task, layerCnt);
+}
+
+GLvoid decompress_images(GLsizei width,
+                         GLsizei height,
+                         GLsizei layerCnt,
+                         GLint texelSize,
+                         const GLubyte *blocks,
+                         GLenum internalFormat,
+                         std::vector<GLubyte>& texels) throw(FWException) {
+	_CompressTask task = {width, height, texelSize, internalFormat, 0,
+	                      blocks, NULL, GL_TRUE};
+	texels.resize(texelSize*width*height*layerCnt);
+	task.dst = &texels[0];
+	_run_compress_task(task, layerCnt);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // build glsl program
 GLvoid build_glsl_program(GLuint program,
@@ -762,40 +2185,63 @@ GLvoid build_glsl_program(GLuint program,
 	while(getline(file, line))
 		source += line + '\n';
 
-	try {
-		// find different stages and build shaders
-		if(source.find("_VERTEX_") != std::string::npos) {
-			std::string vsource = source;
-			vsource.insert(posbu, "#define _VERTEX_\n");
-			_attach_shader(program, GL_VERTEX_SHADER, vsource.data());
-		}
-		if(source.find("_TESS_CONTROL_") != std::string::npos) {
-			std::string csource = source;
-			csource.insert(posbu, "#define _TESS_CONTROL_\n");
-			_attach_shader(program, GL_TESS_CONTROL_SHADER, csource.data());
+	// find different stages
+	static const GLenum STAGES[] = {GL_VERTEX_SHADER,
+	                                GL_TESS_CONTROL_SHADER,
+	                                GL_TESS_EVALUATION_SHADER,
+	                                GL_GEOMETRY_SHADER,
+	                                GL_FRAGMENT_SHADER};
+	static const char *STAGE_MACROS[] = {"_VERTEX_",
+	                                     "_TESS_CONTROL_",
+	                                     "_TESS_EVALUATION_",
+	                                     "_GEOMETRY_",
+	                                     "_FRAGMENT_"};
+	std::vector<GLenum> stages;
+	std::vector<std::string> stageSources;
+	for(GLint i=0; i<5; ++i)
+		if(source.find(STAGE_MACROS[i]) != std::string::npos) {
+			std::string stageSource = source;
+			stageSource.insert(posbu, std::string("#define ")
+			                          + STAGE_MACROS[i] + '\n');
+			stages.push_back(STAGES[i]);
+			stageSources.push_back(stageSource);
 		}
-		if(source.find("_TESS_EVALUATION_") != std::string::npos) {
-			std::string esource = source;
-			esource.insert(posbu, "#define _TESS_EVALUATION_\n");
-			_attach_shader(program, GL_TESS_EVALUATION_SHADER, esource.data());
-		}
-		if(source.find("_GEOMETRY_") != std::string::npos) {
-			std::string gsource = source;
-			gsource.insert(posbu, "#define _GEOMETRY_\n");
-			_attach_shader(program, GL_GEOMETRY_SHADER, gsource.data());
+
+	// look for a cached binary (linked programs only)
+	GLint binaryFormatCnt = 0;
+	if(GL_TRUE == link && !_programCacheDirectory.empty())
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &binaryFormatCnt);
+	const bool cache = binaryFormatCnt > 0;
+	GLuint64 key = 0xCBF29CE484222325ull;
+	if(cache) {
+		for(size_t i=0; i<stages.size(); ++i) {
+			key = _fnv1a(key, &stages[i], sizeof(GLenum));
+			key = _fnv1a(key, stageSources[i].data(), stageSources[i].size());
 		}
-		if(source.find("_FRAGMENT_") != std::string::npos) {
-			std::string fsource = source;
-			fsource.insert(posbu, "#define _FRAGMENT_\n");
-			_attach_shader(program, GL_FRAGMENT_SHADER, fsource.data());
+		key = _fnv1a(key, glGetString(GL_VENDOR));
+		key = _fnv1a(key, glGetString(GL_RENDERER));
+		key = _fnv1a(key, glGetString(GL_VERSION));
+		if(_load_program_binary(program, key)) {
+			++_programCacheLoads;
+			return;
 		}
 	}
+
+	try {
+		// build shaders
+		for(size_t i=0; i<stages.size(); ++i)
+			_attach_shader(program, stages[i], stageSources[i].data());
+	}
 	catch(FWException& e) {
 		throw _ProgramBuildFailException(srcfile, e.what());
 	}
 
 	// Link program if requested
 	if(GL_TRUE == link) {
+		if(cache)
+			glProgramParameteri(program,
+			                    GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+			                    GL_TRUE);
 		glLinkProgram(program);
 		// check link
 		GLint linkStatus = 0;
@@ -805,10 +2251,193 @@ GLvoid build_glsl_program(GLuint program,
 			glGetProgramInfoLog(program, 1024, NULL, logContent);
 			throw _ProgramLinkFailException(srcfile, logContent);
 		}
+		if(cache)
+			_store_program_binary(program, key);
 	}
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Program cache
+GLvoid set_program_cache(const std::string& directory) {
+	_programCacheDirectory = directory;
+	if(directory.empty())
+		return;
+	const char last = directory[directory.size()-1];
+	if(last != '/' && last != '\\')
+		_programCacheDirectory+= '/';
+#ifdef _WIN32
+	CreateDirectoryA(directory.c_str(), NULL);
+#else
+	mkdir(directory.c_str(), 0755);
+#endif
+}
+
+
+GLvoid program_cache_stats(GLint& loads, GLint& stores) {
+	loads  = _programCacheLoads;
+	stores = _programCacheStores;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Resource tracker
+GLvoid track_resource(GLint kind,
+                      GLuint64 id,
+                      GLuint64 bytes,
+                      GLenum format,
+                      GLint levels,
+                      const std::string& owner) {
+	_resource_lock();
+	_Resource& resource = _resources[std::make_pair(kind, id)];
+	if(!resource.owner.empty())
+		_add_resource_bytes(kind, resource.bytes, true);
+	resource.bytes  = bytes;
+	resource.format = format;
+	resource.levels = levels;
+	resource.owner  = owner.empty() ? "?" : owner;
+	_add_resource_bytes(kind, bytes, false);
+	_resource_unlock();
+}
+
+
+GLvoid untrack_resource(GLint kind, GLuint64 id) {
+	_resource_lock();
+	_ResourceMap::iterator it = _resources.find(std::make_pair(kind, id));
+	if(it != _resources.end()) {
+		_add_resource_bytes(kind, it->second.bytes, true);
+		_resources.erase(it);
+	}
+	_resource_unlock();
+}
+
+
+GLvoid track_buffer(GLuint buffer, const std::string& owner) {
+	GLint binding = 0, size = 0;
+	glGetIntegerv(GL_COPY_READ_BUFFER, &binding); // also the binding enum
+	glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+	glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &size);
+	glBindBuffer(GL_COPY_READ_BUFFER, binding);
+	track_resource(RESOURCE_BUFFER, buffer, GLuint64(size), 0, 0, owner);
+}
+
+
+GLvoid track_texture(GLenum target,
+                     GLuint texture,
+                     const std::string& owner) {
+	GLint binding = 0;
+	glGetIntegerv(_texture_binding(target), &binding);
+	glBindTexture(target, texture);
+
+	// the faces of cube maps are queried separately
+	const GLenum levelTarget = target == GL_TEXTURE_CUBE_MAP
+	                         ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : target;
+	const GLint faceCnt = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+	GLuint64 bytes = 0;
+	GLint format = 0, levels = 0;
+	glGetTexLevelParameteriv(levelTarget, 0, GL_TEXTURE_INTERNAL_FORMAT,
+	                         &format);
+	for(;; ++levels) {
+		GLint width = 0, height = 0, depth = 0, compressed = GL_FALSE;
+		GLint samples = 0;
+		glGetTexLevelParameteriv(levelTarget, levels, GL_TEXTURE_WIDTH, &width);
+		if(width == 0 || levels == 32)
+			break;
+		glGetTexLevelParameteriv(levelTarget, levels, GL_TEXTURE_HEIGHT,
+		                         &height);
+		glGetTexLevelParameteriv(levelTarget, levels, GL_TEXTURE_DEPTH,
+		                         &depth);
+		glGetTexLevelParameteriv(levelTarget, levels, GL_TEXTURE_SAMPLES,
+		                         &samples);
+		glGetTexLevelParameteriv(levelTarget, levels, GL_TEXTURE_COMPRESSED,
+		                         &compressed);
+		if(compressed) {
+			GLint size = 0;
+			glGetTexLevelParameteriv(levelTarget, levels,
+			                         GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+			bytes+= GLuint64(size)*faceCnt;
+		}
+		else
+			bytes+= GLuint64(width)*height*depth*std::max(samples, 1)*faceCnt
+			      * ((_texel_bits(levelTarget, levels, false)+7)/8);
+	}
+
+	glBindTexture(target, binding);
+	track_resource(RESOURCE_TEXTURE, texture, bytes, format, levels, owner);
+}
+
+
+GLvoid track_renderbuffer(GLuint renderbuffer, const std::string& owner) {
+	GLint binding = 0, width = 0, height = 0, samples = 0, format = 0;
+	glGetIntegerv(GL_RENDERBUFFER_BINDING, &binding);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
+	glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_WIDTH, &width);
+	glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_HEIGHT,
+	                             &height);
+	glGetRenderbufferParameteriv(GL_RENDERBUFFER, GL_RENDERBUFFER_SAMPLES,
+	                             &samples);
+	glGetRenderbufferParameteriv(GL_RENDERBUFFER,
+	                             GL_RENDERBUFFER_INTERNAL_FORMAT,
+	                             &format);
+	GLuint64 bytes = GLuint64(width)*height*std::max(samples, 1)
+	               * ((_texel_bits(GL_RENDERBUFFER, 0, true)+7)/8);
+	glBindRenderbuffer(GL_RENDERBUFFER, binding);
+	track_resource(RESOURCE_RENDERBUFFER, renderbuffer, bytes, format, 1,
+	               owner);
+}
+
+
+GLvoid resource_bytes(GLint kind, GLuint64& live, GLuint64& peak) {
+	_resource_lock();
+	live = _resourceLive[kind];
+	peak = _resourcePeak[kind];
+	_resource_unlock();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Resource report
+GLvoid report_resources(std::ostream& outputStream) {
+	const char *kindNames[RESOURCE_COUNT+1] = {"buffers",
+	                                           "textures",
+	                                           "renderbuffers",
+	                                           "host",
+	                                           "GL total"};
+	// bytes and resource count of each owner and kind
+	typedef std::map<std::string, std::pair<GLuint64, GLint> > OwnerMap;
+	OwnerMap owners[RESOURCE_COUNT];
+	_resource_lock();
+	for(_ResourceMap::const_iterator it=_resources.begin();
+	    it!=_resources.end(); ++it) {
+		std::pair<GLuint64, GLint>& owner
+			= owners[it->first.first][it->second.owner];
+		owner.first+= it->second.bytes;
+		++owner.second;
+	}
+	const std::ios::fmtflags flags = outputStream.flags();
+	const std::streamsize precision = outputStream.precision();
+	outputStream.setf(std::ios::fixed);
+	outputStream.precision(2);
+	outputStream << "memory (MiB, live / peak):\n";
+	for(GLint kind=0; kind<=RESOURCE_COUNT; ++kind) {
+		outputStream << "  " << kindNames[kind] << ": "
+		             << _resourceLive[kind]/1048576.0 << " / "
+		             << _resourcePeak[kind]/1048576.0 << "\n";
+		if(kind == RESOURCE_COUNT)
+			continue;
+		for(OwnerMap::const_iterator it=owners[kind].begin();
+		    it!=owners[kind].end(); ++it)
+			outputStream << "    " << it->first << ": "
+			             << it->second.first/1048576.0 << " ("
+			             << it->second.second << ")\n";
+	}
+	_resource_unlock();
+	outputStream.flags(flags);
+	outputStream.precision(precision);
+	outputStream.flush();
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Check OpenGL error
 GLvoid check_gl_error() throw (FWException) {
@@ -1277,6 +2906,133 @@ void tex_png_sprites_image3D(const std::vector<std::string>& filenames,
 	                             &_extract_png_format);
 }
 
+
+////////////////////////////////////////////////////////////////////////////////
+// Checksums
+// Select the crc32 / adler32 paths of zlib (0 for the table paths)
+static void _select_checksum_paths(int crcSimd, int adlerSimd) {
+#ifdef Z_X86_SIMD
+	z_cpu_has_crc32_simd = crcSimd;
+	z_cpu_has_adler32_simd = adlerSimd;
+#else
+	(void)crcSimd;
+	(void)adlerSimd;
+#endif
+}
+
+// Compare the SIMD and table checksums of len bytes, whole and in two
+// parts, returns the number of mismatches
+static GLint _check_checksums(const GLubyte *bytes,
+                              GLuint len,
+                              uLong crcSeed,
+                              uLong adlerSeed,
+                              int crcSimd,
+                              int adlerSimd) {
+	const GLuint split = len/3;
+	uLong crc[2][2], adler[2][2];
+	for(GLint simd=0; simd<2; ++simd) {
+		_select_checksum_paths(simd*crcSimd, simd*adlerSimd);
+		crc[simd][0] = crc32(crcSeed, bytes, len);
+		crc[simd][1] = crc32(crc32(crcSeed, bytes, split),
+		                     bytes+split, len-split);
+		adler[simd][0] = adler32(adlerSeed, bytes, len);
+		adler[simd][1] = adler32(adler32(adlerSeed, bytes, split),
+		                         bytes+split, len-split);
+	}
+	return (crc[0][0] != crc[1][0]) + (crc[0][0] != crc[1][1])
+	     + (adler[0][0] != adler[1][0]) + (adler[0][0] != adler[1][1]);
+}
+
+// Get the throughput (in MB/s) of crc32 (or adler32) over bytes
+static GLdouble _checksum_throughput(const std::vector<GLubyte>& bytes,
+                                     bool adler) {
+	const GLint PASSES = 16;
+	uLong checksum = adler ? 1 : 0;
+	Timer timer;
+	timer.Start();
+	for(GLint i=0; i<PASSES; ++i)
+		checksum = adler ? adler32(checksum, &bytes[0], uInt(bytes.size()))
+		                 : crc32(checksum, &bytes[0], uInt(bytes.size()));
+	timer.Stop();
+	// keep the loop
+	volatile uLong sink = checksum;
+	(void)sink;
+	return 1e-6*PASSES*bytes.size()/timer.Ticks();
+}
+
+
+GLint benchmark_checksums(std::ostream& outputStream) {
+	// lengths around the SIMD block sizes and the adler32 NMAX (5552)
+	static const GLuint LENGTHS[] = {
+		0, 1, 2, 3, 7, 8, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65,
+		95, 96, 127, 128, 129, 255, 256, 1000, 4095, 4096, 4097,
+		5551, 5552, 5553, 11103, 11104, 11105, 65536, 100003
+	};
+	const GLint LENGTH_CNT = GLint(sizeof(LENGTHS)/sizeof(LENGTHS[0]));
+	const GLuint ALIGNMENT = 16; // offsets tried
+
+	int crcSimd = 0, adlerSimd = 0;
+#ifdef Z_X86_SIMD
+	z_cpu_check_features();
+	crcSimd = z_cpu_has_crc32_simd;
+	adlerSimd = z_cpu_has_adler32_simd;
+#endif
+
+	// random bytes (and all 0xff, the largest adler32 sums), at every
+	// offset in a 16 byte block and with random seeds
+	GLuint random = 1u;
+	std::vector<GLubyte> bytes(LENGTHS[LENGTH_CNT-1]+ALIGNMENT);
+	GLint checks = 0, mismatches = 0;
+	for(GLint fill=0; fill<2; ++fill) {
+		for(size_t i=0; i<bytes.size(); ++i) {
+			random = random*1664525u + 1013904223u;
+			bytes[i] = fill ? 0xFF : GLubyte(random >> 24);
+		}
+		for(GLint i=0; i<LENGTH_CNT; ++i)
+			for(GLuint offset=0; offset<ALIGNMENT; ++offset) {
+				random = random*1664525u + 1013904223u;
+				const uLong crcSeed = offset ? random : 0u;
+				const uLong adlerSeed = offset ? (random>>16)%65521u << 16
+				                                 | (random&0xFFFF)%65521u
+				                               : 1u;
+				mismatches+= _check_checksums(&bytes[offset],
+				                              LENGTHS[i],
+				                              crcSeed,
+				                              adlerSeed,
+				                              crcSimd,
+				                              adlerSimd);
+				checks+= 4;
+			}
+	}
+
+	// throughput over 16MB
+	bytes.resize(16 << 20);
+	for(size_t i=0; i<bytes.size(); ++i) {
+		random = random*1664525u + 1013904223u;
+		bytes[i] = GLubyte(random >> 24);
+	}
+	GLdouble throughput[2][2];
+	for(GLint simd=0; simd<2; ++simd) {
+		_select_checksum_paths(simd*crcSimd, simd*adlerSimd);
+		throughput[simd][0] = _checksum_throughput(bytes, false);
+		throughput[simd][1] = _checksum_throughput(bytes, true);
+	}
+	_select_checksum_paths(crcSimd, adlerSimd);
+
+	const char *names[] = {"crc32  ", "adler32"};
+	const int simdPaths[] = {crcSimd, adlerSimd};
+	outputStream << "checksums (zlib)\n";
+	for(GLint k=0; k<2; ++k)
+		outputStream << "  " << names[k] << ": "
+		             << throughput[0][k] << " MB/s table, "
+		             << throughput[1][k] << " MB/s "
+		             << (simdPaths[k] ? "SIMD" : "table (no SIMD path)")
+		             << " (x" << throughput[1][k]/throughput[0][k] << ")\n";
+	outputStream << "  bit-exactness: " << checks << " checks, "
+	             << mismatches << " mismatches" << std::endl;
+	return mismatches;
+}
+
 #endif // no png
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1560,6 +3316,116 @@ float half_to_float(GLhalf h)
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// HostResource implementation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+HostResource::HostResource(const std::string& owner) :
+	mOwner(owner)
+{
+	SetBytes(0);
+}
+
+
+HostResource::~HostResource()
+{
+	untrack_resource(RESOURCE_HOST, reinterpret_cast<size_t>(this));
+}
+
+
+void HostResource::SetBytes(GLuint64 bytes)
+{
+	track_resource(RESOURCE_HOST,
+	               reinterpret_cast<size_t>(this),
+	               bytes,
+	               0,
+	               0,
+	               mOwner);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// BackgroundTask implementation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+GLvoid _run_background_task(BackgroundTask *task)
+{
+	task->mFunc(task->mData);
+	_memory_barrier(); // the writes of the task before mDone
+	task->mDone = 1;
+}
+
+
+#ifdef _WIN32
+static DWORD WINAPI _background_thread(LPVOID task)
+{
+	_run_background_task(reinterpret_cast<BackgroundTask*>(task));
+	return 0;
+}
+#else
+static void* _background_thread(void *task)
+{
+	_run_background_task(reinterpret_cast<BackgroundTask*>(task));
+	return NULL;
+}
+#endif
+
+
+BackgroundTask::BackgroundTask() :
+	mFunc(NULL), mData(NULL), mDone(1)
+{}
+
+
+void BackgroundTask::Start(GLvoid (*func)(GLvoid *data),
+                           GLvoid *data) throw(FWException)
+{
+	if(!Done())
+		throw _BackgroundTaskException("already running");
+	mFunc = func;
+	mData = data;
+	mDone = 0;
+#ifdef _WIN32
+	HANDLE thread = CreateThread(NULL, 0, &_background_thread, this, 0, NULL);
+	bool started = thread != NULL;
+	if(started)
+		CloseHandle(thread);
+#else
+	pthread_t thread;
+	bool started = 0 == pthread_create(&thread,
+	                                   NULL,
+	                                   &_background_thread,
+	                                   this);
+	if(started)
+		pthread_detach(thread);
+#endif
+	if(!started) {
+		mDone = 1;
+		throw _BackgroundTaskException("cannot create a thread");
+	}
+}
+
+
+bool BackgroundTask::Done() const
+{
+	bool done = mDone != 0;
+	_memory_barrier(); // read the writes of the task after mDone
+	return done;
+}
+
+
+void BackgroundTask::Wait() const
+{
+	while(!Done())
+#ifdef _WIN32
+		Sleep(1);
+#else
+		usleep(1000);
+#endif
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Timer implementation
 //
@@ -1568,7 +3434,7 @@ float half_to_float(GLhalf h)
 ////////////////////////////////////////////////////////////////////////////////
 // Timer Constructor
 Timer::Timer() : 
-	mStartTicks(0.0), mStopTicks(0.0), mIsTicking(false)
+	mStartTicks(0), mStopTicks(0), mIsTicking(false)
 {}
 
 
@@ -1578,7 +3444,7 @@ void Timer::Start()
 {
 	if(!mIsTicking) {
 		mIsTicking  = true;
-		mStartTicks = _get_ticks();
+		mStartTicks = clock_nanoseconds();
 	}
 }
 
@@ -1589,7 +3455,7 @@ void Timer::Stop()
 {
 	if(mIsTicking) {
 		mIsTicking = false;
-		mStopTicks = _get_ticks();
+		mStopTicks = clock_nanoseconds();
 	}
 }
 
@@ -1598,11 +3464,475 @@ void Timer::Stop()
 // Timer::Ticks()
 double Timer::Ticks() const
 {
-	return mIsTicking ? _get_ticks() - mStartTicks 
+	return static_cast<double>(Nanoseconds()) * 1e-9;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Timer::Nanoseconds()
+GLuint64 Timer::Nanoseconds() const
+{
+	return mIsTicking ? clock_nanoseconds() - mStartTicks
 	                  : mStopTicks - mStartTicks;
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// TimeStats implementation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// TimeStats Constructor
+TimeStats::TimeStats(GLint window, GLdouble bucketWidth, GLint bucketCnt) :
+	mNext(0), mCount(0), mMean(0.0), mJitter(0.0), mBucketWidth(0.0)
+{
+	SetWindow(window);
+	SetHistogram(bucketWidth, bucketCnt);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// TimeStats::SetWindow
+void TimeStats::SetWindow(GLint window)
+{
+	mSamples.assign(std::max(window, 1), 0.0);
+	Clear();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// TimeStats::SetHistogram
+void TimeStats::SetHistogram(GLdouble bucketWidth, GLint bucketCnt)
+{
+	mBucketWidth = bucketWidth > 0.0 ? bucketWidth : 1e-3;
+	mHistogram.assign(std::max(bucketCnt, 1), 0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// TimeStats::Clear
+void TimeStats::Clear()
+{
+	mNext  = 0;
+	mCount = 0;
+	Update();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// TimeStats::Add
+void TimeStats::Add(GLdouble sample)
+{
+	mSamples[mNext] = sample;
+	mNext  = (mNext+1) % GLint(mSamples.size());
+	mCount = std::min(mCount+1, GLint(mSamples.size()));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// TimeStats::Update
+void TimeStats::Update()
+{
+	const GLint window = GLint(mSamples.size());
+	const GLint first  = (mNext-mCount+window) % window; // oldest sample
+	mSorted.resize(mCount);
+	mMean = mJitter = 0.0;
+	std::fill(mHistogram.begin(), mHistogram.end(), 0);
+	const GLint lastBucket = GLint(mHistogram.size())-1;
+	for(GLint i=0; i<mCount; ++i) {
+		const GLdouble sample = mSamples[(first+i) % window];
+		mSorted[i] = sample;
+		mMean+= sample;
+		if(i > 0)
+			mJitter+= std::abs(sample-mSamples[(first+i-1) % window]);
+		GLdouble bucket = std::max(floor(sample/mBucketWidth), 0.0);
+		++mHistogram[GLint(std::min(bucket, GLdouble(lastBucket)))];
+	}
+	if(mCount > 0)
+		mMean/= mCount;
+	if(mCount > 1)
+		mJitter/= mCount-1;
+	std::sort(mSorted.begin(), mSorted.end());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// TimeStats queries
+GLdouble TimeStats::Min() const
+{
+	return mSorted.empty() ? 0.0 : mSorted.front();
+}
+
+
+GLdouble TimeStats::Max() const
+{
+	return mSorted.empty() ? 0.0 : mSorted.back();
+}
+
+
+GLdouble TimeStats::Percentile(GLdouble p) const
+{
+	if(mSorted.empty())
+		return 0.0;
+	// nearest rank
+	GLint rank = GLint(ceil(p/100.0*mSorted.size()));
+	return mSorted[std::min(std::max(rank, 1), GLint(mSorted.size()))-1];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// TimeStats::WriteJson
+void TimeStats::WriteJson(std::ostream& stream) const
+{
+	stream << "{\"count\":" << mCount
+	       << ",\"min_ms\":" << 1e3*Min()
+	       << ",\"mean_ms\":" << 1e3*mMean
+	       << ",\"p50_ms\":" << 1e3*Percentile(50.0)
+	       << ",\"p95_ms\":" << 1e3*Percentile(95.0)
+	       << ",\"p99_ms\":" << 1e3*Percentile(99.0)
+	       << ",\"max_ms\":" << 1e3*Max()
+	       << ",\"jitter_ms\":" << 1e3*mJitter
+	       << ",\"bucket_ms\":" << 1e3*mBucketWidth
+	       << ",\"histogram\":[";
+	for(size_t i=0; i<mHistogram.size(); ++i)
+		stream << (i ? "," : "") << mHistogram[i];
+	stream << "]}";
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// ProgramReflection implementation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// ProgramReflection Constructors
+ProgramReflection::ProgramReflection()
+{}
+
+
+ProgramReflection::ProgramReflection(GLuint program)
+{
+	Reflect(program);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// ProgramReflection::Reflect
+void ProgramReflection::Reflect(GLuint program)
+{
+	mLocations.clear();
+	mOffsets.clear();
+	mBlockIndexes.clear();
+	mBlockSizes.clear();
+
+	// uniforms (default block) and block members
+	GLint uniformCnt = 0, maxLength = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniformCnt);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<GLchar> name(std::max(maxLength, 1));
+	for(GLuint i=0; i<GLuint(uniformCnt); ++i) {
+		GLint size = 0, block = -1, offset = -1;
+		GLenum type = 0;
+		glGetActiveUniform(program, i, GLsizei(name.size()), NULL,
+		                   &size, &type, &name[0]);
+		glGetActiveUniformsiv(program, 1, &i, GL_UNIFORM_BLOCK_INDEX, &block);
+		glGetActiveUniformsiv(program, 1, &i, GL_UNIFORM_OFFSET, &offset);
+		std::string key(&name[0]);
+		GLint value = block < 0 ? glGetUniformLocation(program, &name[0])
+		                        : offset;
+		std::map<std::string, GLint>& table = block < 0 ? mLocations
+		                                                : mOffsets;
+		table[key] = value;
+		if(key.size() > 3 && key.compare(key.size()-3, 3, "[0]") == 0)
+			table[key.substr(0, key.size()-3)] = value;
+	}
+
+	// blocks
+	GLint blockCnt = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &blockCnt);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+	name.resize(std::max(maxLength, 1));
+	for(GLuint i=0; i<GLuint(blockCnt); ++i) {
+		GLint size = 0;
+		glGetActiveUniformBlockName(program, i, GLsizei(name.size()), NULL,
+		                            &name[0]);
+		glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_DATA_SIZE,
+		                          &size);
+		mBlockIndexes[&name[0]] = i;
+		mBlockSizes[&name[0]] = size;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// ProgramReflection queries
+GLint ProgramReflection::UniformLocation(const std::string& name) const
+{
+	std::map<std::string, GLint>::const_iterator it = mLocations.find(name);
+	return it == mLocations.end() ? -1 : it->second;
+}
+
+
+GLint ProgramReflection::UniformOffset(const std::string& name) const
+{
+	std::map<std::string, GLint>::const_iterator it = mOffsets.find(name);
+	return it == mOffsets.end() ? -1 : it->second;
+}
+
+
+GLuint ProgramReflection::UniformBlockIndex(const std::string& name) const
+{
+	std::map<std::string, GLuint>::const_iterator it = mBlockIndexes.find(name);
+	return it == mBlockIndexes.end() ? GL_INVALID_INDEX : it->second;
+}
+
+
+GLint ProgramReflection::UniformBlockSize(const std::string& name) const
+{
+	std::map<std::string, GLint>::const_iterator it = mBlockSizes.find(name);
+	return it == mBlockSizes.end() ? 0 : it->second;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// UniformRing implementation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// UniformRing Constructor / Destructor
+UniformRing::UniformRing() :
+	mBuffer(0), mSize(0), mStride(0), mCurrent(0)
+{}
+
+
+UniformRing::~UniformRing()
+{
+	Release();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// UniformRing::Init
+void UniformRing::Init(GLuint buffer,
+                       GLsizeiptr size,
+                       GLint count) throw(FWException)
+{
+	if(size <= 0 || count <= 0)
+		throw _UniformRingException("invalid size or range count");
+	GLint alignment = 1;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	alignment = std::max(alignment, 1);
+	for(size_t i=0; i<mFences.size(); ++i)
+		if(mFences[i])
+			glDeleteSync(mFences[i]);
+	mBuffer  = buffer;
+	mSize    = size;
+	mStride  = (size+alignment-1)/alignment*alignment;
+	mCurrent = count-1;
+	mFences.assign(count, GLsync(0));
+	glBindBuffer(GL_UNIFORM_BUFFER, mBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, mStride*count, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// UniformRing::Write
+void UniformRing::Write(const GLvoid *data, GLuint binding) throw(FWException)
+{
+	if(mFences.empty())
+		throw _UniformRingException("not initialized");
+	mCurrent = (mCurrent+1) % GLint(mFences.size());
+	GLsync& fence = mFences[mCurrent];
+	if(fence) {
+		GLenum status = glClientWaitSync(fence,
+		                                 GL_SYNC_FLUSH_COMMANDS_BIT,
+		                                 GLuint64(1000000000)); // 1s
+		while(status == GL_TIMEOUT_EXPIRED)
+			status = glClientWaitSync(fence, 0, GLuint64(1000000000));
+		glDeleteSync(fence);
+		fence = 0;
+		if(status == GL_WAIT_FAILED)
+			throw _UniformRingException("fence wait failed");
+	}
+	const GLintptr offset = mStride*mCurrent;
+	glBindBuffer(GL_UNIFORM_BUFFER, mBuffer);
+	GLvoid *range = glMapBufferRange(GL_UNIFORM_BUFFER,
+	                                 offset,
+	                                 mSize,
+	                                 GL_MAP_WRITE_BIT
+	                                 | GL_MAP_INVALIDATE_RANGE_BIT
+	                                 | GL_MAP_UNSYNCHRONIZED_BIT);
+	if(!range) {
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		throw _UniformRingException("mapping failed");
+	}
+	memcpy(range, data, mSize);
+	glUnmapBuffer(GL_UNIFORM_BUFFER);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, mBuffer, offset, mSize);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// UniformRing::Fence
+void UniformRing::Fence()
+{
+	if(mFences.empty())
+		return;
+	GLsync& fence = mFences[mCurrent];
+	if(fence)
+		glDeleteSync(fence);
+	fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// UniformRing::Release
+void UniformRing::Release()
+{
+	for(size_t i=0; i<mFences.size(); ++i)
+		if(mFences[i])
+			glDeleteSync(mFences[i]);
+	mFences.clear(); // no GL call left for the destructor
+	mBuffer = 0;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// ProfileScope implementation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+ProfileScope::ProfileScope(const char *name) :
+	mName(_profiling ? name : NULL), mStart(0.0)
+{
+	if(mName)
+		mStart = _get_ticks();
+}
+
+
+ProfileScope::~ProfileScope()
+{
+	if(mName)
+		profile_span(mName, mStart, _get_ticks());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GpuProfiler implementation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+GpuProfiler::GpuProfiler() :
+	mHead(0), mTail(0), mOffset(0.0)
+{}
+
+
+GpuProfiler::~GpuProfiler()
+{
+	Release();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GpuProfiler::Init
+void GpuProfiler::Init(GLint spanCount)
+{
+	if(!mQueries.empty())
+		glDeleteQueries(GLsizei(mQueries.size()), &mQueries[0]);
+	spanCount = std::max(spanCount, 1);
+	mQueries.resize(2*spanCount);
+	glGenQueries(2*spanCount, &mQueries[0]);
+	mNames.assign(spanCount, static_cast<const char*>(NULL));
+	mClosed.assign(spanCount, false);
+	mOpen.clear();
+	mHead = mTail = 0;
+
+	// GL time of the current profiler time
+	GLint64 glTime = 0;
+	glGetInteger64v(GL_TIMESTAMP, &glTime);
+	mOffset = _get_ticks() - GLdouble(glTime)*1e-9;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GpuProfiler::Begin
+void GpuProfiler::Begin(const char *name)
+{
+	const GLuint spanCnt = GLuint(mNames.size());
+	if(!_profiling || mHead - mTail == spanCnt) {
+		mOpen.push_back(-1);
+		return;
+	}
+	GLint span = GLint(mHead++ % spanCnt);
+	glQueryCounter(mQueries[2*span], GL_TIMESTAMP);
+	mNames[span]  = name;
+	mClosed[span] = false;
+	mOpen.push_back(span);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GpuProfiler::End
+void GpuProfiler::End()
+{
+	if(mOpen.empty())
+		return;
+	GLint span = mOpen.back();
+	mOpen.pop_back();
+	if(span < 0)
+		return;
+	glQueryCounter(mQueries[2*span+1], GL_TIMESTAMP);
+	mClosed[span] = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GpuProfiler::Collect
+void GpuProfiler::Collect()
+{
+	static _ProfileRing *ring = NULL;
+	const GLuint spanCnt = GLuint(mNames.size());
+	for(; mTail != mHead; ++mTail) {
+		GLint span = GLint(mTail % spanCnt);
+		GLuint available = GL_FALSE;
+		if(mClosed[span])
+			glGetQueryObjectuiv(mQueries[2*span+1],
+			                    GL_QUERY_RESULT_AVAILABLE,
+			                    &available);
+		if(!available)
+			return;
+		GLuint64 start = 0, stop = 0;
+		glGetQueryObjectui64v(mQueries[2*span], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(mQueries[2*span+1], GL_QUERY_RESULT, &stop);
+		if(!ring)
+			ring = _new_profile_ring(true);
+		_push_profile_span(ring,
+		                   mNames[span],
+		                   mOffset + GLdouble(start)*1e-9,
+		                   mOffset + GLdouble(stop)*1e-9);
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// GpuProfiler::Release
+void GpuProfiler::Release()
+{
+	if(!mQueries.empty())
+		glDeleteQueries(GLsizei(mQueries.size()), &mQueries[0]);
+	mQueries.clear(); // no GL call left for the destructor
+	mNames.clear();   // Begin drops the spans
+	mClosed.clear();
+	mOpen.clear();
+	mHead = mTail = 0;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Tga local functions/constants
 //
@@ -9,11 +9,18 @@
 
 #include <string>
 #include <vector>
+#include <map>
 #include "glew.hpp"
 
 // offset for buffer objects
 #define FW_BUFFER_OFFSET(i)    ((char*)NULL + (i))
 
+// profile the enclosing scope (see fw::ProfileScope)
+#define FW_PROFILE_CONCAT_(a, b) a##b
+#define FW_PROFILE_CONCAT(a, b)  FW_PROFILE_CONCAT_(a, b)
+#define FW_PROFILE_SCOPE(name) \
+	fw::ProfileScope FW_PROFILE_CONCAT(_fwProfileScope, __LINE__)(name)
+
 namespace fw {
 	// Framework exception
 	class FWException : public std::exception {
@@ -33,11 +40,89 @@ namespace fw {
 	GLuint next_power_of_two_exponent(GLuint number);
 
 
+	// Get the time of a monotonic clock (in nanoseconds, from an arbitrary
+	// origin)
+	GLuint64 clock_nanoseconds();
+
+
+	// Get the number of hardware threads (at least one)
+	GLint hardware_thread_count();
+	// Call func(i, data) for each i in [0, count) from at most
+	// hardware_thread_count() threads, the calling one included.
+	// Returns once every call has returned. func must be thread safe
+	// and must not throw. The worker threads are created by the first
+	// call and reused; nested or concurrent calls run on the calling
+	// thread only.
+	GLvoid parallel_for(GLint count,
+	                    GLvoid (*func)(GLint i, GLvoid *data),
+	                    GLvoid *data);
+
+
+	// Enable / disable profiling (disabled by default). Each thread records
+	// its spans in its own ring of the PROFILE_RING_SIZE most recent ones,
+	// without locking. Span names are not copied (use string literals).
+	enum {PROFILE_RING_SIZE = 1 << 15};
+	GLvoid set_profiling(bool enabled);
+	bool profiling();
+	// Get the time of the profiler clock (in seconds)
+	GLdouble profile_ticks();
+	// Record a span of the calling thread, if profiling is enabled
+	GLvoid profile_span(const char *name, GLdouble start, GLdouble stop);
+	// Drop the recorded spans
+	GLvoid clear_profile();
+	// Write the recorded spans as a Chrome trace (JSON, for chrome://tracing
+	// or Perfetto), one track per thread and one for the GPU. Must not run
+	// while other threads record spans.
+	GLvoid save_profile_trace(const std::string& filename)
+	                          throw(FWException);
+
+
 	// Build GLSL program
 	GLvoid build_glsl_program(GLuint program,
 	                          const std::string& srcfile,
 	                          const std::string& options,
 	                          GLboolean link) throw(FWException);
+	// Cache the programs linked by build_glsl_program in directory (which is
+	// created if needed; an empty string disables the cache, the default).
+	// Binaries are keyed on a hash of the source of each stage and of the
+	// driver strings. A binary the driver rejects is rebuilt from the
+	// sources, and replaced.
+	GLvoid set_program_cache(const std::string& directory);
+	// Get the number of programs loaded from and stored to the cache
+	GLvoid program_cache_stats(GLint& loads, GLint& stores);
+
+
+	// Resource kinds of the memory tracker
+	enum {
+		RESOURCE_BUFFER = 0,
+		RESOURCE_TEXTURE,
+		RESOURCE_RENDERBUFFER,
+		RESOURCE_HOST,
+		RESOURCE_COUNT,
+		RESOURCE_GL = RESOURCE_COUNT // all the GL objects (resource_bytes)
+	};
+	// Record (or update) the storage of a resource, for an owner tag. id is
+	// the name of GL objects, and any unique id for host memory. format and
+	// levels are informative (0 if meaningless). The tracker is thread safe.
+	GLvoid track_resource(GLint kind,
+	                      GLuint64 id,
+	                      GLuint64 bytes,
+	                      GLenum format,
+	                      GLint levels,
+	                      const std::string& owner);
+	GLvoid untrack_resource(GLint kind, GLuint64 id);
+	// Record the storage of a GL object, queried from GL (the object is
+	// bound, and the previous binding restored). Buffer textures own no
+	// storage: track their buffer.
+	GLvoid track_buffer(GLuint buffer, const std::string& owner);
+	GLvoid track_texture(GLenum target,
+	                     GLuint texture,
+	                     const std::string& owner);
+	GLvoid track_renderbuffer(GLuint renderbuffer, const std::string& owner);
+	// Get the bytes held by the resources of a kind, now and at most
+	GLvoid resource_bytes(GLint kind, GLuint64& live, GLuint64& peak);
+	// Report the live resources, by owner, and the totals of each kind
+	GLvoid report_resources(std::ostream& outputStream);
 
 
 	// Check OpenGL errors
@@ -129,6 +214,105 @@ namespace fw {
 	GLushort pack_4ubv_to_ushort_5_5_5_1(const GLubyte *v);
 
 
+	// Mipmap filters
+	enum {
+		MIPMAP_FILTER_BOX = 0,
+		MIPMAP_FILTER_KAISER
+	};
+
+	// Get the number of levels of a full mip chain
+	GLint mip_level_count(GLsizei width, GLsizei height);
+	// Build the mip chain of a stack of 2D images on the CPU.
+	// levels[0] must hold layerCnt tightly packed images of width x height
+	// pixels. Levels 1 to mip_level_count(width,height)-1 are appended.
+	// Supported pixel formats are GL_RED, GL_RG, GL_RGB, GL_BGR, GL_RGBA
+	// and GL_BGRA, with types GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT (native
+	// byte order) and GL_HALF_FLOAT. If alphaWeighted is set (4 channel
+	// formats only), colours are averaged using the alpha channel as weight
+	// so that fully transparent texels do not bleed into their neighbours.
+	// Layers are processed in parallel.
+	GLvoid build_mipmaps(GLsizei width,
+	                     GLsizei height,
+	                     GLsizei layerCnt,
+	                     GLenum pixelFormat,
+	                     GLenum pixelType,
+	                     GLenum filter,
+	                     GLboolean alphaWeighted,
+	                     std::vector< std::vector<GLubyte> >& levels)
+	                     throw(FWException);
+	// Upload a mip chain built with build_mipmaps to the texture bound as
+	// GL_TEXTURE_2D_ARRAY, which must have storage for all the levels.
+	GLvoid tex_mipmaps_image3D(GLsizei width,
+	                           GLsizei height,
+	                           GLsizei layerCnt,
+	                           GLenum pixelFormat,
+	                           GLenum pixelType,
+	                           const std::vector< std::vector<GLubyte> >& levels);
+
+
+	// Block compression quality
+	enum {
+		BC_QUALITY_FAST = 0, // bounding box endpoints
+		BC_QUALITY_NORMAL,   // principal axis endpoints, best of both modes
+		BC_QUALITY_HIGH      // plus endpoint refinement
+	};
+
+	// Encode / decode 4x4 texel blocks. Texels are read (written) in row
+	// major order, stride bytes apart. BC4 and BC5 are the unsigned
+	// RGTC1/RGTC2 formats, BC5 uses the two first bytes of each texel.
+	// BC7 texels are RGBA8; the encoder only emits mode 6 blocks, which
+	// is the only mode the decoder understands.
+	GLvoid encode_bc4_block(const GLubyte *texels,
+	                        GLint stride,
+	                        GLint quality,
+	                        GLubyte block[8]);
+	GLvoid encode_bc5_block(const GLubyte *texels,
+	                        GLint stride,
+	                        GLint quality,
+	                        GLubyte block[16]);
+	GLvoid encode_bc7_block(const GLubyte *texels,
+	                        GLint stride,
+	                        GLint quality,
+	                        GLubyte block[16]);
+	GLvoid decode_bc4_block(const GLubyte block[8],
+	                        GLint stride,
+	                        GLubyte *texels);
+	GLvoid decode_bc5_block(const GLubyte block[16],
+	                        GLint stride,
+	                        GLubyte *texels);
+	GLvoid decode_bc7_block(const GLubyte block[16],
+	                        GLint stride,
+	                        GLubyte *texels);
+
+	// Get the byte size of an image of width x height texels stored in
+	// one of GL_COMPRESSED_RED_RGTC1, GL_COMPRESSED_RG_RGTC2 and
+	// GL_COMPRESSED_RGBA_BPTC_UNORM
+	GLsizei compressed_image_size(GLenum internalFormat,
+	                              GLsizei width,
+	                              GLsizei height);
+	// Compress layerCnt tightly packed images of width x height texels of
+	// texelSize bytes each into internalFormat (see compressed_image_size).
+	// RGTC1 uses the first byte of each texel, RGTC2 the two first and
+	// BPTC four (texelSize must be 4). Blocks crossing the image border
+	// replicate the last row / column. Layers are processed in parallel.
+	GLvoid compress_images(GLsizei width,
+	                       GLsizei height,
+	                       GLsizei layerCnt,
+	                       GLint texelSize,
+	                       const GLubyte *texels,
+	                       GLenum internalFormat,
+	                       GLint quality,
+	                       std::vector<GLubyte>& blocks) throw(FWException);
+	// Inverse of compress_images
+	GLvoid decompress_images(GLsizei width,
+	                         GLsizei height,
+	                         GLsizei layerCnt,
+	                         GLint texelSize,
+	                         const GLubyte *blocks,
+	                         GLenum internalFormat,
+	                         std::vector<GLubyte>& texels) throw(FWException);
+
+
 	// Upload a TGA to a texture bound as GL_TEXTURE_2D
 	void tex_tga_image2D(const std::string& filename,
 	                     GLboolean genMipmaps,
@@ -155,6 +339,11 @@ namespace fw {
 	void tex_png_sprites_image3D(const std::vector<std::string>& filenames,
 	                             GLboolean genMipmaps,
 	                             GLboolean immutable) throw(FWException);
+
+	// Check the SIMD crc32 and adler32 of zlib against its table paths on
+	// unaligned random buffers of many lengths, and report the throughput
+	// of both. Returns the number of mismatches. Does not use OpenGL.
+	GLint benchmark_checksums(std::ostream& outputStream);
 #endif // _NO_PNG
 
 
@@ -231,6 +420,168 @@ namespace fw {
 	} DrawElementsIndirectCommand;
 
 
+	// Reflection of a linked program: the locations of its active uniforms,
+	// its uniform blocks and the offsets of their members, queried once so
+	// that the names need not be looked up when drawing. Array uniforms are
+	// found with or without their "[0]" suffix.
+	class ProgramReflection {
+	public:
+		// Constructors / Destructor
+		ProgramReflection();
+		explicit ProgramReflection(GLuint program);
+
+		// Manipulation (query again after a link)
+		void Reflect(GLuint program);
+
+		// Queries
+		GLint  UniformLocation(const std::string& name)   const; // or -1
+		GLint  UniformOffset(const std::string& name)     const; // or -1
+		GLuint UniformBlockIndex(const std::string& name) const; // or
+		                                                 // GL_INVALID_INDEX
+		GLint  UniformBlockSize(const std::string& name)  const; // or 0
+
+		// Members
+	private:
+		std::map<std::string, GLint> mLocations;
+		std::map<std::string, GLint> mOffsets;     // of block members
+		std::map<std::string, GLuint> mBlockIndexes;
+		std::map<std::string, GLint> mBlockSizes;
+	};
+
+
+	// Ring of ranges of a uniform buffer, written once per frame. Write
+	// waits for the fence of the oldest range, copies the data to it through
+	// an unsynchronized mapping and binds it; Fence must follow the draws
+	// that read it. The ranges are aligned to
+	// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
+	class UniformRing {
+	public:
+		// Constructors / Destructor
+		UniformRing();
+		~UniformRing();
+
+		// Manipulation
+		// allocate count ranges of size bytes in buffer
+		void Init(GLuint buffer,
+		          GLsizeiptr size,
+		          GLint count) throw(FWException);
+		void Write(const GLvoid *data, GLuint binding) throw(FWException);
+		void Fence();
+		// delete the fences while the context is current (the destructor
+		// deletes those left, which requires a context)
+		void Release();
+
+		// Members
+	private:
+		UniformRing(const UniformRing&);
+		UniformRing& operator=(const UniformRing&);
+		GLuint     mBuffer;
+		GLsizeiptr mSize;
+		GLsizeiptr mStride;
+		GLint      mCurrent;
+		std::vector<GLsync> mFences;
+	};
+
+
+	// Span of the enclosing scope, recorded on destruction if profiling was
+	// enabled on construction (see FW_PROFILE_SCOPE)
+	class ProfileScope {
+	public:
+		// Constructors / Destructor
+		explicit ProfileScope(const char *name);
+		~ProfileScope();
+
+		// Members
+	private:
+		ProfileScope(const ProfileScope&);
+		ProfileScope& operator=(const ProfileScope&);
+		const char *mName; // NULL if not recorded
+		GLdouble    mStart;
+	};
+
+
+	// GPU spans, measured with GL_TIMESTAMP queries so that they can nest.
+	// Collect records the spans whose queries are available, in the order
+	// they began, and never waits for the GPU; it should be called once per
+	// frame. Spans begun while all the queries are pending are dropped.
+	class GpuProfiler {
+	public:
+		// Constructors / Destructor
+		GpuProfiler();
+		~GpuProfiler();
+
+		// Manipulation
+		// allocate the queries of spanCount spans
+		void Init(GLint spanCount);
+		void Begin(const char *name);
+		void End();
+		void Collect();
+		// delete the queries while the context is current (the destructor
+		// deletes those left, which requires a context)
+		void Release();
+
+		// Members
+	private:
+		GpuProfiler(const GpuProfiler&);
+		GpuProfiler& operator=(const GpuProfiler&);
+		std::vector<GLuint>      mQueries; // begin, end of each span
+		std::vector<const char*> mNames;
+		std::vector<bool>        mClosed;
+		std::vector<GLint>       mOpen;    // stack of open spans, -1 if dropped
+		GLuint   mHead;                    // next span
+		GLuint   mTail;                    // oldest pending span
+		GLdouble mOffset;                  // GL time to profiler clock (s)
+	};
+
+
+	// Host memory tracked (as RESOURCE_HOST) during the lifetime of the
+	// object
+	class HostResource {
+	public:
+		// Constructors / Destructor
+		explicit HostResource(const std::string& owner);
+		~HostResource();
+
+		// Manipulation
+		void SetBytes(GLuint64 bytes);
+
+		// Members
+	private:
+		HostResource(const HostResource&);
+		HostResource& operator=(const HostResource&);
+		std::string mOwner;
+	};
+
+
+	// Function running on its own (detached) thread, to prepare data while
+	// frames are drawn. Done can be polled once per frame; once it returns
+	// true, the writes of the function are visible to the caller. data must
+	// outlive the thread.
+	class BackgroundTask {
+	public:
+		// Constructors / Destructor
+		BackgroundTask();
+
+		// Manipulation
+		// Start func(data); the previous function must be done
+		void Start(GLvoid (*func)(GLvoid *data),
+		           GLvoid *data) throw(FWException);
+
+		// Queries
+		bool Done() const; // true until started
+		void Wait() const; // until Done (polls every millisecond)
+
+		// Members
+	private:
+		BackgroundTask(const BackgroundTask&);
+		BackgroundTask& operator=(const BackgroundTask&);
+		friend GLvoid _run_background_task(BackgroundTask *task);
+		GLvoid (*mFunc)(GLvoid *data);
+		GLvoid *mData;
+		volatile GLint mDone;
+	};
+
+
 	// Basic timer class
 	class Timer {
 	public:
@@ -243,12 +594,58 @@ namespace fw {
 
 		// Queries
 		double Ticks()   const;
+		GLuint64 Nanoseconds() const;
+
+		// Members
+	private:
+		GLuint64 mStartTicks; // clock_nanoseconds
+		GLuint64 mStopTicks;
+		bool     mIsTicking;
+	};
+
+
+	// Statistics of the last window samples of a duration (in seconds):
+	// extrema, mean, percentiles, jitter (mean absolute difference of
+	// consecutive samples) and a histogram of buckets of bucketWidth
+	// seconds, the last of which also counts the longer samples. The
+	// queries return the statistics of the last Update.
+	class TimeStats {
+	public:
+		// Constructors / Destructor
+		explicit TimeStats(GLint window = 240,
+		                   GLdouble bucketWidth = 0.004,
+		                   GLint bucketCnt = 8);
+
+		// Manipulation
+		void SetWindow(GLint window);       // drops the samples
+		void SetHistogram(GLdouble bucketWidth, GLint bucketCnt);
+		void Add(GLdouble sample);
+		void Update();
+		void Clear();
+
+		// Queries
+		GLint    Window() const     {return GLint(mSamples.size());}
+		GLint    Count() const      {return GLint(mSorted.size());}
+		GLdouble Min() const;
+		GLdouble Mean() const       {return mMean;}
+		GLdouble Percentile(GLdouble p) const; // p in [0,100]
+		GLdouble Max() const;
+		GLdouble Jitter() const     {return mJitter;}
+		GLdouble BucketWidth() const {return mBucketWidth;}
+		const std::vector<GLint>& Histogram() const {return mHistogram;}
+		// Write the statistics (in ms) as a single line JSON object
+		void WriteJson(std::ostream& stream) const;
 
 		// Members
 	private:
-		double mStartTicks;
-		double mStopTicks;
-		bool   mIsTicking;
+		std::vector<GLdouble> mSamples; // ring of the last window samples
+		GLint mNext;
+		GLint mCount;
+		std::vector<GLdouble> mSorted;
+		GLdouble mMean;
+		GLdouble mJitter;
+		GLdouble mBucketWidth;
+		std::vector<GLint> mHistogram;
 	};
 
 
@@ -0,0 +1,1443 @@
+////////////////////////////////////////////////////////////////////////////////
+// \author   Jonathan Dupuy
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Lightfield.hpp"
+
+#include <fstream>   // std::ifstream std::ofstream
+#include <iostream>  // std::ostream
+#include <cstring>   // memcmp memcpy
+#include <cmath>     // log10 acos atan2 ceil floor sqrt log cos
+#include <cstdlib>   // abs
+#include <algorithm> // std::max
+#include <limits>    // std::numeric_limits
+#include <map>       // std::map
+#include <cstdio>    // fopen fread fwrite fflush rename remove
+
+#ifdef _WIN32
+#	include <io.h>     // _commit _fileno
+#else
+#	include <unistd.h> // fsync
+#endif // _WIN32
+
+namespace lf {
+////////////////////////////////////////////////////////////////////////////////
+// Exceptions
+//
+////////////////////////////////////////////////////////////////////////////////
+class _InvalidAtlasFormatException : public fw::FWException {
+public:
+	_InvalidAtlasFormatException() {
+		mMessage = "Invalid lightfield atlas format.";
+	}
+};
+
+class _MultiAtlasException : public fw::FWException {
+public:
+	_MultiAtlasException(const std::string& reason) {
+		mMessage = "Multi-asset atlas: " + reason;
+	}
+};
+
+class _AtlasFileException : public fw::FWException {
+public:
+	_AtlasFileException(const std::string& file, const std::string& reason) {
+		mMessage = "Lightfield cache " + file + ": " + reason;
+	}
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local functions
+//
+////////////////////////////////////////////////////////////////////////////////
+
+// cache file header
+static const char   _ATLAS_MAGIC[4] = {'L','F','A','T'};
+static const GLint  _ATLAS_VERSION  = 5;
+
+// checkpoint file header
+static const char   _CHECKPOINT_MAGIC[4] = {'L','F','C','P'};
+static const GLint  _CHECKPOINT_VERSION  = 3;
+static const GLint  _CHECKPOINT_HEADER_SIZE = 7; // GLints after the magic
+
+static const GLfloat _PI = 3.14159265358979323846f;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Checkpoint files: header, views, completion flags, then the base level
+// layers (offsets may exceed 2GB)
+static GLuint64 _checkpoint_flags(GLint viewCnt) {
+	return sizeof(_CHECKPOINT_MAGIC) + _CHECKPOINT_HEADER_SIZE*sizeof(GLint)
+	     + GLuint64(sizeof(View))*viewCnt;
+}
+
+static GLuint64 _checkpoint_layer(const Atlas& atlas, GLint layer) {
+	const GLint viewCnt = GLint(atlas.views.size());
+	return _checkpoint_flags(viewCnt) + viewCnt
+	     + GLuint64(4)*atlas.resolution*atlas.resolution*layer;
+}
+
+static bool _seek(FILE *file, GLuint64 offset) {
+#ifdef _WIN32
+	return _fseeki64(file, __int64(offset), SEEK_SET) == 0;
+#else
+	return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+// Flush a file to disk
+static bool _sync(FILE *file) {
+	if(fflush(file) != 0)
+		return false;
+#ifdef _WIN32
+	return _commit(_fileno(file)) == 0;
+#else
+	return fsync(fileno(file)) == 0;
+#endif
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Size of a layer of mip level
+static GLsizei _layer_size(const Atlas& atlas, GLint level) {
+	GLsizei size = std::max(atlas.resolution >> level, 1);
+	if(atlas.format == FORMAT_RGBA8)
+		return 4*size*size;
+	return fw::compressed_image_size(internal_format(atlas.format),
+	                                 size,
+	                                 size);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Split / merge the (depth, alpha) and (theta, phi) channels of RGBA8 layers
+static void _split_channels(const std::vector<GLubyte>& rgba,
+                            std::vector<GLubyte>& depthAlpha,
+                            std::vector<GLubyte>& normal) {
+	const size_t texelCnt = rgba.size()/4;
+	depthAlpha.resize(2*texelCnt);
+	normal.resize(2*texelCnt);
+	for(size_t i=0; i<texelCnt; ++i) {
+		depthAlpha[2*i]   = rgba[4*i];
+		depthAlpha[2*i+1] = rgba[4*i+3];
+		normal[2*i]       = rgba[4*i+1];
+		normal[2*i+1]     = rgba[4*i+2];
+	}
+}
+
+static void _merge_channels(const std::vector<GLubyte>& depthAlpha,
+                            const std::vector<GLubyte>& normal,
+                            std::vector<GLubyte>& rgba) {
+	const size_t texelCnt = depthAlpha.size()/2;
+	rgba.resize(4*texelCnt);
+	for(size_t i=0; i<texelCnt; ++i) {
+		rgba[4*i]   = depthAlpha[2*i];
+		rgba[4*i+1] = normal[2*i];
+		rgba[4*i+2] = normal[2*i+1];
+		rgba[4*i+3] = depthAlpha[2*i+1];
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions implementation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// PSNR of two byte arrays
+GLdouble psnr(const std::vector<GLubyte>& a, const std::vector<GLubyte>& b) {
+	GLdouble se = 0.0;
+	for(size_t i=0; i<a.size(); ++i)
+		se+= (GLdouble(a[i])-b[i])*(GLdouble(a[i])-b[i]);
+	if(se == 0.0)
+		return 99.0;
+	return 10.0*log10(255.0*255.0*a.size()/se);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// View count
+GLint view_count(GLint viewN) {
+	return 2*viewN*(viewN+1)+1;
+}
+
+GLint layer_count(const Atlas& atlas) {
+	GLint views = view_count(atlas.viewN);
+	return atlas.format == FORMAT_BC5 ? 2*views : views;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Internal format
+GLenum internal_format(GLint format) {
+	switch(format) {
+	case FORMAT_BC5: return GL_COMPRESSED_RG_RGTC2;
+	case FORMAT_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default:         return GL_RGBA8;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Views
+void build_views(GLint viewN,
+                 const std::vector<Vector3>& positions,
+                 std::vector<View>& views) {
+	const GLint n = viewN;
+	views.resize(view_count(n));
+	GLint current = 0;
+	for(GLint i=-n; i<=n; ++i)
+		for(GLint j=-n+abs(i);j<=n-abs(i);++j) {
+			GLfloat x = (i + j) / float(n);
+			GLfloat y = (j - i) / float(n);
+			GLfloat angle = (90.0f - std::max(fabs(x),fabs(y)) * 90.0f)
+			              * _PI/180.0f;
+			GLfloat alpha = x == 0.0f && y == 0.0f ? 0.0f
+				: atan2(y, x);
+			Matrix4x4 rotation = Matrix4x4::RotationAboutX(-angle);
+			Matrix4x4 mv  = rotation.Inverse()
+			              * Matrix4x4::RotationAboutY(-alpha);
+
+			View& view = views[current++];
+			view.axis[0] = Vector4(mv[0][0],mv[0][1],mv[0][2],0);
+			view.axis[1] = Vector4(mv[1][0],mv[1][1],mv[1][2],0);
+			view.axis[2] = Vector4(mv[2][0],mv[2][1],mv[2][2],0);
+			fit_view_bounds(view, positions);
+		}
+}
+
+
+void fit_view_bounds(View& view, const std::vector<Vector3>& positions) {
+	GLfloat lo[3] = {0.0f, 0.0f, 0.0f};
+	GLfloat hi[3] = {0.0f, 0.0f, 0.0f};
+	for(size_t i=0; i<positions.size(); ++i) {
+		const Vector3& p = positions[i];
+		for(GLint k=0; k<3; ++k) {
+			// view space coordinate k (depth is -z)
+			GLfloat c = view.axis[0][k]*p[0]
+			          + view.axis[1][k]*p[1]
+			          + view.axis[2][k]*p[2];
+			if(k == 2)
+				c = -c;
+			lo[k] = i ? std::min(lo[k], c) : c;
+			hi[k] = i ? std::max(hi[k], c) : c;
+		}
+	}
+	// pad by a fraction of a quantization step so that extreme texels are
+	// not clipped, and keep the ranges non empty
+	GLfloat pad[3];
+	for(GLint k=0; k<3; ++k)
+		pad[k] = std::max(hi[k]-lo[k], 1e-4f) / 512.0f;
+	view.bounds = Vector4(lo[0]-pad[0], hi[0]+pad[0],
+	                      lo[1]-pad[1], hi[1]+pad[1]);
+	view.depth  = Vector4(lo[2]-pad[2], hi[2]+pad[2], 0.0f, 0.0f);
+}
+
+
+Matrix4x4 view_matrix(const View& view) {
+	return Matrix4x4(view.axis[0],
+	                 view.axis[1],
+	                 view.axis[2],
+	                 Vector4(0,0,0,1));
+}
+
+
+Matrix4x4 view_projection(const View& view) {
+	return Matrix4x4::Ortho(view.bounds[0],
+	                        view.bounds[1],
+	                        view.bounds[2],
+	                        view.bounds[3],
+	                        view.depth[0],
+	                        view.depth[1])
+	       * view_matrix(view);
+}
+
+
+GLsizei fit_resolution(const std::vector<View>& views,
+                       GLfloat texelDensity) {
+	GLfloat extent = 0.0f;
+	for(size_t i=0; i<views.size(); ++i)
+		extent = std::max(extent,
+		                  std::max(views[i].bounds[1]-views[i].bounds[0],
+		                           views[i].bounds[3]-views[i].bounds[2]));
+	GLsizei resolution = GLsizei(ceil(extent*texelDensity));
+	return std::max((resolution+3) & ~3, 4);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Normal encodings
+void encode_normal(const Vector3& normal,
+                   GLint encoding,
+                   GLubyte encoded[2]) {
+	const Vector3 n = normal.Normalize();
+	GLfloat u, v;
+	if(encoding == NORMAL_OCTAHEDRAL) {
+		// project on the octahedron, fold the lower half over the upper one
+		GLfloat l1 = fabs(n[0])+fabs(n[1])+fabs(n[2]);
+		u = n[0]/l1;
+		v = n[2]/l1;
+		if(n[1] < 0.0f) {
+			GLfloat tu = u;
+			u = (1.0f-fabs(v)) * (tu >= 0.0f ? 1.0f : -1.0f);
+			v = (1.0f-fabs(tu)) * (v  >= 0.0f ? 1.0f : -1.0f);
+		}
+		u = u*0.5f+0.5f;
+		v = v*0.5f+0.5f;
+	}
+	else {
+		u = acos(std::min(std::max(n[1], -1.0f), 1.0f)) / _PI;
+		v = atan2(n[0], -n[2]) / (2.0f*_PI) + 0.5f;
+	}
+	encoded[0] = GLubyte(std::min(std::max(u, 0.0f), 1.0f)*255.0f+0.5f);
+	encoded[1] = GLubyte(std::min(std::max(v, 0.0f), 1.0f)*255.0f+0.5f);
+}
+
+Vector3 decode_normal(const GLubyte encoded[2], GLint encoding) {
+	return decode_normal(encoded[0] / 255.0f, encoded[1] / 255.0f, encoding);
+}
+
+Vector3 decode_normal(GLfloat u, GLfloat v, GLint encoding) {
+	if(encoding == NORMAL_OCTAHEDRAL) {
+		Vector3 n(u*2.0f-1.0f, 0.0f, v*2.0f-1.0f);
+		n[1] = 1.0f-fabs(n[0])-fabs(n[2]);
+		if(n[1] < 0.0f) {
+			GLfloat tx = n[0];
+			n[0] = (1.0f-fabs(n[2])) * (tx   >= 0.0f ? 1.0f : -1.0f);
+			n[2] = (1.0f-fabs(tx))   * (n[2] >= 0.0f ? 1.0f : -1.0f);
+		}
+		return n.Normalize();
+	}
+	GLfloat theta = u * _PI;
+	GLfloat phi   = (v-0.5f) * (2.0f*_PI);
+	return Vector3(sin(theta)*sin(phi), cos(theta), -sin(theta)*cos(phi));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Normal encoding error
+void benchmark_normal_encodings(const std::vector<Vector3>& normals,
+                                std::ostream& outputStream) {
+	const char* encodingNames[] = {"spherical", "octahedral"};
+	const GLfloat POLE_COS = 0.99f; // ~8 degrees around the poles
+
+	outputStream << "encoding    mean (deg)  rms (deg)  max (deg)"
+	             << "  max near poles (deg)\n";
+	for(GLint encoding=0; encoding<NORMAL_COUNT; ++encoding) {
+		GLdouble sum = 0.0, sumSqr = 0.0, maxErr = 0.0, maxPole = 0.0;
+		for(size_t i=0; i<normals.size(); ++i) {
+			const Vector3 n = normals[i].Normalize();
+			GLubyte encoded[2];
+			encode_normal(n, encoding, encoded);
+			GLfloat d = Vector3::DotProduct(n, decode_normal(encoded,
+			                                                 encoding));
+			GLdouble err = acos(std::min(std::max(d, -1.0f), 1.0f))
+			             * 180.0 / _PI;
+			sum+= err;
+			sumSqr+= err*err;
+			maxErr = std::max(maxErr, err);
+			if(fabs(n[1]) > POLE_COS)
+				maxPole = std::max(maxPole, err);
+		}
+		GLdouble cnt = std::max(GLdouble(normals.size()), 1.0);
+		outputStream << encodingNames[encoding] << '\t'
+		             << sum / cnt << '\t'
+		             << sqrt(sumSqr / cnt) << '\t'
+		             << maxErr << '\t'
+		             << maxPole << std::endl;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Compress
+void compress_atlas(Atlas& atlas,
+                    GLint format,
+                    GLint quality) throw(fw::FWException) {
+	FW_PROFILE_SCOPE("compress_atlas");
+	if(atlas.format != FORMAT_RGBA8 || format < 0 || format >= FORMAT_COUNT)
+		throw _InvalidAtlasFormatException();
+	atlas.quality = quality;
+	if(format == FORMAT_RGBA8)
+		return;
+
+	const GLint views = view_count(atlas.viewN);
+	for(size_t i=0; i<atlas.levels.size(); ++i) {
+		GLsizei size = std::max(atlas.resolution >> i, 1);
+		std::vector<GLubyte>& level = atlas.levels[i];
+		if(format == FORMAT_BC7) {
+			std::vector<GLubyte> blocks;
+			fw::compress_images(size, size, views, 4, &level[0],
+			                    GL_COMPRESSED_RGBA_BPTC_UNORM, quality,
+			                    blocks);
+			level.swap(blocks);
+		}
+		else {
+			std::vector<GLubyte> depthAlpha, normal, blocks;
+			_split_channels(level, depthAlpha, normal);
+			fw::compress_images(size, size, views, 2, &depthAlpha[0],
+			                    GL_COMPRESSED_RG_RGTC2, quality, level);
+			fw::compress_images(size, size, views, 2, &normal[0],
+			                    GL_COMPRESSED_RG_RGTC2, quality, blocks);
+			level.insert(level.end(), blocks.begin(), blocks.end());
+		}
+	}
+	atlas.format = format;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Decompress
+void decompress_atlas(Atlas& atlas) throw(fw::FWException) {
+	const GLint views = view_count(atlas.viewN);
+	for(size_t i=0; i<atlas.levels.size(); ++i) {
+		GLsizei size = std::max(atlas.resolution >> i, 1);
+		std::vector<GLubyte>& level = atlas.levels[i];
+		if(atlas.format == FORMAT_BC7) {
+			std::vector<GLubyte> texels;
+			fw::decompress_images(size, size, views, 4, &level[0],
+			                      GL_COMPRESSED_RGBA_BPTC_UNORM, texels);
+			level.swap(texels);
+		}
+		else if(atlas.format == FORMAT_BC5) {
+			std::vector<GLubyte> depthAlpha, normal;
+			fw::decompress_images(size, size, views, 2, &level[0],
+			                      GL_COMPRESSED_RG_RGTC2, depthAlpha);
+			fw::decompress_images(size, size, views, 2,
+			                      &level[level.size()/2],
+			                      GL_COMPRESSED_RG_RGTC2, normal);
+			_merge_channels(depthAlpha, normal, level);
+		}
+	}
+	atlas.format = FORMAT_RGBA8;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Save to file
+void save_atlas(const Atlas& atlas,
+                const std::string& filename) throw(fw::FWException) {
+	FW_PROFILE_SCOPE("save_atlas");
+	const std::string partial = filename + ".tmp";
+	std::ofstream file(partial.c_str(), std::ios::out | std::ios::binary);
+	if(file.fail())
+		throw _AtlasFileException(filename, "cannot open for writing.");
+
+	const GLint header[10] = {
+		_ATLAS_VERSION,
+		atlas.viewN,
+		atlas.resolution,
+		atlas.format,
+		atlas.normals,
+		GLint(atlas.mipmapFilter),
+		atlas.quality,
+		GLint(atlas.meshHash),
+		GLint(atlas.views.size()),
+		GLint(atlas.levels.size())
+	};
+	file.write(_ATLAS_MAGIC, sizeof(_ATLAS_MAGIC));
+	file.write(reinterpret_cast<const char*>(header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(&atlas.views[0]),
+	           sizeof(View)*atlas.views.size());
+	for(size_t i=0; i<atlas.levels.size(); ++i)
+		file.write(reinterpret_cast<const char*>(&atlas.levels[i][0]),
+		           atlas.levels[i].size());
+	file.close();
+	if(file.fail())
+		throw _AtlasFileException(filename, "write failed.");
+#ifdef _WIN32
+	std::remove(filename.c_str()); // rename does not replace files
+#endif
+	if(std::rename(partial.c_str(), filename.c_str()) != 0)
+		throw _AtlasFileException(filename, "cannot replace.");
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Load from file
+void load_atlas(Atlas& atlas,
+                const std::string& filename) throw(fw::FWException) {
+	FW_PROFILE_SCOPE("load_atlas");
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+	if(file.fail())
+		throw _AtlasFileException(filename, "not found.");
+
+	char magic[4];
+	GLint header[10];
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char*>(header), sizeof(header));
+	if(file.fail() || memcmp(magic, _ATLAS_MAGIC, sizeof(magic)))
+		throw _AtlasFileException(filename, "invalid header.");
+	if(header[0] != _ATLAS_VERSION)
+		throw _AtlasFileException(filename, "unsupported version.");
+
+	atlas.viewN        = header[1];
+	atlas.resolution   = header[2];
+	atlas.format       = header[3];
+	atlas.normals      = header[4];
+	atlas.mipmapFilter = GLenum(header[5]);
+	atlas.quality      = header[6];
+	atlas.meshHash     = GLuint(header[7]);
+	if(atlas.viewN < 1 || atlas.viewN > MAX_VIEW_COUNT
+	|| view_count(atlas.viewN) > MAX_VIEW_COUNT
+	|| atlas.resolution < 1 || atlas.resolution > MAX_RESOLUTION)
+		throw _AtlasFileException(filename, "atlas too large.");
+	if(atlas.format < 0 || atlas.format >= FORMAT_COUNT
+	|| atlas.normals < 0 || atlas.normals >= NORMAL_COUNT
+	|| header[8] != view_count(atlas.viewN)
+	|| header[9] != fw::mip_level_count(atlas.resolution, atlas.resolution))
+		throw _AtlasFileException(filename, "inconsistent header.");
+
+	// check the payload against the file size before allocating it
+	const size_t maxBytes = std::numeric_limits<size_t>::max();
+	const size_t layers = layer_count(atlas);
+	size_t bytes = sizeof(View)*header[8];
+	for(GLint i=0; i<header[9]; ++i) {
+		const size_t levelBytes = _layer_size(atlas, i);
+		if(levelBytes > (maxBytes - bytes) / layers)
+			throw _AtlasFileException(filename, "atlas too large.");
+		bytes+= levelBytes*layers;
+	}
+	const std::streampos payload = file.tellg();
+	file.seekg(0, std::ios::end);
+	if(file.fail() || size_t(file.tellg() - payload) < bytes)
+		throw _AtlasFileException(filename, "truncated file.");
+	file.seekg(payload);
+
+	atlas.views.resize(header[8]);
+	atlas.levels.resize(header[9]);
+	file.read(reinterpret_cast<char*>(&atlas.views[0]),
+	          sizeof(View)*atlas.views.size());
+	for(size_t i=0; i<atlas.levels.size(); ++i) {
+		atlas.levels[i].resize(_layer_size(atlas, GLint(i))
+		                       * layer_count(atlas));
+		file.read(reinterpret_cast<char*>(&atlas.levels[i][0]),
+		          atlas.levels[i].size());
+	}
+	if(file.fail())
+		throw _AtlasFileException(filename, "truncated file.");
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Checkpoints
+std::string cache_file(const std::string& meshFile) {
+	return meshFile.substr(0, meshFile.rfind('.')) + ".lfa";
+}
+
+
+std::string checkpoint_file(const std::string& cacheFile) {
+	return cacheFile + ".part";
+}
+
+
+GLint open_checkpoint(const std::string& filename,
+                      GLint baker,
+                      Atlas& atlas,
+                      AtlasCheckpoint& checkpoint) throw(fw::FWException) {
+	FW_PROFILE_SCOPE("open_checkpoint");
+	const GLint viewCnt = GLint(atlas.views.size());
+	const size_t layerBytes = size_t(4)*atlas.resolution*atlas.resolution;
+	const GLint header[_CHECKPOINT_HEADER_SIZE] = {
+		_CHECKPOINT_VERSION,
+		baker,
+		atlas.viewN,
+		atlas.resolution,
+		atlas.normals,
+		GLint(atlas.meshHash),
+		viewCnt
+	};
+	atlas.levels.assign(1, std::vector<GLubyte>(layerBytes*viewCnt, 0));
+	checkpoint.filename = filename;
+	checkpoint.completed.assign(viewCnt, 0);
+
+	// resume if the file was written for the same atlas
+	GLint completedCnt = 0;
+	FILE *file = fopen(filename.c_str(), "rb");
+	if(file != NULL) {
+		char magic[4];
+		GLint fileHeader[_CHECKPOINT_HEADER_SIZE];
+		std::vector<View> views(viewCnt);
+		if(fread(magic, sizeof(magic), 1, file) == 1
+		&& fread(fileHeader, sizeof(fileHeader), 1, file) == 1
+		&& !memcmp(magic, _CHECKPOINT_MAGIC, sizeof(magic))
+		&& !memcmp(fileHeader, header, sizeof(header))
+		&& fread(&views[0], sizeof(View), viewCnt, file) == size_t(viewCnt)
+		&& !memcmp(&views[0], &atlas.views[0], sizeof(View)*viewCnt)
+		&& fread(&checkpoint.completed[0], 1, viewCnt, file)
+		   == size_t(viewCnt)) {
+			for(GLint i=0; i<viewCnt; ++i) {
+				if(!checkpoint.completed[i])
+					continue;
+				if(_seek(file, _checkpoint_layer(atlas, i))
+				&& fread(&atlas.levels[0][layerBytes*i], 1, layerBytes, file)
+				   == layerBytes)
+					++completedCnt;
+				else
+					checkpoint.completed[i] = 0;
+			}
+		}
+		fclose(file);
+	}
+	if(completedCnt > 0)
+		return completedCnt;
+
+	// start over
+	checkpoint.completed.assign(viewCnt, 0);
+	file = fopen(filename.c_str(), "wb");
+	if(file == NULL)
+		throw _AtlasFileException(filename, "cannot open for writing.");
+	bool written =
+		fwrite(_CHECKPOINT_MAGIC, sizeof(_CHECKPOINT_MAGIC), 1, file) == 1
+	 && fwrite(header, sizeof(header), 1, file) == 1
+	 && fwrite(&atlas.views[0], sizeof(View), viewCnt, file) == size_t(viewCnt)
+	 && fwrite(&checkpoint.completed[0], 1, viewCnt, file) == size_t(viewCnt)
+	 && _sync(file);
+	fclose(file);
+	if(!written)
+		throw _AtlasFileException(filename, "write failed.");
+	return 0;
+}
+
+
+void write_checkpoint(AtlasCheckpoint& checkpoint,
+                      const Atlas& atlas,
+                      const std::vector<GLint>& layers)
+                      throw(fw::FWException) {
+	FW_PROFILE_SCOPE("write_checkpoint");
+	const GLint viewCnt = GLint(atlas.views.size());
+	const size_t layerBytes = size_t(4)*atlas.resolution*atlas.resolution;
+	FILE *file = fopen(checkpoint.filename.c_str(), "r+b");
+	if(file == NULL)
+		throw _AtlasFileException(checkpoint.filename, "cannot open.");
+
+	// the layers reach the disk before their flags
+	bool written = true;
+	for(size_t i=0; i<layers.size() && written; ++i)
+		written = _seek(file, _checkpoint_layer(atlas, layers[i]))
+		       && fwrite(&atlas.levels[0][layerBytes*layers[i]],
+		                 1, layerBytes, file) == layerBytes;
+	written = written && _sync(file);
+	for(size_t i=0; i<layers.size() && written; ++i)
+		written = _seek(file, _checkpoint_flags(viewCnt)+layers[i])
+		       && fputc(1, file) != EOF;
+	written = written && _sync(file);
+	fclose(file);
+	if(!written)
+		throw _AtlasFileException(checkpoint.filename, "write failed.");
+	for(size_t i=0; i<layers.size(); ++i)
+		checkpoint.completed[layers[i]] = 1;
+}
+
+
+void remove_checkpoint(const AtlasCheckpoint& checkpoint) {
+	std::remove(checkpoint.filename.c_str());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Upload to GL
+static void _tex_layers(GLsizei resolution,
+                        GLint format,
+                        GLint layers,
+                        const std::vector< std::vector<GLubyte> >& levels) {
+	const GLenum internalFormat = internal_format(format);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY,
+	               GLsizei(levels.size()),
+	               internalFormat,
+	               resolution,
+	               resolution,
+	               layers);
+	if(format == FORMAT_RGBA8) {
+		fw::tex_mipmaps_image3D(resolution,
+		                        resolution,
+		                        layers,
+		                        GL_RGBA,
+		                        GL_UNSIGNED_BYTE,
+		                        levels);
+		return;
+	}
+	for(size_t i=0; i<levels.size(); ++i) {
+		GLsizei size = std::max(resolution >> i, 1);
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY,
+		                          GLint(i),
+		                          0, 0, 0,
+		                          size, size, layers,
+		                          internalFormat,
+		                          GLsizei(levels[i].size()),
+		                          &levels[i][0]);
+	}
+}
+
+void tex_atlas(const Atlas& atlas) {
+	_tex_layers(atlas.resolution,
+	            atlas.format,
+	            layer_count(atlas),
+	            atlas.levels);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Multi-asset atlases
+Vector4 atlas_bounds(const Atlas& atlas) {
+	Vector4 sphere;
+	for(size_t i=0; i<atlas.views.size(); ++i) {
+		const View& view = atlas.views[i];
+		const Vector4& b = view.bounds;
+		// box center in view space (depth is -z), then in object space
+		GLfloat c[3] = {0.5f*(b[0]+b[1]),
+		                0.5f*(b[2]+b[3]),
+		                -0.5f*(view.depth[0]+view.depth[1])};
+		GLfloat extent[3] = {b[1]-b[0],
+		                     b[3]-b[2],
+		                     view.depth[1]-view.depth[0]};
+		GLfloat radius = 0.5f*sqrt(extent[0]*extent[0]
+		                         + extent[1]*extent[1]
+		                         + extent[2]*extent[2]);
+		if(i && radius >= sphere[3])
+			continue;
+		for(GLint k=0; k<3; ++k)
+			sphere[k] = view.axis[k][0]*c[0]
+			          + view.axis[k][1]*c[1]
+			          + view.axis[k][2]*c[2];
+		sphere[3] = radius;
+	}
+	return sphere;
+}
+
+
+GLint add_atlas(MultiAtlas& multi,
+                const Atlas& atlas) throw(fw::FWException) {
+	const GLint layers = layer_count(atlas);
+	if(multi.assets.empty()) {
+		multi.resolution = atlas.resolution;
+		multi.format     = atlas.format;
+		multi.normals    = atlas.normals;
+		multi.views.clear();
+		multi.pageLayers.clear();
+		multi.pages.clear();
+	}
+	else if(atlas.resolution != multi.resolution
+	     || atlas.format != multi.format
+	     || atlas.normals != multi.normals)
+		throw _MultiAtlasException("resolution, format or normal encoding"
+		                           " differs from the first asset.");
+	if(layers > multi.maxLayers)
+		throw _MultiAtlasException("asset has more layers than a page.");
+
+	// open a page if needed
+	if(multi.pages.empty() || multi.pageLayers.back()+layers > multi.maxLayers) {
+		multi.pageLayers.push_back(0);
+		multi.pages.push_back(
+			std::vector< std::vector<GLubyte> >(atlas.levels.size()));
+	}
+
+	AssetRecord asset;
+	asset.page        = GLint(multi.pages.size())-1;
+	asset.layerOffset = multi.pageLayers.back();
+	asset.viewN       = atlas.viewN;
+	asset.viewOffset  = GLint(multi.views.size());
+	asset.bounds      = atlas_bounds(atlas);
+	multi.assets.push_back(asset);
+	multi.views.insert(multi.views.end(),
+	                   atlas.views.begin(),
+	                   atlas.views.end());
+
+	// levels store layers contiguously, so pages grow by appending
+	std::vector< std::vector<GLubyte> >& levels = multi.pages.back();
+	for(size_t i=0; i<levels.size(); ++i)
+		levels[i].insert(levels[i].end(),
+		                 atlas.levels[i].begin(),
+		                 atlas.levels[i].end());
+	multi.pageLayers.back()+= layers;
+	return GLint(multi.assets.size())-1;
+}
+
+
+void tex_multi_atlas(const MultiAtlas& multi, GLint page) {
+	_tex_layers(multi.resolution,
+	            multi.format,
+	            multi.pageLayers[page],
+	            multi.pages[page]);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Sparse storage
+// pack a list of sparse.tileCnt padded tiles in a square-ish texture
+static void _pack_tiles(const std::vector<GLubyte>& tiles,
+                        SparseAtlas& sparse) {
+	const GLint paddedSize = sparse.tileSize+2;
+	const GLint slotCnt = std::max(sparse.tileCnt, 1);
+	sparse.tilesPerRow = GLint(ceil(sqrt(GLdouble(slotCnt))));
+	const GLint rowCnt = (slotCnt+sparse.tilesPerRow-1)/sparse.tilesPerRow;
+	const GLint width  = sparse.tilesPerRow*paddedSize;
+	sparse.tiles.assign(4*width*rowCnt*paddedSize, 0);
+	for(GLint i=0; i<sparse.tileCnt; ++i) {
+		GLint x0 = (i % sparse.tilesPerRow)*paddedSize;
+		GLint y0 = (i / sparse.tilesPerRow)*paddedSize;
+		for(GLint y=0; y<paddedSize; ++y)
+			memcpy(&sparse.tiles[4*((y0+y)*width+x0)],
+			       &tiles[4*(i*paddedSize+y)*paddedSize],
+			       4*paddedSize);
+	}
+}
+
+// inverse of _pack_tiles
+static void _unpack_tiles(const SparseAtlas& sparse,
+                          std::vector<GLubyte>& tiles) {
+	const GLint paddedSize = sparse.tileSize+2;
+	const GLint width  = sparse.tilesPerRow*paddedSize;
+	tiles.resize(4*sparse.tileCnt*paddedSize*paddedSize);
+	for(GLint i=0; i<sparse.tileCnt; ++i) {
+		GLint x0 = (i % sparse.tilesPerRow)*paddedSize;
+		GLint y0 = (i / sparse.tilesPerRow)*paddedSize;
+		for(GLint y=0; y<paddedSize; ++y)
+			memcpy(&tiles[4*(i*paddedSize+y)*paddedSize],
+			       &sparse.tiles[4*((y0+y)*width+x0)],
+			       4*paddedSize);
+	}
+}
+
+
+void build_sparse_atlas(const Atlas& atlas,
+                        GLint tileSize,
+                        SparseAtlas& sparse) throw(fw::FWException) {
+	FW_PROFILE_SCOPE("build_sparse_atlas");
+	if(atlas.format != FORMAT_RGBA8 || tileSize < 1)
+		throw _InvalidAtlasFormatException();
+
+	const GLint paddedSize = tileSize+2;
+	sparse.resolution = atlas.resolution;
+	sparse.layerCnt   = layer_count(atlas);
+	sparse.levelCnt   = GLint(atlas.levels.size());
+	sparse.tileSize   = tileSize;
+	sparse.tileCnt    = 0;
+	sparse.levelOffsets.resize(sparse.levelCnt);
+	sparse.indirection.resize(0);
+
+	// gather the non empty tiles, with their border, in a list
+	std::vector<GLubyte> tiles, tile(4*paddedSize*paddedSize);
+	for(GLint level=0; level<sparse.levelCnt; ++level) {
+		const GLint size = std::max(atlas.resolution >> level, 1);
+		const GLint tileCnt = (size+tileSize-1)/tileSize;
+		sparse.levelOffsets[level] = GLint(sparse.indirection.size());
+		for(GLint layer=0; layer<sparse.layerCnt; ++layer) {
+			const GLubyte* texels = &atlas.levels[level][4*layer*size*size];
+			for(GLint ty=0; ty<tileCnt; ++ty)
+				for(GLint tx=0; tx<tileCnt; ++tx) {
+					bool empty = true;
+					for(GLint y=0; y<paddedSize; ++y)
+						for(GLint x=0; x<paddedSize; ++x) {
+							GLint sx = tx*tileSize+x-1;
+							GLint sy = ty*tileSize+y-1;
+							bool inside = sx >= 0 && sx < size
+							           && sy >= 0 && sy < size;
+							for(GLint c=0; c<4; ++c) {
+								GLubyte t = inside
+								          ? texels[4*(sy*size+sx)+c] : 0;
+								tile[4*(y*paddedSize+x)+c] = t;
+								empty = empty && t == 0;
+							}
+						}
+					if(empty) {
+						sparse.indirection.push_back(SparseAtlas::EMPTY_TILE);
+					}
+					else {
+						sparse.indirection.push_back(sparse.tileCnt++);
+						tiles.insert(tiles.end(), tile.begin(), tile.end());
+					}
+				}
+		}
+	}
+
+	_pack_tiles(tiles, sparse);
+}
+
+
+void dedup_sparse_atlas(SparseAtlas& sparse, GLint maxError) {
+	const GLint tileBytes = 4*(sparse.tileSize+2)*(sparse.tileSize+2);
+	std::vector<GLubyte> tiles, unique;
+	_unpack_tiles(sparse, tiles);
+
+	// exact duplicates are found by hashing the texels; near duplicates by
+	// hashing the coverage (non zero alpha) of the tiles, and comparing the
+	// most recent candidates with the same coverage
+	const size_t MAX_CANDIDATES = 64;
+
+	std::map<GLuint64, std::vector<GLint> > buckets; // unique tiles by hash
+	std::vector<GLuint> remap(sparse.tileCnt);
+	GLint uniqueCnt = 0;
+	for(GLint i=0; i<sparse.tileCnt; ++i) {
+		const GLubyte* tile = &tiles[i*tileBytes];
+		GLuint64 hash = 14695981039346656037ull; // FNV-1a
+		for(GLint j=0; j<tileBytes; ++j)
+			if(maxError == 0)
+				hash = (hash ^ tile[j]) * 1099511628211ull;
+			else if(j % 4 == 3)
+				hash = (hash ^ (tile[j] > 0)) * 1099511628211ull;
+
+		std::vector<GLint>& bucket = buckets[hash];
+		GLint match = -1;
+		for(size_t k=bucket.size(); k>0 && match < 0; --k) {
+			if(bucket.size()-k >= MAX_CANDIDATES)
+				break;
+			const GLubyte* other = &unique[bucket[k-1]*tileBytes];
+			GLint error = 0;
+			for(GLint j=0; j<tileBytes && error <= maxError; ++j)
+				error = std::max(error, abs(GLint(tile[j])-other[j]));
+			if(error <= maxError)
+				match = bucket[k-1];
+		}
+		if(match < 0) {
+			match = uniqueCnt++;
+			bucket.push_back(match);
+			unique.insert(unique.end(), tile, tile+tileBytes);
+		}
+		remap[i] = GLuint(match);
+	}
+
+	for(size_t i=0; i<sparse.indirection.size(); ++i)
+		if(sparse.indirection[i] != SparseAtlas::EMPTY_TILE)
+			sparse.indirection[i] = remap[sparse.indirection[i]];
+	sparse.tileCnt = uniqueCnt;
+	_pack_tiles(unique, sparse);
+}
+
+
+void tex_sparse_atlas(const SparseAtlas& sparse) {
+	const GLint width  = sparse.tilesPerRow*(sparse.tileSize+2);
+	const GLint height = GLint(sparse.tiles.size()/(4*width));
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+	glTexSubImage2D(GL_TEXTURE_2D,
+	                0,
+	                0, 0,
+	                width, height,
+	                GL_RGBA,
+	                GL_UNSIGNED_BYTE,
+	                &sparse.tiles[0]);
+	glBufferData(GL_TEXTURE_BUFFER,
+	             sizeof(GLuint)*sparse.indirection.size(),
+	             &sparse.indirection[0],
+	             GL_STATIC_DRAW);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Reference lookups
+static void _bilinear(const GLubyte* texels,
+                      GLint width, GLint height,
+                      GLfloat x, GLfloat y,
+                      GLfloat texel[4]) {
+	x-= 0.5f;
+	y-= 0.5f;
+	const GLint x0 = GLint(floor(x));
+	const GLint y0 = GLint(floor(y));
+	const GLfloat fx = x-x0;
+	const GLfloat fy = y-y0;
+	const GLfloat weights[4] = {(1.0f-fx)*(1.0f-fy), fx*(1.0f-fy),
+	                            (1.0f-fx)*fy,        fx*fy};
+	for(GLint c=0; c<4; ++c)
+		texel[c] = 0.0f;
+	for(GLint i=0; i<4; ++i) {
+		GLint tx = x0+(i&1);
+		GLint ty = y0+(i>>1);
+		if(tx < 0 || tx >= width || ty < 0 || ty >= height) // border
+			continue;
+		for(GLint c=0; c<4; ++c)
+			texel[c]+= weights[i]*texels[4*(ty*width+tx)+c]/255.0f;
+	}
+}
+
+static void _sample_level(const Atlas& atlas,
+                          GLint layer, GLint level,
+                          GLfloat u, GLfloat v,
+                          GLfloat texel[4]) {
+	const GLint size = std::max(atlas.resolution >> level, 1);
+	_bilinear(&atlas.levels[level][4*layer*size*size],
+	          size, size, u*size, v*size, texel);
+}
+
+static void _sample_level(const SparseAtlas& sparse,
+                          GLint layer, GLint level,
+                          GLfloat u, GLfloat v,
+                          GLfloat texel[4]) {
+	const GLint size = std::max(sparse.resolution >> level, 1);
+	const GLint tileCnt = (size+sparse.tileSize-1)/sparse.tileSize;
+	const GLfloat x = u*size, y = v*size;
+	for(GLint c=0; c<4; ++c)
+		texel[c] = 0.0f;
+	if(x < -0.5f || y < -0.5f || x > size+0.5f || y > size+0.5f)
+		return;
+	const GLint tx = std::min(std::max(GLint(floor(x/sparse.tileSize)), 0),
+	                          tileCnt-1);
+	const GLint ty = std::min(std::max(GLint(floor(y/sparse.tileSize)), 0),
+	                          tileCnt-1);
+	const GLuint tile = sparse.indirection[sparse.levelOffsets[level]
+	                                     + (layer*tileCnt+ty)*tileCnt+tx];
+	if(tile == SparseAtlas::EMPTY_TILE)
+		return;
+	const GLint paddedSize = sparse.tileSize+2;
+	const GLint width = sparse.tilesPerRow*paddedSize;
+	_bilinear(&sparse.tiles[0],
+	          width, GLint(sparse.tiles.size()/(4*width)),
+	          (tile % sparse.tilesPerRow)*paddedSize + x-tx*sparse.tileSize+1,
+	          (tile / sparse.tilesPerRow)*paddedSize + y-ty*sparse.tileSize+1,
+	          texel);
+}
+
+template<typename T>
+static void _sample_trilinear(const T& atlas,
+                              GLint levelCnt,
+                              GLint layer,
+                              GLfloat u, GLfloat v, GLfloat lod,
+                              GLfloat texel[4]) {
+	lod = std::min(std::max(lod, 0.0f), GLfloat(levelCnt-1));
+	const GLint level = GLint(floor(lod));
+	const GLfloat f = lod-level;
+	_sample_level(atlas, layer, level, u, v, texel);
+	if(f > 0.0f) {
+		GLfloat texel1[4];
+		_sample_level(atlas, layer, level+1, u, v, texel1);
+		for(GLint c=0; c<4; ++c)
+			texel[c]+= f*(texel1[c]-texel[c]);
+	}
+}
+
+
+void sample_atlas(const Atlas& atlas,
+                  GLint layer,
+                  GLfloat u, GLfloat v, GLfloat lod,
+                  GLfloat texel[4]) {
+	_sample_trilinear(atlas, GLint(atlas.levels.size()),
+	                  layer, u, v, lod, texel);
+}
+
+
+void sample_sparse_atlas(const SparseAtlas& sparse,
+                         GLint layer,
+                         GLfloat u, GLfloat v, GLfloat lod,
+                         GLfloat texel[4]) {
+	_sample_trilinear(sparse, sparse.levelCnt, layer, u, v, lod, texel);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Sparse storage benchmark
+void benchmark_sparse_atlas(const Atlas& atlas,
+                            GLint tileSize,
+                            std::ostream& outputStream)
+                            throw(fw::FWException) {
+	SparseAtlas sparse;
+	build_sparse_atlas(atlas, tileSize, sparse);
+
+	// coverage of the base level
+	size_t covered = 0;
+	for(size_t i=3; i<atlas.levels[0].size(); i+=4)
+		covered+= atlas.levels[0][i] > 0;
+	GLdouble denseBytes = 0.0;
+	for(size_t i=0; i<atlas.levels.size(); ++i)
+		denseBytes+= atlas.levels[i].size();
+	GLdouble sparseBytes = sparse.tiles.size()
+	                     + sizeof(GLuint)*sparse.indirection.size();
+
+	// compare lookups at random locations (slightly beyond the layers)
+	const GLint sampleCnt = 1 << 20;
+	GLfloat maxError = 0.0f;
+	GLuint seed = 1u;
+	for(GLint i=0; i<sampleCnt; ++i) {
+		GLfloat r[4];
+		for(GLint j=0; j<4; ++j) {
+			seed = seed*1664525u+1013904223u;
+			r[j] = (seed >> 8) / GLfloat(1 << 24);
+		}
+		GLint layer = std::min(GLint(r[0]*sparse.layerCnt),
+		                       sparse.layerCnt-1);
+		GLfloat u = r[1]*1.1f-0.05f, v = r[2]*1.1f-0.05f;
+		GLfloat lod = r[3]*(sparse.levelCnt-1);
+		GLfloat dense[4], sparseTexel[4];
+		sample_atlas(atlas, layer, u, v, lod, dense);
+		sample_sparse_atlas(sparse, layer, u, v, lod, sparseTexel);
+		for(GLint c=0; c<4; ++c)
+			maxError = std::max(maxError,
+			                    GLfloat(fabs(dense[c]-sparseTexel[c])));
+	}
+
+	outputStream << "tile size:        " << tileSize << '\n'
+	             << "coverage:         "
+	             << 100.0 * covered / (atlas.levels[0].size()/4) << "%\n"
+	             << "tiles kept:       " << sparse.tileCnt << " / "
+	             << sparse.indirection.size() << '\n'
+	             << "dense (MB):       " << denseBytes / 1e6 << '\n'
+	             << "sparse (MB):      " << sparseBytes / 1e6 << " ("
+	             << 100.0 * sparseBytes / denseBytes << "%)\n"
+	             << "max lookup error: " << maxError*255.0f << "/255"
+	             << std::endl;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Tile deduplication benchmark
+void benchmark_tile_dedup(const Atlas& atlas,
+                          GLint tileSize,
+                          std::ostream& outputStream)
+                          throw(fw::FWException) {
+	SparseAtlas sparse;
+	build_sparse_atlas(atlas, tileSize, sparse);
+	GLdouble denseBytes = 0.0;
+	for(size_t i=0; i<atlas.levels.size(); ++i)
+		denseBytes+= atlas.levels[i].size();
+
+	const GLint maxErrors[] = {0, 1, 2, 4, 8, 16};
+	outputStream << "max error  tiles  dedup ratio  size (MB)"
+	             << "  vs dense  PSNR level 0 (dB)\n";
+	for(size_t i=0; i<sizeof(maxErrors)/sizeof(maxErrors[0]); ++i) {
+		SparseAtlas dedup = sparse;
+		dedup_sparse_atlas(dedup, maxErrors[i]);
+
+		// compare the base level texels, looked up through the tiles
+		const GLint size = atlas.resolution;
+		std::vector<GLubyte> texels(atlas.levels[0].size());
+		for(GLint layer=0; layer<dedup.layerCnt; ++layer)
+			for(GLint y=0; y<size; ++y)
+				for(GLint x=0; x<size; ++x) {
+					GLfloat texel[4];
+					_sample_level(dedup, layer, 0,
+					              (x+0.5f)/size, (y+0.5f)/size,
+					              texel);
+					for(GLint c=0; c<4; ++c)
+						texels[4*((layer*size+y)*size+x)+c]
+							= GLubyte(texel[c]*255.0f+0.5f);
+				}
+
+		GLdouble bytes = dedup.tiles.size()
+		               + sizeof(GLuint)*dedup.indirection.size();
+		outputStream << maxErrors[i] << '\t'
+		             << dedup.tileCnt << '\t'
+		             << GLdouble(sparse.tileCnt) / dedup.tileCnt << '\t'
+		             << bytes / 1e6 << '\t'
+		             << 100.0 * bytes / denseBytes << "%\t"
+		             << psnr(atlas.levels[0], texels)
+		             << std::endl;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Eigen-basis approximation
+// The data matrix X has one column per view and one row per texel channel,
+// centered on the mean layer. Dense matrices are row major.
+struct _EigenTask {
+	const GLubyte *texels; // viewCnt layers of rowCnt bytes
+	const GLfloat *mean;   // rowCnt
+	GLint rowCnt, viewCnt, rank;
+	const GLfloat *src;
+	GLfloat *dst;
+};
+
+static const GLint _EIGEN_ROW_BLOCK = 4096;
+
+// dst (rowCnt x rank) = X * src (viewCnt x rank), for one block of rows
+static GLvoid _eigen_product(GLint block, GLvoid *data) {
+	const _EigenTask& task = *reinterpret_cast<_EigenTask*>(data);
+	const GLint first = block*_EIGEN_ROW_BLOCK;
+	const GLint last  = std::min(first+_EIGEN_ROW_BLOCK, task.rowCnt);
+	std::fill(task.dst+first*task.rank, task.dst+last*task.rank, 0.0f);
+	for(GLint n=0; n<task.viewCnt; ++n) {
+		const GLubyte *column = task.texels + size_t(n)*task.rowCnt;
+		const GLfloat *weights = task.src + n*task.rank;
+		for(GLint d=first; d<last; ++d) {
+			GLfloat x = column[d]/255.0f - task.mean[d];
+			GLfloat *row = task.dst + d*task.rank;
+			for(GLint l=0; l<task.rank; ++l)
+				row[l]+= x*weights[l];
+		}
+	}
+}
+
+// dst (viewCnt x rank) = X^T * src (rowCnt x rank), for one view
+static GLvoid _eigen_transpose_product(GLint n, GLvoid *data) {
+	const _EigenTask& task = *reinterpret_cast<_EigenTask*>(data);
+	const GLubyte *column = task.texels + size_t(n)*task.rowCnt;
+	std::vector<GLdouble> sums(task.rank, 0.0);
+	for(GLint d=0; d<task.rowCnt; ++d) {
+		GLfloat x = column[d]/255.0f - task.mean[d];
+		const GLfloat *row = task.src + d*task.rank;
+		for(GLint l=0; l<task.rank; ++l)
+			sums[l]+= x*row[l];
+	}
+	for(GLint l=0; l<task.rank; ++l)
+		task.dst[n*task.rank+l] = GLfloat(sums[l]);
+}
+
+// orthonormalize the columns of m (rowCnt x rank), twice for stability
+static void _orthonormalize(std::vector<GLfloat>& m, GLint rowCnt, GLint rank) {
+	for(GLint pass=0; pass<2; ++pass)
+		for(GLint l=0; l<rank; ++l) {
+			for(GLint j=0; j<l; ++j) {
+				GLdouble dot = 0.0;
+				for(GLint d=0; d<rowCnt; ++d)
+					dot+= m[d*rank+l]*m[d*rank+j];
+				for(GLint d=0; d<rowCnt; ++d)
+					m[d*rank+l]-= GLfloat(dot)*m[d*rank+j];
+			}
+			GLdouble norm = 0.0;
+			for(GLint d=0; d<rowCnt; ++d)
+				norm+= m[d*rank+l]*m[d*rank+l];
+			GLfloat scale = norm > 1e-20 ? GLfloat(1.0/sqrt(norm)) : 0.0f;
+			for(GLint d=0; d<rowCnt; ++d)
+				m[d*rank+l]*= scale;
+		}
+}
+
+// eigen vectors (columns of v) of the symmetric n x n matrix a, by
+// decreasing eigen value (cyclic Jacobi)
+static void _symmetric_eigen(std::vector<GLdouble> a,
+                             GLint n,
+                             std::vector<GLdouble>& v) {
+	v.assign(n*n, 0.0);
+	for(GLint i=0; i<n; ++i)
+		v[i*n+i] = 1.0;
+	for(GLint sweep=0; sweep<64; ++sweep) {
+		GLdouble off = 0.0;
+		for(GLint p=0; p<n; ++p)
+			for(GLint q=p+1; q<n; ++q)
+				off+= a[p*n+q]*a[p*n+q];
+		if(off < 1e-24)
+			break;
+		for(GLint p=0; p<n; ++p)
+			for(GLint q=p+1; q<n; ++q) {
+				if(fabs(a[p*n+q]) < 1e-300)
+					continue;
+				GLdouble theta = (a[q*n+q]-a[p*n+p]) / (2.0*a[p*n+q]);
+				GLdouble t = (theta >= 0.0 ? 1.0 : -1.0)
+				           / (fabs(theta)+sqrt(theta*theta+1.0));
+				GLdouble c = 1.0/sqrt(t*t+1.0), s = t*c;
+				for(GLint k=0; k<n; ++k) { // columns p and q
+					GLdouble akp = a[k*n+p], akq = a[k*n+q];
+					a[k*n+p] = c*akp - s*akq;
+					a[k*n+q] = s*akp + c*akq;
+				}
+				for(GLint k=0; k<n; ++k) { // rows p and q
+					GLdouble apk = a[p*n+k], aqk = a[q*n+k];
+					a[p*n+k] = c*apk - s*aqk;
+					a[q*n+k] = s*apk + c*aqk;
+				}
+				for(GLint k=0; k<n; ++k) {
+					GLdouble vkp = v[k*n+p], vkq = v[k*n+q];
+					v[k*n+p] = c*vkp - s*vkq;
+					v[k*n+q] = s*vkp + c*vkq;
+				}
+			}
+	}
+	// sort by decreasing eigen value (selection sort, n is small)
+	for(GLint i=0; i<n; ++i) {
+		GLint best = i;
+		for(GLint j=i+1; j<n; ++j)
+			if(a[j*n+j] > a[best*n+best])
+				best = j;
+		if(best == i)
+			continue;
+		std::swap(a[i*n+i], a[best*n+best]);
+		for(GLint k=0; k<n; ++k)
+			std::swap(v[k*n+i], v[k*n+best]);
+	}
+}
+
+
+void build_eigen_atlas(const Atlas& atlas,
+                       GLint basisCnt,
+                       EigenAtlas& eigen) throw(fw::FWException) {
+	if(atlas.format != FORMAT_RGBA8 || basisCnt < 1)
+		throw _InvalidAtlasFormatException();
+	const GLint viewCnt = layer_count(atlas);
+	const GLint rowCnt  = 4*atlas.resolution*atlas.resolution;
+	const GLint rank    = std::min(basisCnt+8, viewCnt); // oversampled
+	const GLint blockCnt = (rowCnt+_EIGEN_ROW_BLOCK-1)/_EIGEN_ROW_BLOCK;
+	basisCnt = std::min(basisCnt, viewCnt);
+
+	// mean layer
+	std::vector<GLfloat> mean(rowCnt, 0.0f);
+	for(GLint n=0; n<viewCnt; ++n)
+		for(GLint d=0; d<rowCnt; ++d)
+			mean[d]+= atlas.levels[0][size_t(n)*rowCnt+d];
+	for(GLint d=0; d<rowCnt; ++d)
+		mean[d] = floor(mean[d]/viewCnt+0.5f)/255.0f; // as stored
+
+	// range of X: Q = orth(X X^T X omega), omega gaussian
+	std::vector<GLfloat> omega(viewCnt*rank), q(size_t(rowCnt)*rank);
+	std::vector<GLfloat> z(viewCnt*rank);
+	GLuint seed = 1u;
+	for(size_t i=0; i<omega.size(); ++i) { // Box-Muller
+		GLfloat u[2];
+		for(GLint j=0; j<2; ++j) {
+			seed = seed*1664525u+1013904223u;
+			u[j] = ((seed >> 8)+1.0f) / GLfloat(1 << 24);
+		}
+		omega[i] = sqrt(-2.0f*log(u[0]))*cos(2.0f*_PI*u[1]);
+	}
+	_EigenTask task = {&atlas.levels[0][0], &mean[0],
+	                   rowCnt, viewCnt, rank, &omega[0], &q[0]};
+	fw::parallel_for(blockCnt, &_eigen_product, &task);
+	_orthonormalize(q, rowCnt, rank);
+	task.src = &q[0];                   // power iteration
+	task.dst = &z[0];
+	fw::parallel_for(viewCnt, &_eigen_transpose_product, &task);
+	task.src = &z[0];
+	task.dst = &q[0];
+	fw::parallel_for(blockCnt, &_eigen_product, &task);
+	_orthonormalize(q, rowCnt, rank);
+
+	// B = Q^T X (stored transposed in z), SVD of B through B B^T
+	task.src = &q[0];
+	task.dst = &z[0];
+	fw::parallel_for(viewCnt, &_eigen_transpose_product, &task);
+	std::vector<GLdouble> bbt(rank*rank, 0.0), w;
+	for(GLint i=0; i<rank; ++i)
+		for(GLint j=0; j<rank; ++j)
+			for(GLint n=0; n<viewCnt; ++n)
+				bbt[i*rank+j]+= GLdouble(z[n*rank+i])*z[n*rank+j];
+	_symmetric_eigen(bbt, rank, w);
+
+	// basis U = Q W and coefficients U^T X = W^T B
+	eigen.resolution = atlas.resolution;
+	eigen.viewCnt    = viewCnt;
+	eigen.basisCnt   = basisCnt;
+	eigen.mean.resize(rowCnt);
+	for(GLint d=0; d<rowCnt; ++d)
+		eigen.mean[d] = GLubyte(mean[d]*255.0f+0.5f);
+	eigen.coefficients.assign(viewCnt*basisCnt, 0.0f);
+	for(GLint n=0; n<viewCnt; ++n)
+		for(GLint k=0; k<basisCnt; ++k)
+			for(GLint l=0; l<rank; ++l)
+				eigen.coefficients[n*basisCnt+k]+= GLfloat(w[l*rank+k])
+				                                 * z[n*rank+l];
+	eigen.basis.resize(size_t(basisCnt)*rowCnt);
+	eigen.offsets.resize(basisCnt);
+	eigen.scales.resize(basisCnt);
+	std::vector<GLfloat> layer(rowCnt);
+	for(GLint k=0; k<basisCnt; ++k) {
+		GLfloat lo = 0.0f, hi = 0.0f;
+		for(GLint d=0; d<rowCnt; ++d) {
+			GLfloat u = 0.0f;
+			for(GLint l=0; l<rank; ++l)
+				u+= q[d*rank+l]*GLfloat(w[l*rank+k]);
+			layer[d] = u;
+			lo = d ? std::min(lo, u) : u;
+			hi = d ? std::max(hi, u) : u;
+		}
+		eigen.offsets[k] = lo;
+		eigen.scales[k]  = std::max(hi-lo, 1e-20f);
+		for(GLint d=0; d<rowCnt; ++d)
+			eigen.basis[size_t(k)*rowCnt+d]
+				= GLubyte((layer[d]-lo)/eigen.scales[k]*255.0f+0.5f);
+	}
+}
+
+
+void decode_eigen_view(const EigenAtlas& eigen,
+                       GLint view,
+                       std::vector<GLubyte>& texels) {
+	const GLint rowCnt = 4*eigen.resolution*eigen.resolution;
+	std::vector<GLfloat> layer(rowCnt);
+	for(GLint d=0; d<rowCnt; ++d)
+		layer[d] = eigen.mean[d]/255.0f;
+	for(GLint k=0; k<eigen.basisCnt; ++k) {
+		const GLfloat c = eigen.coefficients[view*eigen.basisCnt+k];
+		const GLfloat scale = c*eigen.scales[k]/255.0f;
+		const GLfloat offset = c*eigen.offsets[k];
+		const GLubyte *basis = &eigen.basis[size_t(k)*rowCnt];
+		for(GLint d=0; d<rowCnt; ++d)
+			layer[d]+= offset + scale*basis[d];
+	}
+	texels.resize(rowCnt);
+	for(GLint d=0; d<rowCnt; ++d)
+		texels[d] = GLubyte(std::min(std::max(layer[d], 0.0f), 1.0f)
+		                    *255.0f+0.5f);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Eigen-basis benchmark
+void benchmark_eigen_atlas(const Atlas& atlas,
+                           std::ostream& outputStream)
+                           throw(fw::FWException) {
+	if(atlas.format != FORMAT_RGBA8)
+		throw _InvalidAtlasFormatException();
+	const GLint viewCnt = layer_count(atlas);
+	const GLint basisCnts[] = {1, 2, 4, 8, 16, 32, 64};
+	const GLdouble rawBytes = atlas.levels[0].size();
+
+	outputStream << "basis  build (s)  size (MB)  ratio  PSNR level 0 (dB)\n";
+	for(size_t i=0; i<sizeof(basisCnts)/sizeof(basisCnts[0]); ++i) {
+		if(basisCnts[i] > viewCnt)
+			break;
+		EigenAtlas eigen;
+		fw::Timer timer;
+		timer.Start();
+		build_eigen_atlas(atlas, basisCnts[i], eigen);
+		timer.Stop();
+
+		std::vector<GLubyte> texels, layer;
+		texels.reserve(atlas.levels[0].size());
+		for(GLint n=0; n<viewCnt; ++n) {
+			decode_eigen_view(eigen, n, layer);
+			texels.insert(texels.end(), layer.begin(), layer.end());
+		}
+		GLdouble bytes = eigen.mean.size() + eigen.basis.size()
+		               + sizeof(GLfloat)*(eigen.offsets.size()
+		                                  + eigen.scales.size()
+		                                  + eigen.coefficients.size());
+		outputStream << basisCnts[i] << '\t'
+		             << timer.Ticks() << '\t'
+		             << bytes / 1e6 << '\t'
+		             << rawBytes / bytes << '\t'
+		             << psnr(atlas.levels[0], texels)
+		             << std::endl;
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Compression benchmark
+void benchmark_compression(const Atlas& atlas,
+                           std::ostream& outputStream)
+                           throw(fw::FWException) {
+	if(atlas.format != FORMAT_RGBA8)
+		throw _InvalidAtlasFormatException();
+	const char* formatNames[]  = {"RGBA8", "BC5", "BC7"};
+	const char* qualityNames[] = {"fast", "normal", "high"};
+	GLdouble rawBytes = 0.0;
+	for(size_t i=0; i<atlas.levels.size(); ++i)
+		rawBytes+= atlas.levels[i].size();
+
+	outputStream << "format  quality  encode (MB/s)  size (MB)  ratio"
+	             << "  PSNR level 0 (dB)\n";
+	for(GLint format=FORMAT_BC5; format<FORMAT_COUNT; ++format)
+		for(GLint quality=fw::BC_QUALITY_FAST;
+		    quality<=fw::BC_QUALITY_HIGH; ++quality) {
+			Atlas compressed = atlas;
+			fw::Timer timer;
+			timer.Start();
+			compress_atlas(compressed, format, quality);
+			timer.Stop();
+
+			GLdouble bytes = 0.0;
+			for(size_t i=0; i<compressed.levels.size(); ++i)
+				bytes+= compressed.levels[i].size();
+			decompress_atlas(compressed);
+
+			outputStream << formatNames[format] << '\t'
+			             << qualityNames[quality] << '\t'
+			             << rawBytes / (timer.Ticks()*1e6) << '\t'
+			             << bytes / 1e6 << '\t'
+			             << rawBytes / bytes << '\t'
+			             << psnr(atlas.levels[0], compressed.levels[0])
+			             << std::endl;
+		}
+}
+
+} // namespace lf
+
@@ -0,0 +1,322 @@
+////////////////////////////////////////////////////////////////////////////////
+// \author J Dupuy
+// \brief Lightfield atlases: the baked views of an object, their storage
+// formats and their cache files.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef LIGHTFIELD_HPP
+#define LIGHTFIELD_HPP
+
+#include <string>
+#include <vector>
+#include "Algebra.hpp"
+#include "Framework.hpp"
+
+namespace lf {
+	// Atlas storage formats
+	enum {
+		FORMAT_RGBA8 = 0, // (depth, normal.x, normal.y, alpha)
+		FORMAT_BC5,       // two BC5 layers per view: (depth, alpha), normal
+		FORMAT_BC7,       // one BC7 layer per view: (depth, normal, alpha)
+		FORMAT_COUNT
+	};
+
+
+	// Limits of an atlas: views of the ViewAxis block (VIEWCNT of
+	// lightfield.glsl, less if GL_MAX_UNIFORM_BLOCK_SIZE is too small) and
+	// texels along each side of a layer
+	enum {
+		MAX_VIEW_COUNT = 512,
+		MAX_RESOLUTION = 16384
+	};
+
+
+	// Normal encodings of the (theta, phi) channels
+	enum {
+		NORMAL_SPHERICAL = 0, // (acos(n.y)/pi, atan(n.x,-n.z)/2pi+0.5)
+		NORMAL_OCTAHEDRAL,    // octahedral map of n, in [0,1]^2
+		NORMAL_COUNT
+	};
+
+
+	// Per view data, laid out for the std140 ViewAxis block
+	struct View {
+		Vector4 axis[3]; // local frame (columns of the view rotation)
+		Vector4 depth;   // (near, far, 0, 0) view space depth range
+		Vector4 bounds;  // (left, right, bottom, top) view space extent
+	};
+
+
+	// Baked views of an object
+	struct Atlas {
+		GLint   viewN;        // views along each half axis of the octahedron
+		GLsizei resolution;   // texels along each side of a layer
+		GLint   format;       // FORMAT_*
+		GLint   normals;      // NORMAL_*
+		GLenum  mipmapFilter; // fw::MIPMAP_FILTER_* of the mip levels
+		GLint   quality;      // fw::BC_QUALITY_* given to compress_atlas
+		GLuint  meshHash;     // of the baked mesh (mesh_hash in Bake.hpp)
+		std::vector<View> views;
+		// level i holds all the layers of mip i, in GL_TEXTURE_2D_ARRAY
+		// order (blocks in row major order for compressed formats)
+		std::vector< std::vector<GLubyte> > levels;
+	};
+
+
+	// Asset of a multi-asset atlas, laid out for the std140 Assets block
+	struct AssetRecord {
+		GLint   page;        // texture array holding the layers of the asset
+		GLint   layerOffset; // first layer of the asset in its page
+		GLint   viewN;
+		GLint   viewOffset;  // first view of the asset in the view table
+		Vector4 bounds;      // (center, radius) object space bounding sphere
+	};
+
+
+	// Atlases of many assets sharing a resolution, a format and a normal
+	// encoding, so that they can be drawn with a single program. The layers
+	// of an asset are contiguous in one page (a texture array of at most
+	// maxLayers layers) and its views are contiguous in the view table.
+	struct MultiAtlas {
+		GLsizei resolution;
+		GLint   format;
+		GLint   normals;
+		GLint   maxLayers;
+		std::vector<AssetRecord> assets;
+		std::vector<View> views;
+		// layer count and mip levels (as in Atlas) of each page
+		std::vector<GLint> pageLayers;
+		std::vector< std::vector< std::vector<GLubyte> > > pages;
+	};
+
+
+	// Sparse storage of an RGBA8 atlas: layers are split in tiles of
+	// tileSize^2 texels, empty tiles are dropped and the others are packed
+	// with a one texel border in a 2D texture, so that bilinear lookups
+	// match the dense atlas.
+	struct SparseAtlas {
+		enum {EMPTY_TILE = 0xFFFFFFFFu};
+		GLsizei resolution;  // of the dense atlas
+		GLint   layerCnt;
+		GLint   levelCnt;
+		GLint   tileSize;    // texels along each side of a tile (no border)
+		GLint   tilesPerRow; // tiles along each row of the tile texture
+		GLint   tileCnt;
+		// first entry of each mip level in indirection
+		std::vector<GLint>  levelOffsets;
+		// tile index of each (level, layer, tile row, tile column)
+		std::vector<GLuint> indirection;
+		// RGBA8 tile texture, tilesPerRow*(tileSize+2) texels wide
+		std::vector<GLubyte> tiles;
+	};
+
+
+	// Eigen-basis approximation of the base level of an RGBA8 atlas: each
+	// layer is the mean layer plus a weighted sum of basisCnt basis layers.
+	// Layers are RGBA8, basis layer k is quantized as
+	// offset[k] + scale[k]*texel/255.
+	struct EigenAtlas {
+		GLsizei resolution;
+		GLint   viewCnt;
+		GLint   basisCnt;
+		std::vector<GLubyte> mean;         // one layer
+		std::vector<GLubyte> basis;        // basisCnt layers
+		std::vector<GLfloat> offsets;      // basisCnt
+		std::vector<GLfloat> scales;       // basisCnt
+		std::vector<GLfloat> coefficients; // viewCnt x basisCnt
+	};
+
+
+	// Get the PSNR (in dB, 99 if equal) of two byte arrays of the same size
+	GLdouble psnr(const std::vector<GLubyte>& a, const std::vector<GLubyte>& b);
+
+
+	// Get the number of views baked for viewN (2n(n+1)+1)
+	GLint view_count(GLint viewN);
+	// Get the number of texture layers of an atlas
+	GLint layer_count(const Atlas& atlas);
+	// Get the GL internal format of an atlas format
+	GLenum internal_format(GLint format);
+
+
+	// Encode / decode a unit normal with the given NORMAL_* encoding.
+	// Matches mesh.glsl and lightfield.glsl.
+	void encode_normal(const Vector3& normal,
+	                   GLint encoding,
+	                   GLubyte encoded[2]);
+	Vector3 decode_normal(const GLubyte encoded[2], GLint encoding);
+	Vector3 decode_normal(GLfloat u, GLfloat v, GLint encoding); // in [0,1]
+
+	// Report the angular error of each normal encoding after 8-bit
+	// quantization, over all normals and near the poles. Does not use OpenGL.
+	void benchmark_normal_encodings(const std::vector<Vector3>& normals,
+	                                std::ostream& outputStream);
+
+
+	// Build the views of the octahedron for viewN, fitted to positions
+	void build_views(GLint viewN,
+	                 const std::vector<Vector3>& positions,
+	                 std::vector<View>& views);
+	// Set the depth range and the projection bounds of a view to the
+	// extent of positions, so that the texels and the 8-bit depth channel
+	// cover the object only
+	void fit_view_bounds(View& view, const std::vector<Vector3>& positions);
+	// Get the modelview / modelview projection matrix of a view
+	Matrix4x4 view_matrix(const View& view);
+	Matrix4x4 view_projection(const View& view);
+	// Get the smallest layer resolution (a multiple of 4) giving at least
+	// texelDensity texels per unit of length in every view
+	GLsizei fit_resolution(const std::vector<View>& views,
+	                       GLfloat texelDensity);
+
+
+	// Convert an RGBA8 atlas to format. quality is one of fw::BC_QUALITY_*
+	// (and is recorded in the atlas).
+	// Layers are encoded in parallel.
+	void compress_atlas(Atlas& atlas,
+	                    GLint format,
+	                    GLint quality) throw(fw::FWException);
+	// Convert an atlas back to RGBA8
+	void decompress_atlas(Atlas& atlas) throw(fw::FWException);
+
+
+	// Write / read an atlas cache file (native byte order). The header
+	// holds the parameters of the atlas, including its mip filter, its
+	// compression quality and the hash of its mesh, so that a stale cache
+	// can be detected. The file is written next to filename and renamed
+	// once complete.
+	void save_atlas(const Atlas& atlas,
+	                const std::string& filename) throw(fw::FWException);
+	void load_atlas(Atlas& atlas,
+	                const std::string& filename) throw(fw::FWException);
+
+
+	// Checkpoint of an RGBA8 atlas being baked: a file (native byte order)
+	// holding the views, a completion flag per layer and the base level
+	// layers written so far, so that an interrupted bake can resume
+	struct AtlasCheckpoint {
+		std::string filename;
+		std::vector<GLubyte> completed; // 1 per layer in the file
+	};
+
+	// Rasterizers of the layers of a checkpoint, which do not produce the
+	// same texels: a checkpoint of one is not resumed by the other
+	enum {
+		BAKER_CPU = 0, // bake_view (Bake.hpp)
+		BAKER_GPU      // mesh.glsl
+	};
+
+	// Get the cache file of an OBJ file (next to it) / the checkpoint file
+	// of a cache file
+	std::string cache_file(const std::string& meshFile);
+	std::string checkpoint_file(const std::string& cacheFile);
+	// Open the checkpoint of an atlas whose parameters and views are set,
+	// allocating its base level and reading the completed layers in it.
+	// The file is (re)created if missing or written for other parameters,
+	// views, mesh or baker (BAKER_*). Returns the number of completed
+	// layers.
+	GLint open_checkpoint(const std::string& filename,
+	                      GLint baker,
+	                      Atlas& atlas,
+	                      AtlasCheckpoint& checkpoint)
+	                      throw(fw::FWException);
+	// Write base level layers of an atlas and flush them to disk before
+	// flagging them completed, so that a crash loses unflagged layers only
+	void write_checkpoint(AtlasCheckpoint& checkpoint,
+	                      const Atlas& atlas,
+	                      const std::vector<GLint>& layers)
+	                      throw(fw::FWException);
+	// Delete the checkpoint file (once the atlas is saved)
+	void remove_checkpoint(const AtlasCheckpoint& checkpoint);
+
+
+	// Upload the layers of an atlas to the texture bound as
+	// GL_TEXTURE_2D_ARRAY. Storage is allocated with glTexStorage3D.
+	void tex_atlas(const Atlas& atlas);
+
+
+	// Get the bounding sphere (center, radius) of the object of an atlas:
+	// the smallest sphere circumscribing the projection box of a view
+	Vector4 atlas_bounds(const Atlas& atlas);
+	// Append an atlas to a multi-asset atlas (whose maxLayers must be set)
+	// and return its asset index. The first atlas sets the resolution, the
+	// format and the normal encoding; a page is opened when the asset does
+	// not fit the last one.
+	GLint add_atlas(MultiAtlas& multi,
+	                const Atlas& atlas) throw(fw::FWException);
+	// Upload the layers of a page to the texture bound as
+	// GL_TEXTURE_2D_ARRAY
+	void tex_multi_atlas(const MultiAtlas& multi, GLint page);
+
+
+	// Build the sparse storage of an RGBA8 atlas
+	void build_sparse_atlas(const Atlas& atlas,
+	                        GLint tileSize,
+	                        SparseAtlas& sparse) throw(fw::FWException);
+	// Merge the tiles of a sparse atlas that differ by at most maxError
+	// (in 1/255 units, per channel) and remap the indirection table. Tiles
+	// are hashed (texels if maxError is 0, coverage otherwise) and only
+	// recent candidates sharing a hash are compared.
+	void dedup_sparse_atlas(SparseAtlas& sparse, GLint maxError);
+	// Upload the tile texture to the texture bound as GL_TEXTURE_2D and
+	// the indirection table to the buffer bound as GL_TEXTURE_BUFFER
+	void tex_sparse_atlas(const SparseAtlas& sparse);
+
+
+	// Reference trilinear lookups of a layer, with a zero border, as done
+	// by lightfield.glsl. Texels are in [0,1].
+	void sample_atlas(const Atlas& atlas,
+	                  GLint layer,
+	                  GLfloat u, GLfloat v, GLfloat lod,
+	                  GLfloat texel[4]);
+	void sample_sparse_atlas(const SparseAtlas& sparse,
+	                         GLint layer,
+	                         GLfloat u, GLfloat v, GLfloat lod,
+	                         GLfloat texel[4]);
+
+	// Report the memory of the dense and sparse storages of an RGBA8 atlas,
+	// its coverage and the largest difference between their lookups.
+	// Does not use OpenGL.
+	void benchmark_sparse_atlas(const Atlas& atlas,
+	                            GLint tileSize,
+	                            std::ostream& outputStream)
+	                            throw(fw::FWException);
+
+
+	// Report the tile count, dedup ratio, memory and PSNR of the sparse
+	// storage of an RGBA8 atlas after dedup_sparse_atlas, for increasing
+	// error thresholds. Does not use OpenGL.
+	void benchmark_tile_dedup(const Atlas& atlas,
+	                          GLint tileSize,
+	                          std::ostream& outputStream)
+	                          throw(fw::FWException);
+
+
+	// Compute the eigen-basis approximation of the base level of an RGBA8
+	// atlas with a randomized SVD (products are multithreaded)
+	void build_eigen_atlas(const Atlas& atlas,
+	                       GLint basisCnt,
+	                       EigenAtlas& eigen) throw(fw::FWException);
+	// Reconstruct the RGBA8 layer of a view
+	void decode_eigen_view(const EigenAtlas& eigen,
+	                       GLint view,
+	                       std::vector<GLubyte>& texels);
+	// Report the build time, compression ratio and PSNR of the eigen-basis
+	// approximation of an RGBA8 atlas for increasing basis counts. Does not
+	// use OpenGL.
+	void benchmark_eigen_atlas(const Atlas& atlas,
+	                           std::ostream& outputStream)
+	                           throw(fw::FWException);
+
+
+	// Report the encoding throughput and PSNR of each format and quality
+	// for an RGBA8 atlas. Does not use OpenGL.
+	void benchmark_compression(const Atlas& atlas,
+	                           std::ostream& outputStream)
+	                           throw(fw::FWException);
+
+} // namespace lf
+
+#endif
+
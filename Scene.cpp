@@ -0,0 +1,1173 @@
+////////////////////////////////////////////////////////////////////////////////
+// \author   Jonathan Dupuy
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Scene.hpp"
+
+#include <cmath>     // sqrt tan cos sin
+#include <cfloat>    // FLT_MAX
+#include <algorithm> // std::min std::max std::lower_bound
+#include <fstream>   // std::ifstream
+#include <sstream>   // std::stringstream
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define _LF_SSE2
+#	include <emmintrin.h>
+#endif
+
+namespace lf {
+////////////////////////////////////////////////////////////////////////////////
+// Exceptions
+//
+////////////////////////////////////////////////////////////////////////////////
+class _CameraPathException : public fw::FWException {
+public:
+	_CameraPathException(const std::string& file, const std::string& reason) {
+		mMessage = "Camera path " + file + ": " + reason;
+	}
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Local functions
+//
+////////////////////////////////////////////////////////////////////////////////
+
+static const GLfloat _PI = 3.14159265358979323846f;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Uniform random number in [0,1)
+static GLfloat _random(GLuint& seed) {
+	seed = seed*1664525u+1013904223u;
+	return (seed >> 8) / GLfloat(1 << 24);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Culling internals
+// Instances are classified in blocks of _CULL_BLOCK instances: a first pass
+// sets their LOD flags and counts the visible ones per (LOD, asset) and
+// block, a second one copies them to their slot of the sorted output.
+static const GLint _CULL_BLOCK = 16384; // a multiple of four
+
+struct _CullTask {
+	const Instance *instances;
+	GLint instanceCnt;
+	const GLfloat *assetRadius; // |center|+radius of the asset spheres
+	GLint assetCnt;
+	const CullParameters *parameters;
+	GLubyte *lods;
+	GLuint *counts; // 2*assetCnt per block, then first output slots
+	Instance *impostors;
+	Instance *meshes;
+};
+
+// Set the LOD flags of an instance (the scalar path, and the reference)
+static GLubyte _classify(const Instance& instance,
+                         GLfloat assetRadius,
+                         const CullParameters& p,
+                         GLubyte lod) {
+	const Vector3& c = instance.position;
+	const GLfloat radius = instance.scale*assetRadius;
+	bool visible = true;
+	for(GLint k=0; k<6; ++k) {
+		GLfloat d = p.planes[k][0]*c[0] + p.planes[k][1]*c[1]
+		          + p.planes[k][2]*c[2] + p.planes[k][3];
+		visible = visible && d >= -radius;
+	}
+	GLfloat dx = c[0]-p.eye[0], dy = c[1]-p.eye[1], dz = c[2]-p.eye[2];
+	GLfloat distance = sqrt(dx*dx + dy*dy + dz*dz);
+	visible = visible && distance-radius <= p.maxDistance;
+	GLfloat size = radius*p.projectionScale / std::max(distance, 1e-6f);
+	GLfloat threshold = p.lodSize * (lod & LOD_MESH ? 1.0f-p.hysteresis
+	                                                : 1.0f+p.hysteresis);
+	return (visible ? LOD_VISIBLE : 0) | (size > threshold ? LOD_MESH : 0);
+}
+
+// Classify the instances [first, last) and add the visible ones to counts
+static void _cull_range(const _CullTask& task,
+                        GLint first,
+                        GLint last,
+                        GLuint *counts) {
+	const CullParameters& p = *task.parameters;
+	GLint i = first;
+#ifdef _LF_SSE2
+	__m128 planes[6][4];
+	for(GLint k=0; k<6; ++k)
+		for(GLint j=0; j<4; ++j)
+			planes[k][j] = _mm_set1_ps(p.planes[k][j]);
+	const __m128 eyeX = _mm_set1_ps(p.eye[0]);
+	const __m128 eyeY = _mm_set1_ps(p.eye[1]);
+	const __m128 eyeZ = _mm_set1_ps(p.eye[2]);
+	const __m128 maxDistance = _mm_set1_ps(p.maxDistance);
+	const __m128 projectionScale = _mm_set1_ps(p.projectionScale);
+	const __m128 minDistance = _mm_set1_ps(1e-6f);
+	const GLfloat thresholds[2] = {p.lodSize*(1.0f+p.hysteresis),
+	                               p.lodSize*(1.0f-p.hysteresis)};
+	for(; i+4<=last; i+=4) {
+		const Instance *in = task.instances+i;
+		// (x, y, z, scale) of four instances, transposed
+		__m128 x = _mm_loadu_ps(&in[0].position[0]);
+		__m128 y = _mm_loadu_ps(&in[1].position[0]);
+		__m128 z = _mm_loadu_ps(&in[2].position[0]);
+		__m128 scale = _mm_loadu_ps(&in[3].position[0]);
+		_MM_TRANSPOSE4_PS(x, y, z, scale);
+		__m128 radius = _mm_mul_ps(scale,
+		                           _mm_set_ps(task.assetRadius[in[3].asset],
+		                                      task.assetRadius[in[2].asset],
+		                                      task.assetRadius[in[1].asset],
+		                                      task.assetRadius[in[0].asset]));
+		__m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), radius);
+		__m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for(GLint k=0; k<6; ++k) {
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+			               _mm_mul_ps(planes[k][0], x),
+			               _mm_mul_ps(planes[k][1], y)),
+			               _mm_mul_ps(planes[k][2], z)),
+			               planes[k][3]);
+			visible = _mm_and_ps(visible, _mm_cmpge_ps(d, negRadius));
+		}
+		__m128 dx = _mm_sub_ps(x, eyeX);
+		__m128 dy = _mm_sub_ps(y, eyeY);
+		__m128 dz = _mm_sub_ps(z, eyeZ);
+		__m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(
+		                      _mm_mul_ps(dx, dx),
+		                      _mm_mul_ps(dy, dy)),
+		                      _mm_mul_ps(dz, dz)));
+		visible = _mm_and_ps(visible,
+		                     _mm_cmple_ps(_mm_sub_ps(distance, radius),
+		                                  maxDistance));
+		__m128 size = _mm_div_ps(_mm_mul_ps(radius, projectionScale),
+		                         _mm_max_ps(distance, minDistance));
+		GLubyte *lods = task.lods+i;
+		__m128 threshold = _mm_set_ps(thresholds[(lods[3] & LOD_MESH) >> 1],
+		                              thresholds[(lods[2] & LOD_MESH) >> 1],
+		                              thresholds[(lods[1] & LOD_MESH) >> 1],
+		                              thresholds[(lods[0] & LOD_MESH) >> 1]);
+		GLint visibleMask = _mm_movemask_ps(visible);
+		GLint meshMask = _mm_movemask_ps(_mm_cmpgt_ps(size, threshold));
+		for(GLint j=0; j<4; ++j) {
+			GLint mesh = (meshMask >> j) & 1;
+			lods[j] = ((visibleMask >> j) & 1) | (mesh << 1);
+			if((visibleMask >> j) & 1)
+				++counts[mesh*task.assetCnt + in[j].asset];
+		}
+	}
+#endif
+	for(; i<last; ++i) {
+		const Instance& instance = task.instances[i];
+		GLubyte lod = _classify(instance,
+		                        task.assetRadius[instance.asset],
+		                        p,
+		                        task.lods[i]);
+		task.lods[i] = lod;
+		if(lod & LOD_VISIBLE)
+			++counts[(lod >> 1)*task.assetCnt + instance.asset];
+	}
+}
+
+// Copy the visible instances of [first, last) to their slots
+static void _compact_range(const _CullTask& task,
+                           GLint first,
+                           GLint last,
+                           GLuint *slots) {
+	for(GLint i=first; i<last; ++i) {
+		const GLubyte lod = task.lods[i];
+		if(!(lod & LOD_VISIBLE))
+			continue;
+		const Instance& instance = task.instances[i];
+		if(lod & LOD_MESH)
+			task.meshes[slots[task.assetCnt + instance.asset]++] = instance;
+		else
+			task.impostors[slots[instance.asset]++] = instance;
+	}
+}
+
+static GLvoid _cull_block(GLint block, GLvoid *data) {
+	const _CullTask& task = *reinterpret_cast<_CullTask*>(data);
+	const GLint first = block*_CULL_BLOCK;
+	_cull_range(task,
+	            first,
+	            std::min(first+_CULL_BLOCK, task.instanceCnt),
+	            task.counts + 2*task.assetCnt*block);
+}
+
+static GLvoid _compact_block(GLint block, GLvoid *data) {
+	const _CullTask& task = *reinterpret_cast<_CullTask*>(data);
+	const GLint first = block*_CULL_BLOCK;
+	_compact_range(task,
+	               first,
+	               std::min(first+_CULL_BLOCK, task.instanceCnt),
+	               task.counts + 2*task.assetCnt*block);
+}
+
+// Asset sphere radii, centered on the origin of the assets
+static void _asset_radii(const std::vector<CullAsset>& assets,
+                         std::vector<GLfloat>& radii) {
+	radii.resize(assets.size());
+	for(size_t i=0; i<assets.size(); ++i) {
+		const Vector4& b = assets[i].bounds;
+		radii[i] = sqrt(b[0]*b[0] + b[1]*b[1] + b[2]*b[2]) + b[3];
+	}
+}
+
+// Write the draws of the culled instances from their counts per asset
+static void _cull_draws(const std::vector<CullAsset>& assets,
+                        const GLuint *impostorCounts,
+                        const GLuint *meshCounts,
+                        CullOutput& output) {
+	const GLint assetCnt = GLint(assets.size());
+	output.impostorDraws.resize(assetCnt);
+	output.meshDraws.resize(assetCnt);
+	GLuint impostorCnt = 0, meshCnt = 0;
+	for(GLint a=0; a<assetCnt; ++a) {
+		fw::DrawArraysIndirectCommand& impostor = output.impostorDraws[a];
+		impostor.count        = 4;
+		impostor.primCount    = impostorCounts[a];
+		impostor.first        = 0;
+		impostor.baseInstance = impostorCnt;
+		impostorCnt+= impostorCounts[a];
+
+		fw::DrawElementsIndirectCommand& mesh = output.meshDraws[a];
+		mesh.count        = assets[a].indexCount;
+		mesh.primCount    = meshCounts[a];
+		mesh.firstIndex   = assets[a].firstIndex;
+		mesh.baseVertex   = assets[a].baseVertex;
+		mesh.baseInstance = meshCnt;
+		meshCnt+= meshCounts[a];
+	}
+	output.impostors.resize(impostorCnt);
+	output.meshes.resize(meshCnt);
+}
+
+// Write the draws from the counts per (LOD, asset) of blockCnt blocks of
+// instances, and replace the counts by the first output slot of each block
+// (blocks keep their order)
+static void _cull_slots(const std::vector<CullAsset>& assets,
+                        GLint blockCnt,
+                        GLuint *counts,
+                        CullOutput& output) {
+	const GLint assetCnt = GLint(assets.size());
+	std::vector<GLuint> totals(2*assetCnt, 0);
+	for(GLint b=0; b<blockCnt; ++b)
+		for(GLint j=0; j<2*assetCnt; ++j)
+			totals[j]+= counts[2*assetCnt*b+j];
+	_cull_draws(assets, &totals[0], &totals[assetCnt], output);
+	for(GLint a=0; a<assetCnt; ++a) {
+		GLuint impostorSlot = output.impostorDraws[a].baseInstance;
+		GLuint meshSlot = output.meshDraws[a].baseInstance;
+		for(GLint b=0; b<blockCnt; ++b) {
+			GLuint *blockCounts = counts + 2*assetCnt*b;
+			GLuint impostorCnt = blockCounts[a];
+			GLuint meshCnt = blockCounts[assetCnt+a];
+			blockCounts[a] = impostorSlot;
+			blockCounts[assetCnt+a] = meshSlot;
+			impostorSlot+= impostorCnt;
+			meshSlot+= meshCnt;
+		}
+	}
+}
+
+// Scalar, single threaded version of cull_instances
+static void _cull_reference(const std::vector<Instance>& instances,
+                            const std::vector<CullAsset>& assets,
+                            const CullParameters& parameters,
+                            std::vector<GLubyte>& lods,
+                            CullOutput& output) {
+	const GLint assetCnt = GLint(assets.size());
+	std::vector<GLfloat> radii;
+	_asset_radii(assets, radii);
+	std::vector<GLuint> counts(2*assetCnt, 0);
+	lods.resize(instances.size(), 0);
+	for(size_t i=0; i<instances.size(); ++i) {
+		lods[i] = _classify(instances[i], radii[instances[i].asset],
+		                    parameters, lods[i]);
+		if(lods[i] & LOD_VISIBLE)
+			++counts[(lods[i] >> 1)*assetCnt + instances[i].asset];
+	}
+	_cull_draws(assets, &counts[0], &counts[assetCnt], output);
+	for(GLint a=0; a<assetCnt; ++a) {
+		counts[a] = output.impostorDraws[a].baseInstance;
+		counts[assetCnt+a] = output.meshDraws[a].baseInstance;
+	}
+	for(size_t i=0; i<instances.size(); ++i) {
+		if(!(lods[i] & LOD_VISIBLE))
+			continue;
+		if(lods[i] & LOD_MESH)
+			output.meshes[counts[assetCnt+instances[i].asset]++] = instances[i];
+		else
+			output.impostors[counts[instances[i].asset]++] = instances[i];
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Hierarchy internals
+// Instances get a 30 bit Morton code of their position in the bounds of the
+// scene, and are sorted by code with a parallel radix sort. The top levels
+// are split serially down to ranges of _BVH_SUBTREE instances, which are
+// built in parallel in their own node arrays before being appended to the
+// hierarchy. Nodes are stored after their parent, so that refits walk them
+// backwards. Traversals use a fixed stack: a split either consumes a bit of
+// the codes or halves a range of equal codes, so that the depth is bounded
+// by 62.
+static const GLint _BVH_LEAF    = 8;    // instances per leaf, at most
+static const GLint _BVH_SUBTREE = 4096; // instances per subtree, at most
+static const GLint _BVH_STACK   = 64;
+static const GLint _SORT_BLOCK  = 16384;
+static const GLint _SORT_BITS   = 10;   // bits per radix sort pass
+
+// Tests of a node: bit k for plane k, then the maximum distance
+static const GLint _TEST_DISTANCE = 1 << 6;
+static const GLint _TEST_ALL = (1 << 7) - 1;
+
+struct _BvhTask {
+	const Instance *instances;
+	GLint instanceCnt;
+	GLfloat *blockBounds;  // lo and hi of the positions of each block
+	Vector3 lo, scale;     // quantization of the positions
+	GLuint *codes;
+	GLint *indexes;
+	GLuint *sortedCodes;
+	GLint *sortedIndexes;
+	GLuint *histograms;    // 1 << _SORT_BITS counters per block
+	GLint shift;
+	Instance *sortedInstances;
+	const GLint *ranges;   // instances of each subtree (first, last)
+	std::vector<BvhNode> *subtreeNodes;
+	Bvh *bvh;
+};
+
+// Spread the 10 low bits of v to every third bit
+static GLuint _expand_bits(GLuint v) {
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+static GLvoid _bvh_bounds_block(GLint block, GLvoid *data) {
+	const _BvhTask& task = *reinterpret_cast<_BvhTask*>(data);
+	const GLint first = block*_SORT_BLOCK;
+	const GLint last = std::min(first+_SORT_BLOCK, task.instanceCnt);
+	GLfloat *bounds = task.blockBounds + 6*block;
+	for(GLint j=0; j<3; ++j) {
+		bounds[j]   = task.instances[first].position[j];
+		bounds[3+j] = task.instances[first].position[j];
+	}
+	for(GLint i=first+1; i<last; ++i)
+		for(GLint j=0; j<3; ++j) {
+			bounds[j]   = std::min(bounds[j], task.instances[i].position[j]);
+			bounds[3+j] = std::max(bounds[3+j], task.instances[i].position[j]);
+		}
+}
+
+static GLvoid _bvh_code_block(GLint block, GLvoid *data) {
+	const _BvhTask& task = *reinterpret_cast<_BvhTask*>(data);
+	const GLint first = block*_SORT_BLOCK;
+	const GLint last = std::min(first+_SORT_BLOCK, task.instanceCnt);
+	for(GLint i=first; i<last; ++i) {
+		GLuint code = 0;
+		for(GLint j=0; j<3; ++j) {
+			GLfloat q = (task.instances[i].position[j] - task.lo[j])
+			          * task.scale[j];
+			GLuint v = GLuint(std::min(std::max(q, 0.0f), 1023.0f));
+			code|= _expand_bits(v) << (2-j);
+		}
+		task.codes[i] = code;
+		task.indexes[i] = i;
+	}
+}
+
+static GLvoid _bvh_count_block(GLint block, GLvoid *data) {
+	const _BvhTask& task = *reinterpret_cast<_BvhTask*>(data);
+	const GLint first = block*_SORT_BLOCK;
+	const GLint last = std::min(first+_SORT_BLOCK, task.instanceCnt);
+	const GLuint digit = (1u << _SORT_BITS) - 1u;
+	GLuint *histogram = task.histograms + (block << _SORT_BITS);
+	std::fill(histogram, histogram + (1 << _SORT_BITS), 0u);
+	for(GLint i=first; i<last; ++i)
+		++histogram[(task.codes[i] >> task.shift) & digit];
+}
+
+static GLvoid _bvh_scatter_block(GLint block, GLvoid *data) {
+	const _BvhTask& task = *reinterpret_cast<_BvhTask*>(data);
+	const GLint first = block*_SORT_BLOCK;
+	const GLint last = std::min(first+_SORT_BLOCK, task.instanceCnt);
+	const GLuint digit = (1u << _SORT_BITS) - 1u;
+	GLuint *slots = task.histograms + (block << _SORT_BITS);
+	for(GLint i=first; i<last; ++i) {
+		GLuint slot = slots[(task.codes[i] >> task.shift) & digit]++;
+		task.sortedCodes[slot] = task.codes[i];
+		task.sortedIndexes[slot] = task.indexes[i];
+	}
+}
+
+static GLvoid _bvh_gather_block(GLint block, GLvoid *data) {
+	const _BvhTask& task = *reinterpret_cast<_BvhTask*>(data);
+	const GLint first = block*_SORT_BLOCK;
+	const GLint last = std::min(first+_SORT_BLOCK, task.instanceCnt);
+	for(GLint i=first; i<last; ++i)
+		task.sortedInstances[i] = task.instances[task.indexes[i]];
+}
+
+// Get the split of the sorted codes [first, last): where the highest bit
+// that differs is first set, or the middle if the codes are equal
+static GLint _bvh_split(const GLuint *codes, GLint first, GLint last) {
+	GLuint diff = codes[first] ^ codes[last-1];
+	if(diff == 0)
+		return (first+last)/2;
+	GLint bit = 31;
+	while(!(diff >> bit))
+		--bit;
+	GLuint key = (codes[last-1] >> bit) << bit;
+	return GLint(std::lower_bound(codes+first, codes+last, key) - codes);
+}
+
+// Split the range of node down to leaves, or to subtrees if subtrees is
+// not NULL (nodes are appended to nodes)
+static void _bvh_split_nodes(const GLuint *codes,
+                             GLint node,
+                             std::vector<BvhNode>& nodes,
+                             std::vector<Bvh::Subtree> *subtrees) {
+	const GLint maxCount = subtrees ? _BVH_SUBTREE : _BVH_LEAF;
+	GLint stack[_BVH_STACK];
+	GLint top = 0;
+	stack[0] = node;
+	while(top >= 0) {
+		const GLint n = stack[top--];
+		const GLint first = nodes[n].first;
+		const GLint last = first + nodes[n].count;
+		nodes[n].children = 0;
+		if(last-first <= maxCount) {
+			if(subtrees) {
+				Bvh::Subtree subtree = {n, 0, 0};
+				subtrees->push_back(subtree);
+			}
+			continue;
+		}
+		const GLint split = _bvh_split(codes, first, last);
+		const GLint children = GLint(nodes.size());
+		nodes.resize(children+2);
+		nodes[n].children = children;
+		nodes[children].first = first;
+		nodes[children].count = split-first;
+		nodes[children+1].first = split;
+		nodes[children+1].count = last-split;
+		stack[++top] = children+1;
+		stack[++top] = children;
+	}
+}
+
+// Build the nodes of a subtree (local indices, the root is node 0)
+static GLvoid _bvh_subtree_block(GLint subtree, GLvoid *data) {
+	const _BvhTask& task = *reinterpret_cast<_BvhTask*>(data);
+	std::vector<BvhNode>& nodes = task.subtreeNodes[subtree];
+	nodes.assign(1, task.bvh->nodes[task.bvh->subtrees[subtree].root]);
+	_bvh_split_nodes(task.codes, 0, nodes, NULL);
+}
+
+// Copy the nodes of a subtree to the hierarchy
+static GLvoid _bvh_append_block(GLint subtree, GLvoid *data) {
+	const _BvhTask& task = *reinterpret_cast<_BvhTask*>(data);
+	const std::vector<BvhNode>& local = task.subtreeNodes[subtree];
+	const Bvh::Subtree& s = task.bvh->subtrees[subtree];
+	BvhNode *nodes = &task.bvh->nodes[0];
+	for(size_t i=0; i<local.size(); ++i) {
+		BvhNode& node = nodes[i == 0 ? s.root : s.begin+GLint(i)-1];
+		node = local[i];
+		if(node.children)
+			node.children+= s.begin-1;
+	}
+}
+
+// Set the bounds of a node from its children or its instances
+static void _bvh_refit_node(Bvh& bvh,
+                            const Instance *instances,
+                            GLint n) {
+	BvhNode& node = bvh.nodes[n];
+	if(node.children) {
+		const BvhNode& a = bvh.nodes[node.children];
+		const BvhNode& b = bvh.nodes[node.children+1];
+		for(GLint j=0; j<3; ++j) {
+			node.lo[j] = std::min(a.lo[j], b.lo[j]);
+			node.hi[j] = std::max(a.hi[j], b.hi[j]);
+		}
+		return;
+	}
+	node.lo = Vector3(FLT_MAX, FLT_MAX, FLT_MAX);
+	node.hi = -node.lo;
+	for(GLint i=node.first; i<node.first+node.count; ++i) {
+		const Instance& instance = instances[i];
+		const GLfloat r = instance.scale*bvh.radii[instance.asset];
+		for(GLint j=0; j<3; ++j) {
+			node.lo[j] = std::min(node.lo[j], instance.position[j]-r);
+			node.hi[j] = std::max(node.hi[j], instance.position[j]+r);
+		}
+	}
+}
+
+static GLvoid _bvh_refit_block(GLint subtree, GLvoid *data) {
+	const _BvhTask& task = *reinterpret_cast<_BvhTask*>(data);
+	Bvh& bvh = *task.bvh;
+	const Bvh::Subtree& s = bvh.subtrees[subtree];
+	for(GLint n=s.end-1; n>=s.begin; --n)
+		_bvh_refit_node(bvh, task.instances, n);
+	_bvh_refit_node(bvh, task.instances, s.root);
+}
+
+// Get the tests of mask a node still needs: -1 if the node is outside a
+// plane or too far, without the tests the node passes whole otherwise
+static GLint _bvh_node_tests(const BvhNode& node,
+                             const CullParameters& p,
+                             GLint mask) {
+	for(GLint k=0; k<6; ++k) if(mask & (1 << k)) {
+		const Vector4& plane = p.planes[k];
+		GLfloat dMin = plane[3], dMax = plane[3];
+		for(GLint j=0; j<3; ++j) {
+			dMin+= plane[j] * (plane[j] >= 0.0f ? node.lo[j] : node.hi[j]);
+			dMax+= plane[j] * (plane[j] >= 0.0f ? node.hi[j] : node.lo[j]);
+		}
+		if(dMax < 0.0f)
+			return -1;
+		if(dMin >= 0.0f)
+			mask&= ~(1 << k);
+	}
+	if(mask & _TEST_DISTANCE) {
+		GLfloat dMin = 0.0f, dMax = 0.0f; // squared distances
+		for(GLint j=0; j<3; ++j) {
+			GLfloat lo = node.lo[j]-p.eye[j], hi = node.hi[j]-p.eye[j];
+			GLfloat d = std::max(std::max(lo, -hi), 0.0f);
+			dMin+= d*d;
+			dMax+= std::max(lo*lo, hi*hi);
+		}
+		if(dMin > p.maxDistance*p.maxDistance)
+			return -1;
+		if(dMax <= p.maxDistance*p.maxDistance)
+			mask&= ~_TEST_DISTANCE;
+	}
+	return mask;
+}
+
+// Instances are classified by ranges: the leaves that intersect the
+// frustum, and the nodes inside of it. The ranges of each subtree are
+// kept for the compaction.
+struct _BvhCullTask {
+	const Bvh *bvh;
+	_CullTask cull; // counts has 2*assetCnt entries per subtree
+	std::vector<GLint> *ranges; // first, last of each range, per subtree
+};
+
+static GLvoid _bvh_cull_block(GLint subtree, GLvoid *data) {
+	FW_PROFILE_SCOPE("cull_subtree");
+	const _BvhCullTask& task = *reinterpret_cast<_BvhCullTask*>(data);
+	const Bvh& bvh = *task.bvh;
+	GLuint *counts = task.cull.counts + 2*task.cull.assetCnt*subtree;
+	std::vector<GLint>& ranges = task.ranges[subtree];
+	GLint stack[_BVH_STACK][2];
+	GLint top = 0;
+	ranges.clear();
+	stack[0][0] = bvh.subtrees[subtree].root;
+	stack[0][1] = _TEST_ALL;
+	while(top >= 0) {
+		const BvhNode& node = bvh.nodes[stack[top][0]];
+		const GLint mask = _bvh_node_tests(node,
+		                                   *task.cull.parameters,
+		                                   stack[top][1]);
+		--top;
+		if(mask < 0)
+			continue;
+		if(mask && node.children) {
+			stack[++top][0] = node.children+1;
+			stack[top][1] = mask;
+			stack[++top][0] = node.children;
+			stack[top][1] = mask;
+			continue;
+		}
+		// merge with the previous range if they are contiguous
+		if(!ranges.empty() && ranges.back() == node.first)
+			ranges.back()+= node.count;
+		else {
+			ranges.push_back(node.first);
+			ranges.push_back(node.first+node.count);
+		}
+	}
+	for(size_t i=0; i<ranges.size(); i+=2)
+		_cull_range(task.cull, ranges[i], ranges[i+1], counts);
+}
+
+static GLvoid _bvh_compact_block(GLint subtree, GLvoid *data) {
+	const _BvhCullTask& task = *reinterpret_cast<_BvhCullTask*>(data);
+	const std::vector<GLint>& ranges = task.ranges[subtree];
+	GLuint *slots = task.cull.counts + 2*task.cull.assetCnt*subtree;
+	for(size_t i=0; i<ranges.size(); i+=2)
+		_compact_range(task.cull, ranges[i], ranges[i+1], slots);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions implementation
+//
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Scatter instances
+void scatter_instances(GLint count,
+                       GLint assetCnt,
+                       GLfloat extent,
+                       GLuint seed,
+                       std::vector<Instance>& instances) {
+	instances.resize(count);
+	for(GLint i=0; i<count; ++i) {
+		Instance& instance = instances[i];
+		GLfloat x = (_random(seed)*2.0f-1.0f)*extent;
+		GLfloat z = (_random(seed)*2.0f-1.0f)*extent;
+		instance.position = Vector3(x, 0.0f, z);
+		instance.scale    = 0.75f+0.5f*_random(seed);
+		instance.rotation = 2.0f*_PI*_random(seed);
+		instance.asset    = std::min(GLint(_random(seed)*assetCnt),
+		                             assetCnt-1);
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Billboard draws (counting sort by asset)
+void build_impostor_draws(GLint assetCnt,
+                          std::vector<Instance>& instances,
+                          std::vector<fw::DrawArraysIndirectCommand>&
+                          commands) {
+	commands.resize(assetCnt);
+	for(GLint i=0; i<assetCnt; ++i) {
+		commands[i].count        = 4;
+		commands[i].primCount    = 0;
+		commands[i].first        = 0;
+		commands[i].baseInstance = 0;
+	}
+	for(size_t i=0; i<instances.size(); ++i)
+		++commands[instances[i].asset].primCount;
+	GLuint first = 0;
+	for(GLint i=0; i<assetCnt; ++i) {
+		commands[i].baseInstance = first;
+		first+= commands[i].primCount;
+	}
+
+	std::vector<Instance> sorted(instances.size());
+	std::vector<GLuint> next(assetCnt);
+	for(GLint i=0; i<assetCnt; ++i)
+		next[i] = commands[i].baseInstance;
+	for(size_t i=0; i<instances.size(); ++i)
+		sorted[next[instances[i].asset]++] = instances[i];
+	instances.swap(sorted);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Frustum planes (rows of the matrix are m[0][i], m[1][i], m[2][i], m[3][i])
+void frustum_planes(const Matrix4x4& m, Vector4 planes[6]) {
+	for(GLint i=0; i<3; ++i) {
+		Vector4 row(m[0][i], m[1][i], m[2][i], m[3][i]);
+		Vector4 w(m[0][3], m[1][3], m[2][3], m[3][3]);
+		planes[2*i]   = w + row;
+		planes[2*i+1] = w - row;
+	}
+	for(GLint i=0; i<6; ++i) {
+		Vector4& p = planes[i];
+		p = p / sqrt(p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+	}
+}
+
+
+GLfloat projection_scale(GLfloat fovy, GLsizei height) {
+	return height / (2.0f*tan(0.5f*fovy));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Culling
+void cull_instances(const std::vector<Instance>& instances,
+                    const std::vector<CullAsset>& assets,
+                    const CullParameters& parameters,
+                    std::vector<GLubyte>& lods,
+                    CullOutput& output) {
+	FW_PROFILE_SCOPE("cull_instances");
+	const GLint assetCnt = GLint(assets.size());
+	const GLint instanceCnt = GLint(instances.size());
+	const GLint blockCnt = (instanceCnt+_CULL_BLOCK-1)/_CULL_BLOCK;
+	std::vector<GLfloat> radii;
+	_asset_radii(assets, radii);
+	if(lods.size() != instances.size())
+		lods.assign(instances.size(), 0);
+	if(instanceCnt == 0 || assetCnt == 0) {
+		std::vector<GLuint> zeros(assetCnt+1, 0);
+		_cull_draws(assets, &zeros[0], &zeros[0], output);
+		return;
+	}
+
+	// classify and count
+	std::vector<GLuint> counts(2*assetCnt*blockCnt, 0);
+	_CullTask task = {&instances[0], instanceCnt, &radii[0], assetCnt,
+	                  &parameters, &lods[0], &counts[0], NULL, NULL};
+	fw::parallel_for(blockCnt, &_cull_block, &task);
+
+	// draws and first slot of each block
+	_cull_slots(assets, blockCnt, &counts[0], output);
+
+	// compact
+	task.impostors = output.impostors.empty() ? NULL : &output.impostors[0];
+	task.meshes = output.meshes.empty() ? NULL : &output.meshes[0];
+	fw::parallel_for(blockCnt, &_compact_block, &task);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Benchmark scene: count instances of two assets, seen at 1080p
+static GLfloat _bench_scene(GLint count,
+                            std::vector<Instance>& instances,
+                            std::vector<CullAsset>& assets,
+                            CullParameters& parameters) {
+	const GLfloat extent = 0.5f*sqrt(GLfloat(count));
+	scatter_instances(count, 2, extent, 1u, instances);
+	assets.resize(2);
+	assets[0].bounds = Vector4(0.0f, 0.0f, 0.0f, 0.84f);
+	assets[1].bounds = Vector4(0.01f, -0.01f, 0.0f, 0.6f);
+	for(GLint a=0; a<2; ++a) {
+		assets[a].indexCount = 3000*(a+1);
+		assets[a].firstIndex = 3000*a;
+		assets[a].baseVertex = 0;
+	}
+	parameters.maxDistance     = extent;
+	parameters.projectionScale = projection_scale(0.5f*_PI, 1080);
+	parameters.lodSize         = 64.0f;
+	parameters.hysteresis      = 0.1f;
+	return extent;
+}
+
+// Camera of a frame, circling the benchmark scene
+static void _bench_camera(GLint frame,
+                          GLint frameCnt,
+                          GLfloat extent,
+                          CullParameters& parameters) {
+	const GLfloat angle = 2.0f*_PI*frame/frameCnt;
+	parameters.eye = Vector3(0.5f*extent*cos(angle),
+	                         2.0f,
+	                         0.5f*extent*sin(angle));
+	Matrix4x4 viewProjection = Matrix4x4::Perspective(0.5f*_PI, 16.0f/9.0f,
+	                                                  0.05f, 1000.0f)
+	                         * Matrix4x4::LookAt(parameters.eye,
+	                                             Vector3(0,0,0),
+	                                             Vector3(0,1,0));
+	frustum_planes(viewProjection, parameters.planes);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Culling benchmark
+void benchmark_culling(GLint count, std::ostream& outputStream) {
+	const GLint FRAMES = 16;
+	std::vector<Instance> instances;
+	std::vector<CullAsset> assets;
+	CullParameters parameters;
+	const GLfloat extent = _bench_scene(count, instances, assets, parameters);
+
+	std::vector<GLubyte> lods, referenceLods;
+	CullOutput output, reference;
+	GLdouble cullTime = 0.0, referenceTime = 0.0;
+	GLdouble impostorCnt = 0.0, meshCnt = 0.0;
+	GLint mismatches = 0;
+	for(GLint frame=0; frame<FRAMES; ++frame) {
+		_bench_camera(frame, FRAMES, extent, parameters);
+
+		fw::Timer timer;
+		timer.Start();
+		cull_instances(instances, assets, parameters, lods, output);
+		timer.Stop();
+		cullTime+= timer.Ticks();
+		timer.Start();
+		_cull_reference(instances, assets, parameters, referenceLods,
+		                reference);
+		timer.Stop();
+		referenceTime+= timer.Ticks();
+
+		impostorCnt+= output.impostors.size();
+		meshCnt+= output.meshes.size();
+		for(size_t i=0; i<lods.size(); ++i)
+			mismatches+= lods[i] != referenceLods[i];
+		for(GLint a=0; a<2; ++a)
+			mismatches+= output.impostorDraws[a].primCount
+			             != reference.impostorDraws[a].primCount
+			           || output.meshDraws[a].primCount
+			             != reference.meshDraws[a].primCount;
+	}
+
+	outputStream << "culling " << count << " instances ("
+	             << fw::hardware_thread_count() << " threads, "
+#ifdef _LF_SSE2
+	             << "SSE2"
+#else
+	             << "scalar"
+#endif
+	             << ")\n"
+	             << "  visible: " << impostorCnt/FRAMES << " impostors, "
+	             << meshCnt/FRAMES << " meshes per frame\n"
+	             << "  cull:      " << 1000.0*cullTime/FRAMES << " ms/frame ("
+	             << count*FRAMES/(cullTime*1e6) << " M instances/s)\n"
+	             << "  reference: " << 1000.0*referenceTime/FRAMES
+	             << " ms/frame (scalar, one thread)\n"
+	             << "  mismatches: " << mismatches << std::endl;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Hierarchy build
+void build_bvh(std::vector<Instance>& instances,
+               const std::vector<CullAsset>& assets,
+               Bvh& bvh) {
+	FW_PROFILE_SCOPE("build_bvh");
+	const GLint instanceCnt = GLint(instances.size());
+	bvh.nodes.clear();
+	bvh.subtrees.clear();
+	bvh.topCnt = 0;
+	bvh.indexes.clear();
+	if(instanceCnt == 0) {
+		_asset_radii(assets, bvh.radii);
+		return;
+	}
+
+	// bounds of the positions
+	const GLint blockCnt = (instanceCnt+_SORT_BLOCK-1)/_SORT_BLOCK;
+	std::vector<GLfloat> blockBounds(6*blockCnt);
+	_BvhTask task = {};
+	task.instances = &instances[0];
+	task.instanceCnt = instanceCnt;
+	task.blockBounds = &blockBounds[0];
+	fw::parallel_for(blockCnt, &_bvh_bounds_block, &task);
+	Vector3 lo(blockBounds[0], blockBounds[1], blockBounds[2]);
+	Vector3 hi(blockBounds[3], blockBounds[4], blockBounds[5]);
+	for(GLint b=1; b<blockCnt; ++b)
+		for(GLint j=0; j<3; ++j) {
+			lo[j] = std::min(lo[j], blockBounds[6*b+j]);
+			hi[j] = std::max(hi[j], blockBounds[6*b+3+j]);
+		}
+	task.lo = lo;
+	for(GLint j=0; j<3; ++j)
+		task.scale[j] = hi[j] > lo[j] ? 1024.0f/(hi[j]-lo[j]) : 0.0f;
+
+	// Morton codes, sorted (least significant digit first, stable)
+	std::vector<GLuint> codes(instanceCnt), sortedCodes(instanceCnt);
+	std::vector<GLint> indexes(instanceCnt), sortedIndexes(instanceCnt);
+	std::vector<GLuint> histograms(blockCnt << _SORT_BITS);
+	task.codes = &codes[0];
+	task.indexes = &indexes[0];
+	task.sortedCodes = &sortedCodes[0];
+	task.sortedIndexes = &sortedIndexes[0];
+	task.histograms = &histograms[0];
+	fw::parallel_for(blockCnt, &_bvh_code_block, &task);
+	for(task.shift=0; task.shift<30; task.shift+=_SORT_BITS) {
+		fw::parallel_for(blockCnt, &_bvh_count_block, &task);
+		GLuint slot = 0;
+		for(GLint d=0; d<(1 << _SORT_BITS); ++d)
+			for(GLint b=0; b<blockCnt; ++b) {
+				GLuint& count = histograms[(b << _SORT_BITS) + d];
+				GLuint next = slot+count;
+				count = slot;
+				slot = next;
+			}
+		fw::parallel_for(blockCnt, &_bvh_scatter_block, &task);
+		std::swap(task.codes, task.sortedCodes);
+		std::swap(task.indexes, task.sortedIndexes);
+	}
+
+	// sort the instances
+	std::vector<Instance> sorted(instanceCnt);
+	task.sortedInstances = &sorted[0];
+	fw::parallel_for(blockCnt, &_bvh_gather_block, &task);
+	instances.swap(sorted);
+	bvh.indexes.assign(task.indexes, task.indexes+instanceCnt);
+
+	// top levels, then the subtrees (appended in order)
+	bvh.nodes.resize(1);
+	bvh.nodes[0].first = 0;
+	bvh.nodes[0].count = instanceCnt;
+	_bvh_split_nodes(task.codes, 0, bvh.nodes, &bvh.subtrees);
+	bvh.topCnt = GLint(bvh.nodes.size());
+	const GLint subtreeCnt = GLint(bvh.subtrees.size());
+	std::vector< std::vector<BvhNode> > subtreeNodes(subtreeCnt);
+	task.subtreeNodes = &subtreeNodes[0];
+	task.bvh = &bvh;
+	fw::parallel_for(subtreeCnt, &_bvh_subtree_block, &task);
+	GLint nodeCnt = bvh.topCnt;
+	for(GLint i=0; i<subtreeCnt; ++i) {
+		bvh.subtrees[i].begin = nodeCnt;
+		nodeCnt+= GLint(subtreeNodes[i].size())-1;
+		bvh.subtrees[i].end = nodeCnt;
+	}
+	bvh.nodes.resize(nodeCnt);
+	fw::parallel_for(subtreeCnt, &_bvh_append_block, &task);
+
+	refit_bvh(bvh, instances, assets);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Hierarchy refit
+void refit_bvh(Bvh& bvh,
+               const std::vector<Instance>& instances,
+               const std::vector<CullAsset>& assets) {
+	_asset_radii(assets, bvh.radii);
+	if(bvh.nodes.empty())
+		return;
+	_BvhTask task = {};
+	task.instances = &instances[0];
+	task.bvh = &bvh;
+	fw::parallel_for(GLint(bvh.subtrees.size()), &_bvh_refit_block, &task);
+	for(GLint n=bvh.topCnt-1; n>=0; --n)
+		_bvh_refit_node(bvh, &instances[0], n);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Sphere query
+void query_bvh(const Bvh& bvh,
+               const std::vector<Instance>& instances,
+               const Vector3& center,
+               GLfloat radius,
+               std::vector<GLint>& indexes) {
+	if(bvh.nodes.empty())
+		return;
+	GLint stack[_BVH_STACK];
+	GLint top = 0;
+	stack[0] = 0;
+	while(top >= 0) {
+		const BvhNode& node = bvh.nodes[stack[top--]];
+		GLfloat distance = 0.0f; // squared, to the box
+		for(GLint j=0; j<3; ++j) {
+			GLfloat d = std::max(std::max(node.lo[j]-center[j],
+			                              center[j]-node.hi[j]), 0.0f);
+			distance+= d*d;
+		}
+		if(distance > radius*radius)
+			continue;
+		if(node.children) {
+			stack[++top] = node.children+1;
+			stack[++top] = node.children;
+			continue;
+		}
+		for(GLint i=node.first; i<node.first+node.count; ++i) {
+			const Instance& instance = instances[i];
+			const GLfloat r = radius
+			                + instance.scale*bvh.radii[instance.asset];
+			const Vector3 d = instance.position - center;
+			if(d[0]*d[0] + d[1]*d[1] + d[2]*d[2] <= r*r)
+				indexes.push_back(i);
+		}
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Hierarchy culling
+void cull_bvh(const Bvh& bvh,
+              const std::vector<Instance>& instances,
+              const std::vector<CullAsset>& assets,
+              const CullParameters& parameters,
+              std::vector<GLubyte>& lods,
+              CullOutput& output) {
+	FW_PROFILE_SCOPE("cull_bvh");
+	const GLint assetCnt = GLint(assets.size());
+	const GLint subtreeCnt = GLint(bvh.subtrees.size());
+	if(lods.size() != instances.size())
+		lods.assign(instances.size(), 0);
+	if(subtreeCnt == 0 || assetCnt == 0) {
+		std::vector<GLuint> zeros(assetCnt+1, 0);
+		_cull_draws(assets, &zeros[0], &zeros[0], output);
+		return;
+	}
+
+	// traverse, classify and count
+	std::vector<GLuint> counts(2*assetCnt*subtreeCnt, 0);
+	std::vector< std::vector<GLint> > ranges(subtreeCnt);
+	_BvhCullTask task = {&bvh,
+	                     {&instances[0], GLint(instances.size()),
+	                      &bvh.radii[0], assetCnt, &parameters, &lods[0],
+	                      &counts[0], NULL, NULL},
+	                     &ranges[0]};
+	fw::parallel_for(subtreeCnt, &_bvh_cull_block, &task);
+
+	// draws and first slot of each subtree, then compact
+	_cull_slots(assets, subtreeCnt, &counts[0], output);
+	task.cull.impostors = output.impostors.empty() ? NULL
+	                                               : &output.impostors[0];
+	task.cull.meshes = output.meshes.empty() ? NULL : &output.meshes[0];
+	fw::parallel_for(subtreeCnt, &_bvh_compact_block, &task);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Hierarchy benchmark
+void benchmark_bvh(GLint count, std::ostream& outputStream) {
+	const GLint BUILDS = 4, FRAMES = 16, QUERIES = 1024, CHECKS = 16;
+	const GLfloat QUERY_RADIUS = 4.0f;
+	std::vector<Instance> instances;
+	std::vector<CullAsset> assets;
+	CullParameters parameters;
+	const GLfloat extent = _bench_scene(count, instances, assets, parameters);
+	fw::Timer timer;
+	Bvh bvh;
+
+	// build (from the scattered order)
+	const std::vector<Instance> scattered = instances;
+	GLdouble buildTime = 0.0;
+	for(GLint i=0; i<BUILDS; ++i) {
+		instances = scattered;
+		timer.Start();
+		build_bvh(instances, assets, bvh);
+		timer.Stop();
+		buildTime+= timer.Ticks();
+	}
+
+	// move the instances a little, and refit
+	GLdouble refitTime = 0.0;
+	GLuint seed = 2u;
+	for(GLint i=0; i<BUILDS; ++i) {
+		for(GLint j=0; j<count; ++j) {
+			instances[j].position[0]+= 0.25f*(_random(seed)*2.0f-1.0f);
+			instances[j].position[2]+= 0.25f*(_random(seed)*2.0f-1.0f);
+		}
+		timer.Start();
+		refit_bvh(bvh, instances, assets);
+		timer.Stop();
+		refitTime+= timer.Ticks();
+	}
+
+	// culling, against cull_instances (without LOD hysteresis state, as
+	// the instances of culled nodes keep their LOD)
+	std::vector<GLubyte> lods, linearLods;
+	CullOutput output, linear;
+	GLdouble cullTime = 0.0, linearTime = 0.0, visibleCnt = 0.0;
+	GLint mismatches = 0;
+	for(GLint frame=0; frame<FRAMES; ++frame) {
+		_bench_camera(frame, FRAMES, extent, parameters);
+		lods.assign(count, 0);
+		linearLods.assign(count, 0);
+		timer.Start();
+		cull_bvh(bvh, instances, assets, parameters, lods, output);
+		timer.Stop();
+		cullTime+= timer.Ticks();
+		timer.Start();
+		cull_instances(instances, assets, parameters, linearLods, linear);
+		timer.Stop();
+		linearTime+= timer.Ticks();
+
+		visibleCnt+= output.impostors.size() + output.meshes.size();
+		mismatches+= output.impostors.size() != linear.impostors.size()
+		          || output.meshes.size() != linear.meshes.size();
+		for(size_t i=0; i<output.impostors.size() && i<linear.impostors.size();
+		    ++i)
+			mismatches+= output.impostors[i].position
+			             != linear.impostors[i].position;
+	}
+
+	// sphere queries, the first ones against a linear search
+	std::vector<GLint> indexes;
+	GLdouble queryTime = 0.0, queryCnt = 0.0;
+	for(GLint i=0; i<QUERIES; ++i) {
+		Vector3 center((_random(seed)*2.0f-1.0f)*extent,
+		               0.0f,
+		               (_random(seed)*2.0f-1.0f)*extent);
+		indexes.clear();
+		timer.Start();
+		query_bvh(bvh, instances, center, QUERY_RADIUS, indexes);
+		timer.Stop();
+		queryTime+= timer.Ticks();
+		queryCnt+= indexes.size();
+		if(i < CHECKS) {
+			size_t expected = 0;
+			for(GLint j=0; j<count; ++j) {
+				const GLfloat r = QUERY_RADIUS + instances[j].scale
+				                * bvh.radii[instances[j].asset];
+				const Vector3 d = instances[j].position - center;
+				expected+= d[0]*d[0] + d[1]*d[1] + d[2]*d[2] <= r*r;
+			}
+			mismatches+= expected != indexes.size();
+		}
+	}
+
+	outputStream << "hierarchy of " << count << " instances ("
+	             << fw::hardware_thread_count() << " threads): "
+	             << bvh.nodes.size() << " nodes, "
+	             << bvh.subtrees.size() << " subtrees\n"
+	             << "  build: " << 1000.0*buildTime/BUILDS << " ms ("
+	             << count*BUILDS/(buildTime*1e6) << " M instances/s)\n"
+	             << "  refit: " << 1000.0*refitTime/BUILDS << " ms ("
+	             << count*BUILDS/(refitTime*1e6) << " M instances/s)\n"
+	             << "  cull:  " << 1000.0*cullTime/FRAMES << " ms/frame, "
+	             << visibleCnt/FRAMES << " visible (cull_instances: "
+	             << 1000.0*linearTime/FRAMES << " ms/frame)\n"
+	             << "  sphere queries (radius " << QUERY_RADIUS << "): "
+	             << 1e6*queryTime/QUERIES << " us, "
+	             << queryCnt/QUERIES << " instances\n"
+	             << "  mismatches: " << mismatches << std::endl;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Camera paths
+void load_camera_path(const std::string& filename,
+                      std::vector<CameraKey>& path) throw(fw::FWException) {
+	std::ifstream file(filename.c_str());
+	if(file.fail())
+		throw _CameraPathException(filename, "not found.");
+	path.clear();
+	std::string line;
+	for(GLint lineNumber=1; std::getline(file, line); ++lineNumber) {
+		line = line.substr(0, line.find('#'));
+		std::stringstream ss(line);
+		CameraKey key;
+		if(!(ss >> key.theta)) // blank line
+			continue;
+		std::string trailing;
+		if(!(ss >> key.phi >> key.radius) || (ss >> trailing)) {
+			std::stringstream reason;
+			reason << "line " << lineNumber << " is not \"theta phi radius\".";
+			throw _CameraPathException(filename, reason.str());
+		}
+		path.push_back(key);
+	}
+	if(path.empty())
+		throw _CameraPathException(filename, "no keys.");
+}
+
+
+void sweep_camera_path(GLint keyCnt,
+                       GLfloat minRadius,
+                       GLfloat maxRadius,
+                       std::vector<CameraKey>& path) {
+	keyCnt = std::max(keyCnt, 2);
+	path.resize(keyCnt);
+	for(GLint i=0; i<keyCnt; ++i) {
+		GLfloat t = GLfloat(i)/(keyCnt-1);
+		path[i].theta  = 0.001f + 89.999f*t;
+		path[i].phi    = 4.0f*360.0f*t;
+		path[i].radius = minRadius + (maxRadius-minRadius)*sin(_PI*t);
+	}
+}
+
+
+CameraKey camera_on_path(const std::vector<CameraKey>& path, GLfloat t) {
+	if(path.size() == 1)
+		return path[0];
+	GLfloat x = std::min(std::max(t, 0.0f), 1.0f)*(path.size()-1);
+	GLint i = std::min(GLint(x), GLint(path.size())-2);
+	GLfloat u = x-i;
+	CameraKey key;
+	key.theta  = path[i].theta  + u*(path[i+1].theta -path[i].theta);
+	key.phi    = path[i].phi    + u*(path[i+1].phi   -path[i].phi);
+	key.radius = path[i].radius + u*(path[i+1].radius-path[i].radius);
+	return key;
+}
+
+} // namespace lf
@@ -0,0 +1,212 @@
+////////////////////////////////////////////////////////////////////////////////
+// \author J Dupuy
+// \brief Impostor instances: the per-instance data of the billboards drawn
+// from a multi-asset atlas and the CPU passes that build their draws, and
+// the camera paths of the benchmarks.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCENE_HPP
+#define SCENE_HPP
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include "Algebra.hpp"
+#include "Framework.hpp"
+
+namespace lf {
+	// Impostor instance, laid out for the instance buffer (24 bytes)
+	struct Instance {
+		Vector3 position; // world space position of the object origin
+		GLfloat scale;    // uniform scale of the object
+		GLfloat rotation; // about the world y axis, in radians
+		GLint   asset;    // index of the asset in its MultiAtlas
+	};
+
+
+	// Scatter count instances of assetCnt assets on the [-extent,extent]^2
+	// square of the y=0 plane, with random scales and rotations.
+	// The scene only depends on seed.
+	void scatter_instances(GLint count,
+	                       GLint assetCnt,
+	                       GLfloat extent,
+	                       GLuint seed,
+	                       std::vector<Instance>& instances);
+
+
+	// Sort instances by asset and write one billboard draw per asset:
+	// command i draws the instances of asset i with baseInstance pointing
+	// to the first of them (commands of assets without instances draw
+	// nothing)
+	void build_impostor_draws(GLint assetCnt,
+	                          std::vector<Instance>& instances,
+	                          std::vector<fw::DrawArraysIndirectCommand>&
+	                          commands);
+
+
+
+	// Per asset data of the culling stage
+	struct CullAsset {
+		Vector4 bounds;    // object space bounding sphere (AssetRecord)
+		GLuint indexCount; // mesh of the asset in the shared mesh buffers
+		GLuint firstIndex;
+		GLint  baseVertex;
+	};
+
+
+	// Culling and LOD parameters of a frame. An instance is drawn as a mesh
+	// once its projected radius exceeds lodSize*(1+hysteresis) pixels, and
+	// as an impostor again once it falls below lodSize*(1-hysteresis).
+	struct CullParameters {
+		Vector4 planes[6];        // world space frustum planes (see below)
+		Vector3 eye;              // world space camera position
+		GLfloat maxDistance;      // instances further away are culled
+		GLfloat projectionScale;  // pixels per unit at unit distance
+		GLfloat lodSize;          // in pixels
+		GLfloat hysteresis;
+	};
+
+
+	// Instances that pass the culling, sorted by asset, and their draws:
+	// one command per asset and LOD (see build_impostor_draws)
+	struct CullOutput {
+		std::vector<Instance> impostors;
+		std::vector<Instance> meshes;
+		std::vector<fw::DrawArraysIndirectCommand>   impostorDraws;
+		std::vector<fw::DrawElementsIndirectCommand> meshDraws;
+	};
+
+
+	// LOD state of an instance (lods array of cull_instances)
+	enum {
+		LOD_VISIBLE = 1, // passed the culling of the last frame
+		LOD_MESH    = 2  // drawn as a mesh when visible
+	};
+
+
+	// Set the normalized frustum planes (a,b,c,d) of a view projection
+	// matrix: points p inside the frustum verify a*p.x+b*p.y+c*p.z+d >= 0
+	void frustum_planes(const Matrix4x4& viewProjection, Vector4 planes[6]);
+	// Get projectionScale for a vertical field of view and a viewport height
+	GLfloat projection_scale(GLfloat fovy, GLsizei height);
+
+
+	// Cull instances against the frustum and the maximum distance, pick
+	// their LOD and write the compacted instances and their draws. lods
+	// holds the LOD_* flags of each instance and is updated (it is reset
+	// if its size does not match). Instances are processed in blocks of
+	// four with SSE, blocks of instances are distributed over the threads
+	// of fw::parallel_for. The bounding sphere of an instance is centered
+	// on its position, with a radius of scale*(|center|+radius) of the
+	// asset sphere, so that rotations need not be evaluated.
+	void cull_instances(const std::vector<Instance>& instances,
+	                    const std::vector<CullAsset>& assets,
+	                    const CullParameters& parameters,
+	                    std::vector<GLubyte>& lods,
+	                    CullOutput& output);
+
+
+	// Report the culling throughput over count scattered instances for a
+	// camera circling the scene, and check the results against a scalar
+	// reference. Does not use OpenGL.
+	void benchmark_culling(GLint count, std::ostream& outputStream);
+
+
+
+	// Node of a bounding volume hierarchy. Each node holds a range of the
+	// sorted instances; the children of an internal node are adjacent and
+	// stored after it.
+	struct BvhNode {
+		Vector3 lo;       // world space bounding box of the instance spheres
+		GLint   first;    // first instance
+		Vector3 hi;
+		GLint   count;    // instance count
+		GLint   children; // first child, 0 for leaves
+	};
+
+
+	// Linear bounding volume hierarchy (LBVH) over the bounding spheres of
+	// instances (see cull_instances). Instances are sorted along a Morton
+	// curve and split where their codes first differ, down to leaves of a
+	// few instances. The nodes below the top levels are grouped in subtrees
+	// that are built, refitted and traversed in parallel.
+	struct Bvh {
+		struct Subtree {
+			GLint root;       // node in the top levels
+			GLint begin, end; // other nodes of the subtree
+		};
+		std::vector<BvhNode> nodes;   // the root is node 0
+		std::vector<Subtree> subtrees;
+		GLint topCnt;                 // nodes of the top levels
+		std::vector<GLint>   indexes; // index of each instance before the sort
+		std::vector<GLfloat> radii;   // of the asset spheres
+	};
+
+
+	// Build a hierarchy over instances, which are sorted in place (so that
+	// the nodes read them sequentially). The sort and the subtrees are
+	// multithreaded.
+	void build_bvh(std::vector<Instance>& instances,
+	               const std::vector<CullAsset>& assets,
+	               Bvh& bvh);
+	// Update the bounds of the nodes after instances have moved (or their
+	// scale or asset changed), without reordering them. The hierarchy is
+	// kept, so that its quality degrades as the instances drift from their
+	// build positions; rebuild it when they have moved far.
+	void refit_bvh(Bvh& bvh,
+	               const std::vector<Instance>& instances,
+	               const std::vector<CullAsset>& assets);
+	// Append the instances whose bounding sphere intersects a sphere
+	void query_bvh(const Bvh& bvh,
+	               const std::vector<Instance>& instances,
+	               const Vector3& center,
+	               GLfloat radius,
+	               std::vector<GLint>& indexes);
+	// Same as cull_instances, traversing the hierarchy: nodes outside the
+	// frustum or too far are skipped, and nodes that pass all the tests
+	// whole are classified without visiting their children. lods is only
+	// updated for the instances of the visited nodes. The output matches
+	// the one of cull_instances.
+	void cull_bvh(const Bvh& bvh,
+	              const std::vector<Instance>& instances,
+	              const std::vector<CullAsset>& assets,
+	              const CullParameters& parameters,
+	              std::vector<GLubyte>& lods,
+	              CullOutput& output);
+
+
+	// Report the build, refit, culling and sphere query throughput of the
+	// hierarchy over count scattered instances, and compare its culling with
+	// cull_instances. Does not use OpenGL.
+	void benchmark_bvh(GLint count, std::ostream& outputStream);
+
+
+	// Camera of the viewer, looking at the object from the polar angle
+	// theta (in [0,90] degrees, 0 is the pole) and the azimuth phi (in
+	// degrees), at distance radius
+	struct CameraKey {
+		GLfloat theta;
+		GLfloat phi;
+		GLfloat radius;
+	};
+
+	// Load a camera path: one "theta phi radius" key per line, '#' starts
+	// a comment. The keys are evenly spaced along the path.
+	void load_camera_path(const std::string& filename,
+	                      std::vector<CameraKey>& path)
+	                      throw(fw::FWException);
+	// Build a path of keyCnt keys sweeping the hemisphere: a spiral from the
+	// pole to the horizon making four turns, the radius going from
+	// minRadius to maxRadius and back
+	void sweep_camera_path(GLint keyCnt,
+	                       GLfloat minRadius,
+	                       GLfloat maxRadius,
+	                       std::vector<CameraKey>& path);
+	// Get the camera at t in [0,1] along a path (linear interpolation)
+	CameraKey camera_on_path(const std::vector<CameraKey>& path, GLfloat t);
+
+} // namespace lf
+
+#endif
+
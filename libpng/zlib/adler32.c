@@ -7,6 +7,7 @@
 
 #define ZLIB_INTERNAL
 #include "zlib.h"
+#include "adler32_simd.h" /* SSSE3 sums, selected at runtime */
 
 #define BASE 65521UL    /* largest prime smaller than 65536 */
 #define NMAX 5552
@@ -81,6 +82,14 @@ uLong ZEXPORT adler32(adler, buf, len)
     if (buf == Z_NULL)
         return 1L;
 
+#ifdef Z_X86_SIMD
+    if (len >= Z_ADLER32_SIMD_MIN_LENGTH) {
+        z_cpu_check_features();
+        if (z_cpu_has_adler32_simd)
+            return adler32_simd(adler | (sum2 << 16), buf, len);
+    }
+#endif /* Z_X86_SIMD */
+
     /* in case short lengths are provided, keep it somewhat fast */
     if (len < 16) {
         while (len--) {
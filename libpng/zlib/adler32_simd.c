@@ -0,0 +1,104 @@
+/* adler32_simd.c -- Adler-32 using SSSE3 multiply-adds
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ *
+ * Per 32 byte block, s1 grows by the byte sum (psadbw) and s2 by the bytes
+ * weighted 32..1 (pmaddubsw + pmaddwd), plus 32 times the s1 value at the
+ * start of the block. The 32*s1 terms are accumulated in a separate
+ * register and folded in once per NMAX run, where both sums are reduced.
+ */
+
+/* @(#) $Id$ */
+
+#include "zutil.h"
+#include "adler32_simd.h"
+
+#ifdef Z_X86_SIMD
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+#define BASE 65521UL    /* largest prime smaller than 65536 */
+#define NMAX 5552
+/* NMAX is the largest n such that 255n(n+1)/2 + (n+1)(BASE-1) <= 2^32-1 */
+
+#define BLOCK_SIZE 32
+
+/* ========================================================================= */
+Z_TARGET("ssse3")
+unsigned long adler32_simd(adler, buf, len)
+    unsigned long adler;
+    const unsigned char FAR *buf;
+    unsigned len;
+{
+    unsigned long s1 = adler & 0xffff;
+    unsigned long s2 = (adler >> 16) & 0xffff;
+    unsigned blocks = len / BLOCK_SIZE;
+    const __m128i tap1 = _mm_setr_epi8(32,31,30,29,28,27,26,25,
+                                       24,23,22,21,20,19,18,17);
+    const __m128i tap2 = _mm_setr_epi8(16,15,14,13,12,11,10, 9,
+                                        8, 7, 6, 5, 4, 3, 2, 1);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+
+    len -= blocks * BLOCK_SIZE;
+
+    while (blocks) {
+        __m128i v_ps, v_s1, v_s2;
+        unsigned n = NMAX / BLOCK_SIZE; /* keeps the sums below 2^32 */
+        if (n > blocks)
+            n = blocks;
+        blocks -= n;
+
+        v_ps = _mm_cvtsi32_si128((int)(s1 * n));
+        v_s2 = _mm_cvtsi32_si128((int)s2);
+        v_s1 = zero;
+
+        do {
+            const __m128i bytes1 = _mm_loadu_si128((const __m128i *)buf);
+            const __m128i bytes2 = _mm_loadu_si128((const __m128i *)(buf + 16));
+            __m128i mad1, mad2;
+
+            /* previous byte sum, weighted by the block size later */
+            v_ps = _mm_add_epi32(v_ps, v_s1);
+
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+            mad1 = _mm_maddubs_epi16(bytes1, tap1);
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(mad1, ones));
+
+            v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+            mad2 = _mm_maddubs_epi16(bytes2, tap2);
+            v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(mad2, ones));
+
+            buf += BLOCK_SIZE;
+        } while (--n);
+
+        v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+
+        /* horizontal sums */
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2,3,0,1)));
+        v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1,0,3,2)));
+        s1 += (unsigned)_mm_cvtsi128_si32(v_s1);
+
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2,3,0,1)));
+        v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1,0,3,2)));
+        s2 = (unsigned)_mm_cvtsi128_si32(v_s2);
+
+        s1 %= BASE;
+        s2 %= BASE;
+    }
+
+    /* leftover bytes */
+    if (len) {
+        while (len--) {
+            s1 += *buf++;
+            s2 += s1;
+        }
+        if (s1 >= BASE)
+            s1 -= BASE;
+        s2 %= BASE;
+    }
+
+    return s1 | (s2 << 16);
+}
+
+#endif /* Z_X86_SIMD */
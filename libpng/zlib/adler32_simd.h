@@ -0,0 +1,27 @@
+/* adler32_simd.h -- Adler-32 using SSSE3 multiply-adds
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/* WARNING: this file should *not* be used by applications. It is
+   part of the implementation of the compression library and is
+   subject to change. Applications should only use zlib.h.
+ */
+
+#ifndef ADLER32_SIMD_H
+#define ADLER32_SIMD_H
+
+#include "cpu_features.h"
+
+#ifdef Z_X86_SIMD
+
+/* below this length the scalar loop wins */
+#define Z_ADLER32_SIMD_MIN_LENGTH 64
+
+/* Returns the Adler-32 of len bytes of buf, continuing from adler. */
+unsigned long adler32_simd OF((unsigned long adler,
+                               const unsigned char FAR *buf,
+                               unsigned len));
+
+#endif /* Z_X86_SIMD */
+
+#endif /* ADLER32_SIMD_H */
@@ -0,0 +1,50 @@
+/* cpu_features.c -- runtime detection of x86 SIMD extensions
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/* @(#) $Id$ */
+
+#include "zutil.h"
+#include "cpu_features.h"
+
+#ifdef Z_X86_SIMD
+
+#if defined(_MSC_VER)
+#  include <intrin.h>
+#else
+#  include <cpuid.h>
+#endif
+
+int z_cpu_has_crc32_simd = 0;
+int z_cpu_has_adler32_simd = 0;
+
+local volatile int cpu_features_checked = 0;
+
+/* ========================================================================= */
+void z_cpu_check_features()
+{
+    unsigned ecx;
+#if defined(_MSC_VER)
+    int regs[4];
+#else
+    unsigned eax, ebx, edx;
+#endif
+
+    if (cpu_features_checked)
+        return;
+
+#if defined(_MSC_VER)
+    __cpuid(regs, 1);
+    ecx = (unsigned)regs[2];
+#else
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        ecx = 0;
+#endif
+
+    /* ecx bits: 1 PCLMULQDQ, 9 SSSE3, 19 SSE4.1 */
+    z_cpu_has_crc32_simd = (ecx & (1u << 1)) && (ecx & (1u << 19));
+    z_cpu_has_adler32_simd = (ecx & (1u << 9)) != 0;
+    cpu_features_checked = 1;
+}
+
+#endif /* Z_X86_SIMD */
@@ -0,0 +1,47 @@
+/* cpu_features.h -- runtime detection of the x86 SIMD extensions used by
+ * the accelerated crc32() and adler32() paths
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/* WARNING: this file should *not* be used by applications. It is
+   part of the implementation of the compression library and is
+   subject to change. Applications should only use zlib.h.
+ */
+
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+/* The SIMD paths are only built for x86 targets whose compiler can emit
+ * SSSE3/SSE4.1/PCLMULQDQ code on a per function basis (no global -m flags
+ * required). Define NO_X86_SIMD to force the portable table code.
+ */
+#ifndef NO_X86_SIMD
+#  if defined(__x86_64__) || defined(__i386__) || \
+      defined(_M_X64) || defined(_M_IX86)
+#    if defined(__clang__) || (defined(_MSC_VER) && _MSC_VER >= 1600) || \
+        (defined(__GNUC__) && \
+         (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+#      define Z_X86_SIMD
+#    endif
+#  endif
+#endif
+
+#ifdef Z_X86_SIMD
+
+#  if defined(__GNUC__) || defined(__clang__)
+#    define Z_TARGET(isa) __attribute__((target(isa)))
+#  else
+#    define Z_TARGET(isa)
+#  endif
+
+/* set by z_cpu_check_features() */
+extern int z_cpu_has_crc32_simd;   /* SSE4.1 + PCLMULQDQ */
+extern int z_cpu_has_adler32_simd; /* SSSE3 */
+
+/* Query cpuid once. Safe to call from several threads: every caller
+ * writes the same values. */
+void z_cpu_check_features OF((void));
+
+#endif /* Z_X86_SIMD */
+
+#endif /* CPU_FEATURES_H */
@@ -27,6 +27,7 @@
 #endif /* MAKECRCH */
 
 #include "zutil.h"      /* for STDC and FAR definitions */
+#include "crc32_simd.h" /* PCLMULQDQ folding, selected at runtime */
 
 #define local static
 
@@ -228,6 +229,21 @@ unsigned long ZEXPORT crc32(crc, buf, len)
         make_crc_table();
 #endif /* DYNAMIC_CRC_TABLE */
 
+#ifdef Z_X86_SIMD
+    if (len >= Z_CRC32_SIMD_MIN_LENGTH) {
+        z_cpu_check_features();
+        if (z_cpu_has_crc32_simd) {
+            /* fold the 16 byte blocks, leave the tail to the tables */
+            unsigned chunk = len & ~Z_CRC32_SIMD_CHUNK_MASK;
+            crc = ~crc32_simd(buf, chunk, ~(unsigned)crc) & 0xffffffffUL;
+            len -= chunk;
+            if (!len)
+                return crc;
+            buf += chunk;
+        }
+    }
+#endif /* Z_X86_SIMD */
+
 #ifdef BYFOUR
     if (sizeof(void *) == sizeof(ptrdiff_t)) {
         u4 endian;
@@ -0,0 +1,30 @@
+/* crc32_simd.h -- CRC-32 using carry-less multiplication (PCLMULQDQ)
+ * For conditions of distribution and use, see copyright notice in zlib.h
+ */
+
+/* WARNING: this file should *not* be used by applications. It is
+   part of the implementation of the compression library and is
+   subject to change. Applications should only use zlib.h.
+ */
+
+#ifndef CRC32_SIMD_H
+#define CRC32_SIMD_H
+
+#include "cpu_features.h"
+
+#ifdef Z_X86_SIMD
+
+/* The folding loop consumes 64 bytes before reducing, and only whole
+ * 16 byte blocks. Shorter buffers and the tail go through the tables. */
+#define Z_CRC32_SIMD_MIN_LENGTH 64
+#define Z_CRC32_SIMD_CHUNK_MASK 15
+
+/* Returns the CRC of len bytes of buf, len being a multiple of 16 and at
+ * least Z_CRC32_SIMD_MIN_LENGTH. crc is the raw (pre-inverted) register
+ * value, as is the result. */
+unsigned crc32_simd OF((const unsigned char FAR *buf, unsigned len,
+                        unsigned crc));
+
+#endif /* Z_X86_SIMD */
+
+#endif /* CRC32_SIMD_H */
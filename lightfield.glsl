@@ -14,7 +14,13 @@ void find_views(vec3 cDir,
                 out ivec3 layers,
                 out vec3 weights);
 
-vec3 spherical_to_cartesian(float theta, float phi);
+vec3 decode_normal(vec2 encoded);
+
+void set_asset(int asset);
+
+vec4 fetch_view(vec2 texCoord, int layer);
+
+vec4 sample_tiles(vec2 texCoord, int layer);
 
 
 //------------------------------------------------------------------------------
@@ -22,29 +28,129 @@ vec3 spherical_to_cartesian(float theta, float phi);
 uniform sampler2DArray sView;
 uniform int uViewCount;
 
+#ifdef SPARSE_TILES
+uniform sampler2D sTiles;            // tiles with a one texel border
+uniform usamplerBuffer sIndirection; // tile index, 0xFFFFFFFF if empty
+uniform int uResolution;             // of the dense layers
+uniform int uLevelCount;
+uniform int uTileSize;
+uniform int uTilesPerRow;
+uniform int uLevelOffsets[16];       // first indirection entry of a level
+#endif
+
+struct View {
+	mat3 axis;   // local frame
+	vec4 depth;  // (near, far, 0, 0) view space depth range
+	vec4 bounds; // (left, right, bottom, top) view space extent
+};
+
+#ifdef MULTI_ASSET // views of all the assets, drawn with instanced billboards
+struct Asset {
+	int page;        // texture array bound to sView when drawn
+	int layerOffset; // first layer in sView
+	int viewN;
+	int viewOffset;  // first view in sViewTable
+	vec4 bounds;     // (center, radius) bounding sphere
+};
+
+layout(std140) uniform Assets {
+	Asset uAssets[ASSETCNT]; // ASSETCNT must be defined
+};
+
+uniform samplerBuffer sViewTable; // lf::View array, five texels per view
+#else
 layout(std140) uniform ViewAxis {
-	mat3 uAxis[VIEWCNT]; // VIEWCNT must be defined
+	View uViews[VIEWCNT]; // VIEWCNT must be defined
 };
+#endif
+
+View get_view(int view);
+vec2 view_tex_coord(View view, vec3 p);
 
-uniform vec3 uCamPos;
-uniform mat3 uBillboardAxis;
-uniform mat4 uModelViewProjection;
+// view set of the asset being drawn (see set_asset)
+int gViewCount;
+int gViewOffset;
+int gLayerOffset;
+
+// camera, written once per frame
+layout(std140) uniform Frame {
+	mat4 uModelViewProjection; // of the billboard (single object)
+	mat3 uBillboardAxis;
+	vec3 uCamPos;              // object space
+	mat4 uViewProjection;      // of the instanced billboards (MULTI_ASSET)
+	vec3 uEyePosition;         // world space
+};
 
 
 
 //------------------------------------------------------------------------------
 // vertex shader
+// The views to blend only depend on the direction of the billboard, they are
+// selected once per vertex and passed flat with their depth ranges. The
+// texcoords of a view are affine in the position on the billboard, so they
+// are interpolated.
 #ifdef _VERTEX_
 layout(location=0) out vec3 oTexCoord;
 layout(location=1) out vec3 oViewDir;
+layout(location=3) flat out ivec3 oLayers;
+layout(location=4) flat out vec3  oWeights;
+layout(location=5) flat out vec3  oDepthNear; // depth range of each view
+layout(location=6) flat out vec3  oDepthFar;
+layout(location=7) out vec4 oViewTexCoord01;  // texcoords of each view
+layout(location=8) out vec2 oViewTexCoord2;
+
+void select_views(vec3 camDir, vec3 texCoord) {
+	find_views(camDir, oLayers, oWeights);
+	View v0 = get_view(oLayers[0]);
+	View v1 = get_view(oLayers[1]);
+	View v2 = get_view(oLayers[2]);
+	oDepthNear = vec3(v0.depth.x, v1.depth.x, v2.depth.x);
+	oDepthFar  = vec3(v0.depth.y, v1.depth.y, v2.depth.y);
+	oViewTexCoord01 = vec4(view_tex_coord(v0, texCoord),
+	                       view_tex_coord(v1, texCoord));
+	oViewTexCoord2  = view_tex_coord(v2, texCoord);
+}
+
+#ifdef MULTI_ASSET // lf::Instance attributes
+layout(location=0) in int   iAsset;
+layout(location=1) in vec4  iPosition; // (world position, scale)
+layout(location=2) in float iRotation; // about the world y axis
+layout(location=2) flat out int oAsset;
 
+void main() {
+	vec2 p = vec2(gl_VertexID & 1, (gl_VertexID >> 1) & 1)*2.0-1.0;
+	vec4 sphere = uAssets[iAsset].bounds;
+	float c = cos(iRotation);
+	float s = sin(iRotation);
+	mat3 rotation = mat3(c,0,-s, 0,1,0, s,0,c); // object to world
+
+	// camera facing billboard of the bounding sphere, in object space
+	// (same frame as lf::render_impostor)
+	vec3 eye = transpose(rotation) * (uEyePosition-iPosition.xyz)
+	         / iPosition.w;
+	vec3 z = normalize(eye-sphere.xyz);
+	vec3 up = abs(z.y) < 0.99 ? vec3(0,1,0) : vec3(1,0,0);
+	vec3 x = normalize(cross(up, z));
+	vec3 y = cross(z, x);
+	oTexCoord = sphere.xyz + mat3(x, y, z) * vec3(p*sphere.w, 0);
+	oViewDir = normalize(eye-oTexCoord);
+	oAsset = iAsset;
+	set_asset(iAsset);
+	select_views(z, oTexCoord);
+	gl_Position = uViewProjection
+	            * vec4(iPosition.xyz + iPosition.w*(rotation*oTexCoord), 1);
+}
+#else
 void main() {
 	vec2 p = vec2(gl_VertexID & 1, (gl_VertexID >> 1) & 1)*2.0-1.0;
 	gl_Position = uModelViewProjection * vec4(p,0,1);
 	oTexCoord = uBillboardAxis * vec3(p,0);
 	oViewDir = normalize(uCamPos-oTexCoord);
+	set_asset(0);
+	select_views(-uBillboardAxis[2], oTexCoord);
 }
 #endif
+#endif
 
 
 //------------------------------------------------------------------------------
@@ -52,30 +158,40 @@ void main() {
 #ifdef _FRAGMENT_
 layout(location=0) in  vec3 iTexCoord;
 layout(location=1) in  vec3 iViewDir;
+#ifdef MULTI_ASSET
+layout(location=2) flat in int iAsset;
+#endif
+layout(location=3) flat in ivec3 iLayers;
+layout(location=4) flat in vec3  iWeights;
+layout(location=5) flat in vec3  iDepthNear;
+layout(location=6) flat in vec3  iDepthFar;
+layout(location=7) in vec4 iViewTexCoord01;
+layout(location=8) in vec2 iViewTexCoord2;
 layout(location=0) out vec4 oColour;
 
 layout(depth_greater) out float gl_FragDepth;
 
 void main() {
-	ivec3 layers;
-	vec3 weights;
-	find_views(-uBillboardAxis[2], layers, weights);
-
-	// texcoords for each view
-	vec2 texCoord0 = (uAxis[layers[0]] * iTexCoord).st*0.5+0.5;
-	vec2 texCoord1 = (uAxis[layers[1]] * iTexCoord).st*0.5+0.5;
-	vec2 texCoord2 = (uAxis[layers[2]] * iTexCoord).st*0.5+0.5;
-	vec4 t0 = texture(sView, vec3(texCoord0, layers[0]));
-	vec4 t1 = texture(sView, vec3(texCoord1, layers[1]));
-	vec4 t2 = texture(sView, vec3(texCoord2, layers[2]));
+#ifdef MULTI_ASSET
+	set_asset(iAsset);
+#else
+	set_asset(0);
+#endif
+	ivec3 layers = iLayers;
+	vec3 weights = iWeights;
+
+	// fetch each view, and blend
+	vec4 t0 = fetch_view(iViewTexCoord01.xy, layers[0]);
+	vec4 t1 = fetch_view(iViewTexCoord01.zw, layers[1]);
+	vec4 t2 = fetch_view(iViewTexCoord2, layers[2]);
 	vec4 t = t0*weights[0]+t1*weights[1]+t2*weights[2]; // lerp
+	t.r = dot(weights, mix(iDepthNear, iDepthFar, vec3(t0.r, t1.r, t2.r)));
 
-	vec4 z = 
 	// second iteration (bugged)
-//	vec3 q = iTexCoord + iViewDir*fma(t.r,SQRT_2,-INV_SQRT_2);
-//	texCoord0 = (uAxis[layers[0]] * q).st*0.5+0.5;
-//	texCoord1 = (uAxis[layers[1]] * q).st*0.5+0.5;
-//	texCoord2 = (uAxis[layers[2]] * q).st*0.5+0.5;
+//	vec3 q = iTexCoord + iViewDir*t.r;
+//	texCoord0 = view_tex_coord(get_view(layers[0]), q);
+//	texCoord1 = view_tex_coord(get_view(layers[1]), q);
+//	texCoord2 = view_tex_coord(get_view(layers[2]), q);
 //	t0 = texture(sView, vec3(texCoord0, layers[0]));
 //	t1 = texture(sView, vec3(texCoord1, layers[1]));
 //	t2 = texture(sView, vec3(texCoord2, layers[2]));
@@ -85,8 +201,8 @@ void main() {
 	gl_FragDepth = gl_FragCoord.z;
 
 	// build output
-	oColour.rgb = spherical_to_cartesian(t.g*PI, t.b*TWO_PI)*t.a;
-	oColour.rgb = t.rrr*t.a;
+	oColour.rgb = decode_normal(t.gb)*t.a;
+	oColour.rgb = vec3(fma(t.r, INV_SQRT_2, 0.5))*t.a;
 	oColour.rgb = vec3(gl_FragDepth);
 
 }
@@ -96,7 +212,38 @@ void main() {
 //------------------------------------------------------------------------------
 // function impl
 ivec3 _view_number(ivec3 i, ivec3 j) {
-	return i*((2*uViewCount+1)-abs(i))+j+(uViewCount*(uViewCount+1));
+	return i*((2*gViewCount+1)-abs(i))+j+(gViewCount*(gViewCount+1));
+}
+
+
+//------------------------------------------------------------------------------
+void set_asset(int asset) {
+#ifdef MULTI_ASSET
+	gViewCount   = uAssets[asset].viewN;
+	gViewOffset  = uAssets[asset].viewOffset;
+	gLayerOffset = uAssets[asset].layerOffset;
+#else
+	gViewCount   = uViewCount;
+	gViewOffset  = 0;
+	gLayerOffset = 0;
+#endif
+}
+
+
+//------------------------------------------------------------------------------
+View get_view(int view) {
+#ifdef MULTI_ASSET
+	int texel = 5*(gViewOffset+view);
+	View v;
+	v.axis = mat3(texelFetch(sViewTable, texel).xyz,
+	              texelFetch(sViewTable, texel+1).xyz,
+	              texelFetch(sViewTable, texel+2).xyz);
+	v.depth  = texelFetch(sViewTable, texel+3);
+	v.bounds = texelFetch(sViewTable, texel+4);
+	return v;
+#else
+	return uViews[view];
+#endif
 }
 
 
@@ -104,8 +251,8 @@ ivec3 _view_number(ivec3 i, ivec3 j) {
 void find_views(vec3 cDir, out ivec3 layers, out vec3 weights) {
 	vec3 VDIR = vec3(cDir.x, max(cDir.y, 0.01), cDir.z);
 	float a = abs(VDIR.z) > abs(VDIR.x) ? VDIR.x / VDIR.z : -VDIR.z / VDIR.x;
-	float nxx = uViewCount * (1.0 - a) * acos(VDIR.y) / PI;
-	float nyy = uViewCount * (1.0 + a) * acos(VDIR.y) / PI;
+	float nxx = gViewCount * (1.0 - a) * acos(VDIR.y) / PI;
+	float nyy = gViewCount * (1.0 + a) * acos(VDIR.y) / PI;
 	int i = int(floor(nxx));
 	int j = int(floor(nyy));
 	float ti = nxx - i;
@@ -127,11 +274,91 @@ void find_views(vec3 cDir, out ivec3 layers, out vec3 weights) {
 
 
 //------------------------------------------------------------------------------
-vec3 spherical_to_cartesian(float theta, float phi) {
+// inverse of the encoding of mesh.glsl
+vec3 decode_normal(vec2 encoded) {
+#ifdef OCTAHEDRAL_NORMALS
+	vec3 n = vec3(encoded.x, 0.0, encoded.y)*2.0-1.0;
+	n.y = 1.0-abs(n.x)-abs(n.z);
+	if(n.y < 0.0)
+		n.xz = (1.0-abs(n.zx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0,
+		                              n.z >= 0.0 ? 1.0 : -1.0);
+	return normalize(n);
+#else
+	float theta = encoded.x*PI;
+	float phi = (encoded.y-0.5)*TWO_PI;
 	float sinTheta = sin(theta);
-	return vec3(sinTheta*cos(phi),
-	             cos(theta),
-	             sinTheta*sin(phi));
+	return vec3(sinTheta*sin(phi),
+	            cos(theta),
+	            -sinTheta*cos(phi));
+#endif
+}
+
+
+//------------------------------------------------------------------------------
+// projects p on the layer of a view
+vec2 view_tex_coord(View view, vec3 p) {
+	vec4 bounds = view.bounds;
+	return ((view.axis * p).st - bounds.xz) / (bounds.yw - bounds.xz);
 }
 
 
+//------------------------------------------------------------------------------
+// returns (depth in the depth range of the view, encoded normal, alpha)
+vec4 fetch_view(vec2 texCoord, int layer) {
+	int textureLayer = gLayerOffset + layer;
+#ifdef SPLIT_LAYERS // BC5 atlas: (depth, alpha) layers, then (theta, phi) layers
+	int normalLayer = textureLayer + 2*gViewCount*(gViewCount+1)+1;
+	vec2 depthAlpha = texture(sView, vec3(texCoord, textureLayer)).rg;
+	vec2 normal = texture(sView, vec3(texCoord, normalLayer)).rg;
+	vec4 t = vec4(depthAlpha.x, normal, depthAlpha.y);
+#elif defined(SPARSE_TILES)
+	vec4 t = sample_tiles(texCoord, layer);
+#else
+	vec4 t = texture(sView, vec3(texCoord, textureLayer));
+#endif
+	return t;
+}
+
+
+//------------------------------------------------------------------------------
+#ifdef SPARSE_TILES
+vec4 _sample_tile_level(vec2 texCoord, int layer, int level) {
+	int size = max(uResolution >> level, 1);
+	int tileCnt = (size+uTileSize-1)/uTileSize;
+	vec2 p = texCoord*float(size);
+	if(any(lessThan(p, vec2(-0.5))) || any(greaterThan(p, vec2(size)+0.5)))
+		return vec4(0); // border
+	ivec2 tile = clamp(ivec2(floor(p/float(uTileSize))),
+	                   ivec2(0),
+	                   ivec2(tileCnt-1));
+	uint index = texelFetch(sIndirection,
+	                        uLevelOffsets[level]
+	                        + (layer*tileCnt+tile.y)*tileCnt+tile.x).r;
+	if(index == 0xFFFFFFFFu)
+		return vec4(0); // empty tile
+	ivec2 origin = ivec2(int(index) % uTilesPerRow,
+	                     int(index) / uTilesPerRow) * (uTileSize+2);
+	vec2 q = vec2(origin) + p - vec2(tile*uTileSize) + 1.0;
+	return textureLod(sTiles, q/vec2(textureSize(sTiles, 0)), 0.0);
+}
+
+// trilinear lookup through the indirection table (see lf::sample_atlas)
+vec4 sample_tiles(vec2 texCoord, int layer) {
+#ifdef _FRAGMENT_
+	vec2 dx = dFdx(texCoord)*float(uResolution);
+	vec2 dy = dFdy(texCoord)*float(uResolution);
+	float lod = clamp(0.5*log2(max(dot(dx,dx), dot(dy,dy))),
+	                  0.0,
+	                  float(uLevelCount-1));
+#else // no derivatives
+	float lod = 0.0;
+#endif
+	int level = int(lod);
+	vec4 t = _sample_tile_level(texCoord, layer, level);
+	if(lod > float(level))
+		t = mix(t, _sample_tile_level(texCoord, layer, level+1),
+		        lod-float(level));
+	return t;
+}
+#endif
+
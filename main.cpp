@@ -12,6 +12,11 @@
 // GL libraries
 #include "glew.hpp"
 #include "GL/freeglut.h"
+#ifdef _WIN32
+#	include "GL/wglew.h" // swap control
+#else
+#	include "GL/glxew.h"
+#endif // _WIN32
 
 #ifdef _ANT_ENABLE
 #	include "AntTweakBar.h"
@@ -21,15 +26,20 @@
 #include "Algebra.hpp"      // Basic algebra library
 #include "Transform.hpp"    // Basic transformations
 #include "Framework.hpp"    // utility classes/functions
-#include "glm.hpp"           // obj loader
+#include "Lightfield.hpp"    // lightfield atlases
+#include "Bake.hpp"          // CPU baker
+#include "Scene.hpp"         // impostor instances
 
 // Standard librabries
 #include <iostream>
+#include <fstream>
 #include <sstream>
 #include <vector>
-#include <map>
 #include <stdexcept>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -49,6 +59,11 @@ enum {
 	BUFFER_MESH_INDEXES,
 	BUFFER_MESH_DRAW,
 	BUFFER_LIGHTFIELD_AXIS, // local frame of each view
+	BUFFER_LIGHTFIELD_INDIRECTION, // tile indexes of the sparse atlas
+	BUFFER_ASSET_RECORDS,   // lf::AssetRecord of each asset
+	BUFFER_ASSET_INSTANCES, // lf::Instance of each billboard
+	BUFFER_ASSET_DRAWS,     // one indirect command per asset
+	BUFFER_FRAME,           // ring of Frame blocks (lightfield.glsl)
 	BUFFER_COUNT,
 
 	// vertex arrays
@@ -58,17 +73,42 @@ enum {
 
 	// samplers
 	SAMPLER_TRILINEAR = 0,
+	SAMPLER_BILINEAR,
 	SAMPLER_COUNT,
 
 	// textures
 	TEXTURE_LIGHFIELD = 0,
+	TEXTURE_LIGHFIELD_TILES,
+	TEXTURE_LIGHFIELD_INDIRECTION,
+	TEXTURE_ASSET_VIEWS, // view table of the multi-asset atlas
 	TEXTURE_COUNT,
 
 	// programs
 	PROGRAM_MESH = 0,
 	PROGRAM_LIGHTFIELD,
 	PROGRAM_PREVIEW,
-	PROGRAM_COUNT
+	PROGRAM_COUNT,
+
+	// uniforms updated after init
+	UNIFORM_MESH_DEPTH_RANGE = 0,
+	UNIFORM_MESH_MODELVIEW,
+	UNIFORM_MESH_MODELVIEW_PROJECTION,
+	UNIFORM_PREVIEW_LAYER,
+	UNIFORM_LIGHTFIELD_RESOLUTION,
+	UNIFORM_LIGHTFIELD_LEVEL_COUNT,
+	UNIFORM_LIGHTFIELD_TILE_SIZE,
+	UNIFORM_LIGHTFIELD_TILES_PER_ROW,
+	UNIFORM_LIGHTFIELD_LEVEL_OFFSETS,
+	UNIFORM_LIGHTFIELD_VIEW_COUNT,
+	UNIFORM_COUNT,
+
+	// members of the Frame block
+	FRAME_MODELVIEW_PROJECTION = 0,
+	FRAME_BILLBOARD_AXIS,
+	FRAME_CAM_POS,
+	FRAME_VIEW_PROJECTION,
+	FRAME_EYE_POSITION,
+	FRAME_COUNT
 };
 
 // OpenGL objects
@@ -78,8 +118,78 @@ GLuint *textures     = NULL;
 GLuint *samplers     = NULL;
 GLuint *programs     = NULL;
 
+// uniforms, resolved once the programs are linked
+GLint uniformLocations[UNIFORM_COUNT];
+GLint frameOffsets[FRAME_COUNT];  // in the Frame block, -1 if inactive
+std::vector<GLubyte> frameData;   // Frame block of the current frame
+fw::UniformRing frameRing;
+
 GLsizei lightfieldResolution = 256;
 GLsizei viewN = 9;
+GLfloat texelDensity = 0.0f; // texels per unit, if > 0 sets the resolution
+GLenum mipmapFilter = fw::MIPMAP_FILTER_BOX;
+GLint lightfieldFormat = lf::FORMAT_RGBA8;
+GLint normalEncoding = lf::NORMAL_SPHERICAL;
+GLint compressionQuality = fw::BC_QUALITY_NORMAL;
+GLint sparseTileSize = 0; // tile size of the sparse RGBA8 atlas, 0 for dense
+GLint dedupMaxError = -1; // tile merge threshold of the sparse atlas, < 0 off
+const std::string lightfieldCache = "models/Stone_Forest_1.lfa";
+const std::string programCache = "programs"; // binaries of the GLSL programs
+const GLint checkpointLayers = 16; // GPU bake layers between checkpoints
+GLint progressiveViewN = 0; // viewN of the coarse atlas drawn first, 0 off
+// resolution of the coarse atlas: fixed, so that the time to the first
+// frame does not grow with the final resolution
+const GLsizei progressiveResolution = 64;
+std::vector<std::string> assetFiles; // OBJ files of the multi-asset atlas
+std::vector<GLuint> pageTextures;    // texture array of each page
+std::vector<GLint> pageAssets;       // first asset of each page, asset count
+std::vector<lf::Instance> instances; // billboards of the assets
+GLint benchInstanceCount = 0; // instances of the benchmark scene
+GLint benchFrames = 0;        // frames of the benchmark, 0 to run the viewer
+GLint benchFrame = 0;
+GLdouble benchFillTime  = 0.0; // CPU time of the instance buffer fills (s)
+GLdouble benchFrameTime = 0.0; // time to render the impostors (s)
+GLdouble benchDrawnCount = 0.0;
+GLfloat maxDistance = 500.0f;       // instances further away are culled
+std::vector<lf::CullAsset> cullAssets;
+lf::Bvh instanceBvh;                // hierarchy of the (static) instances
+std::vector<GLubyte> instanceLods;  // lf::LOD_* flags of each instance
+lf::CullOutput culled;              // visible instances of the frame
+lf::Mesh mesh; // CPU copy of the mesh
+// full atlas baked in the background in progressive mode, with its own
+// copy of the mesh and of the settings so that it does not read globals
+// (on_clean cancels it and waits for it before they are destroyed)
+struct LightfieldRefinement {
+	LightfieldRefinement() : hostMesh("refinement mesh") {}
+	lf::Mesh mesh;
+	fw::HostResource hostMesh;
+	std::string cache;
+	GLint viewN;
+	GLsizei resolution;
+	GLint normals;
+	GLenum mipmapFilter;
+	GLint format;
+	GLint quality;
+	volatile GLint cancel; // set to stop between two bake batches
+	lf::Atlas atlas;
+	std::string error; // empty if baked
+};
+fw::BackgroundTask refineTask;
+LightfieldRefinement *refinement = NULL; // in flight
+std::string traceFile;   // Chrome trace written on exit, empty for none
+fw::GpuProfiler gpuProfiler;
+fw::TimeStats frameStats; // time between two frames
+fw::TimeStats cpuStats;   // CPU time of a frame, without the swap
+GLint statsWindow = 240;  // frames of the statistics
+std::ofstream statsStream;     // periodic dump of the statistics, if open
+const GLdouble statsPeriod = 5.0; // seconds between two dumps
+std::vector<lf::CameraKey> cameraPath; // of the benchmark, empty for the mouse
+GLint pathFrames = 0;              // frames along the camera path
+GLint pathFrame  = 0;
+std::string pathName = "sweep";    // path file, or sweep
+std::string pathReport;            // JSON report of the benchmark
+std::vector<GLdouble> pathCpuTimes; // CPU time of each frame (s)
+std::vector<GLuint> pathQueries;    // GPU time of each frame
 GLint layer = viewN*(viewN+1);
 GLfloat theta = 0.001f; // camera polar angle
 GLfloat phi   = 0; // camera azimuthal angle
@@ -91,6 +201,21 @@ GLfloat deltaTicks = 0.0f;
 
 #ifdef _ANT_ENABLE
 GLfloat speed = 0.0f; // app speed (in ms)
+// frame statistics (in ms) and histogram shown in the menu
+enum {
+	STAT_MIN = 0,
+	STAT_MEAN,
+	STAT_P50,
+	STAT_P95,
+	STAT_P99,
+	STAT_MAX,
+	STAT_JITTER,
+	STAT_COUNT
+};
+GLfloat frameStatValues[STAT_COUNT];
+std::vector<GLint> frameHistogram;
+// live and peak memory (in MiB) of the GL objects and of the host
+GLfloat memoryValues[4];
 #endif
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -100,50 +225,22 @@ GLfloat speed = 0.0f; // app speed (in ms)
 
 void obj_buffer_data(const std::string& filename) {
 	fw::DrawElementsIndirectCommand command;
-	GLMmodel *model = glmReadOBJ(filename.c_str());
-	if(model == NULL)
-		throw(std::runtime_error("failed to load OBJ model"));
-	glmUnitize(model); // unit scale
-	glmScale(model, 0.5f); // really unit scale
-
-	// GL model
-	std::vector<GLfloat>     vertices(model->numvertices*6*2,0.0f);
-	std::vector<uint16_t>    indexes(model->numtriangles*3,0);
-	std::map<uint32_t, uint16_t>  indexMap;
-	vertices.resize(0);
-	indexes.resize(0);
-	uint16_t nextIndex = 0u;
-	// convert to GL batch ready mesh
-	for(uint16_t i = 0u; i<model->numtriangles; ++i) {
-		uint32_t vertex;
-		uint32_t normal;
-		std::map<uint32_t, uint16_t>::const_iterator it;
-
-		for(uint8_t j = 0; j < 3u; ++j) {
-			vertex = model->triangles[i].vindices[j];
-			normal = model->triangles[i].nindices[j];
-			it = indexMap.find(vertex + model->numvertices * normal);
-
-			if(it != indexMap.end()) {
-				indexes.push_back((*it).second);
-			}
-			else {
-				indexMap[vertex + model->numvertices * normal] = nextIndex;
-				indexes.push_back(nextIndex);
-
-				vertices.push_back(model->vertices[vertex*3u]);
-				vertices.push_back(model->vertices[vertex*3u+1u]);
-				vertices.push_back(model->vertices[vertex*3u+2u]);
-		
-				vertices.push_back(model->normals[normal*3u]);
-				vertices.push_back(model->normals[normal*3u+1u]);
-				vertices.push_back(model->normals[normal*3u+2u]);
-
-				++nextIndex;
-			}
-		}
+	static fw::HostResource hostMesh("mesh"); // of the global copy
+	lf::load_mesh(filename, mesh);
+	hostMesh.SetBytes(lf::mesh_bytes(mesh));
+
+	// GL model (interleaved positions and normals)
+	std::vector<GLfloat> vertices;
+	vertices.reserve(mesh.positions.size()*6);
+	for(size_t i = 0; i<mesh.positions.size(); ++i) {
+		vertices.push_back(mesh.positions[i][0]);
+		vertices.push_back(mesh.positions[i][1]);
+		vertices.push_back(mesh.positions[i][2]);
+		vertices.push_back(mesh.normals[i][0]);
+		vertices.push_back(mesh.normals[i][1]);
+		vertices.push_back(mesh.normals[i][2]);
 	}
-	glmDelete(model);
+	const std::vector<GLuint>& indexes = mesh.indexes;
 
 	// set indirect drawing command
 	command.count = indexes.size();
@@ -157,7 +254,7 @@ void obj_buffer_data(const std::string& filename) {
 		         &vertices[0],
 		         GL_STATIC_DRAW);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-		         sizeof(GLushort)*indexes.size(),
+		         sizeof(GLuint)*indexes.size(),
 		         &indexes[0],
 		         GL_STATIC_DRAW);
 	glBufferData(GL_DRAW_INDIRECT_BUFFER,
@@ -175,42 +272,65 @@ void load_mesh() {
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	fw::track_buffer(buffers[BUFFER_MESH_VERTICES], "mesh");
+	fw::track_buffer(buffers[BUFFER_MESH_INDEXES], "mesh");
+	fw::track_buffer(buffers[BUFFER_MESH_DRAW], "mesh");
+}
+
+
+// bytes of the levels of an atlas (or of a page)
+GLuint64 level_bytes(const std::vector< std::vector<GLubyte> >& levels) {
+	GLuint64 bytes = 0;
+	for(size_t i=0; i<levels.size(); ++i)
+		bytes+= levels[i].size();
+	return bytes;
 }
 
 void draw_mesh() {
 	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers[BUFFER_MESH_DRAW]);
 	glBindVertexArray(vertexArrays[VERTEX_ARRAY_MESH]);
 	glUseProgram(programs[PROGRAM_MESH]);
-		glDrawElementsIndirect(GL_TRIANGLES,GL_UNSIGNED_SHORT,0);
+		glDrawElementsIndirect(GL_TRIANGLES,GL_UNSIGNED_INT,0);
 	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
 }
 
 
-void build_lighfield() {
-	GLuint framebuffer, renderbuffer;
+void build_lighfield(lf::AtlasCheckpoint& checkpoint, lf::Atlas& atlas) {
+	GLuint framebuffer, renderbuffer, texture;
 	GLint n = viewN;
-	GLint total = 2*n*(n+1)+1;
-	GLint current = 0;
-	std::vector<Vector4> axis(total*3); // alignment for std140
-	axis.resize(0);
+	GLint total = lf::view_count(n);
+
+	atlas.viewN        = n;
+	atlas.resolution   = lightfieldResolution;
+	atlas.format       = lf::FORMAT_RGBA8;
+	atlas.normals      = normalEncoding;
+	atlas.mipmapFilter = mipmapFilter;
+	atlas.meshHash     = lf::mesh_hash(mesh);
+	lf::build_views(n, mesh.positions, atlas.views);
+
+	// resume from the layers of an interrupted bake
+	GLint completedCnt = lf::open_checkpoint(checkpoint.filename,
+	                                         lf::BAKER_GPU,
+	                                         atlas,
+	                                         checkpoint);
+	if(completedCnt > 0)
+		std::cout << "lightfield: resuming, " << completedCnt << '/' << total
+		          << " layers done" << std::endl;
+	std::vector<GLint> batch;
 
 	glGenFramebuffers(1, &framebuffer);
 	glGenRenderbuffers(1, &renderbuffer);
+	glGenTextures(1, &texture);
 
+	// bake the base level in a temporary RGBA8 array
 	glActiveTexture(GL_TEXTURE0+TEXTURE_LIGHFIELD);
-	std::vector<GLubyte> pixels(4*total*lightfieldResolution*lightfieldResolution, 0);
-	glBindTexture(GL_TEXTURE_2D_ARRAY, textures[TEXTURE_LIGHFIELD]);
-		glTexImage3D(GL_TEXTURE_2D_ARRAY, 
-		             0,
-		             GL_RGBA8,
-		             lightfieldResolution,
-		             lightfieldResolution,
-		             total,
-		             0,
-		             GL_RGBA,
-		             GL_UNSIGNED_BYTE,
-		             &pixels[0]);
-	pixels.clear();
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glTexStorage3D(GL_TEXTURE_2D_ARRAY,
+		               1,
+		               GL_RGBA8,
+		               lightfieldResolution,
+		               lightfieldResolution,
+		               total);
 
 	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffer);
 	glRenderbufferStorage(GL_RENDERBUFFER,
@@ -218,6 +338,8 @@ void build_lighfield() {
 	                      lightfieldResolution,
 	                      lightfieldResolution);
 	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	fw::track_texture(GL_TEXTURE_2D_ARRAY, texture, "bake");
+	fw::track_renderbuffer(renderbuffer, "bake");
 
 	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
 		glFramebufferRenderbuffer(GL_FRAMEBUFFER,
@@ -231,83 +353,694 @@ void build_lighfield() {
 	// single depth renderbuffer attachment.
 
 	glViewport(0,0,lightfieldResolution,lightfieldResolution);
-	for(GLint i=-n; i<=n; ++i)
-		for(GLint j=-n+abs(i);j<=n-abs(i);++j) {
-			GLfloat x = (i + j) / float(n);
-			GLfloat y = (j - i) / float(n);
-			GLfloat angle = (90.0f - std::max(fabs(x),fabs(y)) * 90.0f)*PI/180.0f;
-			GLfloat alpha = x == 0.0f && y == 0.0f ? 0.0f 
-				: atan2(y, x);
-
-			// compute mvp
-			Matrix4x4 rotation = /*Matrix4x4::RotationAboutX(PI*0.5f)
-			                   * */Matrix4x4::RotationAboutX(-angle);
-			Matrix4x4 mv  = rotation.Inverse()
-			              * Matrix4x4::RotationAboutY(-alpha);
-			Matrix4x4 mvp = Matrix4x4::Ortho(-SQRT_2*0.5f,
-			                                  SQRT_2*0.5f,
-			                                 -SQRT_2*0.5f,
-			                                  SQRT_2*0.5f,
-			                                 -SQRT_2*0.5f,
-			                                  SQRT_2*0.5f)
-			              * mv;
-
-			// add local frame (transpose of rotation)
-			#if 1
-			axis.push_back(Vector4(mv[0][0],mv[0][1],mv[0][2],0));
-			axis.push_back(Vector4(mv[1][0],mv[1][1],mv[1][2],0));
-			axis.push_back(Vector4(mv[2][0],mv[2][1],mv[2][2],0));
-			#else
-			axis.push_back(Vector4(1,0,0,1));
-			axis.push_back(Vector4(0,1,0,1));
-			axis.push_back(Vector4(0,0,1,1));
-			#endif
-
-			// set uniforms
-			glProgramUniform1i(programs[PROGRAM_MESH],
-				glGetUniformLocation(programs[PROGRAM_MESH],
-				                     "uLayer"),
-				                     current);
-			glProgramUniformMatrix4fv(programs[PROGRAM_MESH],
-				glGetUniformLocation(programs[PROGRAM_MESH],
-				                     "uModelView"),
-				                     1, 
-				                     GL_FALSE,
-				                     reinterpret_cast<const GLfloat*>
-				                     (&mv));
-			glProgramUniformMatrix4fv(programs[PROGRAM_MESH],
-				glGetUniformLocation(programs[PROGRAM_MESH],
-				                     "uModelViewProjection"),
-				                     1, 
-				                     GL_FALSE,
-				                     reinterpret_cast<const GLfloat*>
-				                     (&mvp));
-
-			glFramebufferTextureLayer(GL_FRAMEBUFFER,
-		                              GL_COLOR_ATTACHMENT0,
-		                              textures[TEXTURE_LIGHFIELD],
-		                              0,
-		                              current);
-	fw::check_framebuffer_status();
-
-			glClear(GL_DEPTH_BUFFER_BIT);
-			draw_mesh();
-
-			++current;
+	for(GLint current=0; current<total; ++current) {
+		if(checkpoint.completed[current])
+			continue;
+		const lf::View& view = atlas.views[current];
+		Matrix4x4 mv  = lf::view_matrix(view);
+		Matrix4x4 mvp = lf::view_projection(view);
+
+		// set uniforms
+		glProgramUniform2f(programs[PROGRAM_MESH],
+		                   uniformLocations[UNIFORM_MESH_DEPTH_RANGE],
+		                   view.depth[0],
+		                   view.depth[1]);
+		glProgramUniformMatrix4fv(programs[PROGRAM_MESH],
+		                          uniformLocations[UNIFORM_MESH_MODELVIEW],
+		                          1,
+		                          GL_FALSE,
+		                          reinterpret_cast<const GLfloat*>
+		                          (&mv));
+		glProgramUniformMatrix4fv(programs[PROGRAM_MESH],
+		                          uniformLocations
+		                          [UNIFORM_MESH_MODELVIEW_PROJECTION],
+		                          1,
+		                          GL_FALSE,
+		                          reinterpret_cast<const GLfloat*>
+		                          (&mvp));
+
+		glFramebufferTextureLayer(GL_FRAMEBUFFER,
+		                          GL_COLOR_ATTACHMENT0,
+		                          texture,
+		                          0,
+		                          current);
+		fw::check_framebuffer_status();
+
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		draw_mesh();
+
+		// read the layer back and checkpoint every few layers
+		glReadPixels(0,
+		             0,
+		             lightfieldResolution,
+		             lightfieldResolution,
+		             GL_RGBA,
+		             GL_UNSIGNED_BYTE,
+		             &atlas.levels[0][size_t(4)*current*lightfieldResolution
+		                                    *lightfieldResolution]);
+		batch.push_back(current);
+		if(GLint(batch.size()) == checkpointLayers) {
+			lf::write_checkpoint(checkpoint, atlas, batch);
+			batch.clear();
 		}
+	}
+	if(!batch.empty())
+		lf::write_checkpoint(checkpoint, atlas, batch);
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+	// build the mip chain on the CPU (alpha weighted, so that depth and
+	// normals do not bleed into empty texels)
+	fw::build_mipmaps(lightfieldResolution,
+	                  lightfieldResolution,
+	                  total,
+	                  GL_RGBA,
+	                  GL_UNSIGNED_BYTE,
+	                  mipmapFilter,
+	                  GL_TRUE,
+	                  atlas.levels);
+
+	fw::untrack_resource(fw::RESOURCE_RENDERBUFFER, renderbuffer);
+	fw::untrack_resource(fw::RESOURCE_TEXTURE, texture);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteRenderbuffers(1, &renderbuffer);
+	glDeleteTextures(1, &texture);
+}
+
+
+bool multi_asset() {
+	return !assetFiles.empty();
+}
+
+
+bool sparse_lightfield() {
+	return sparseTileSize > 0
+	    && lightfieldFormat == lf::FORMAT_RGBA8
+	    && !multi_asset();
+}
+
+
+// check if a cached atlas was baked from atlasMesh with the current
+// settings
+bool atlas_is_current(const lf::Atlas& atlas, const lf::Mesh& atlasMesh) {
+	return !atlas.levels.empty()
+	    && atlas.viewN == viewN
+	    && atlas.resolution == lightfieldResolution
+	    && atlas.format == lightfieldFormat
+	    && atlas.normals == normalEncoding
+	    && atlas.mipmapFilter == mipmapFilter
+	    && (atlas.format == lf::FORMAT_RGBA8
+	        || atlas.quality == compressionQuality)
+	    && atlas.meshHash == lf::mesh_hash(atlasMesh);
+}
+
+
+// Replace a texture by a new object, so that its immutable storage can be
+// allocated again
+void renew_texture(GLint texture) {
+	fw::untrack_resource(fw::RESOURCE_TEXTURE, textures[texture]);
+	glDeleteTextures(1, &textures[texture]);
+	glGenTextures(1, &textures[texture]);
+}
+
+
+// Upload an atlas and its views as the lightfield of the viewer
+void upload_lightfield(const lf::Atlas& atlas) {
+	if(sparse_lightfield()) {
+		lf::SparseAtlas sparse;
+		fw::HostResource hostSparse("lightfield tiles");
+		lf::build_sparse_atlas(atlas, sparseTileSize, sparse);
+		renew_texture(TEXTURE_LIGHFIELD_TILES);
+		if(dedupMaxError >= 0) {
+			GLint tileCnt = sparse.tileCnt;
+			lf::dedup_sparse_atlas(sparse, dedupMaxError);
+			std::cout << "lightfield tiles: " << sparse.tileCnt << " / "
+			          << tileCnt << " after dedup" << std::endl;
+		}
+		glActiveTexture(GL_TEXTURE0+TEXTURE_LIGHFIELD_TILES);
+		glBindTexture(GL_TEXTURE_2D, textures[TEXTURE_LIGHFIELD_TILES]);
+		glBindBuffer(GL_TEXTURE_BUFFER,
+		             buffers[BUFFER_LIGHTFIELD_INDIRECTION]);
+			lf::tex_sparse_atlas(sparse);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		glActiveTexture(GL_TEXTURE0+TEXTURE_LIGHFIELD_INDIRECTION);
+		glBindTexture(GL_TEXTURE_BUFFER,
+		              textures[TEXTURE_LIGHFIELD_INDIRECTION]);
+			glTexBuffer(GL_TEXTURE_BUFFER,
+			            GL_R32UI,
+			            buffers[BUFFER_LIGHTFIELD_INDIRECTION]);
+		hostSparse.SetBytes(sparse.tiles.size()
+		                    + sizeof(GLuint)*sparse.indirection.size());
+		fw::track_texture(GL_TEXTURE_2D,
+		                  textures[TEXTURE_LIGHFIELD_TILES],
+		                  "lightfield tiles");
+		fw::track_buffer(buffers[BUFFER_LIGHTFIELD_INDIRECTION],
+		                 "lightfield tiles");
+
+		const GLuint program = programs[PROGRAM_LIGHTFIELD];
+		glProgramUniform1i(program,
+			uniformLocations[UNIFORM_LIGHTFIELD_RESOLUTION],
+			               sparse.resolution);
+		glProgramUniform1i(program,
+			uniformLocations[UNIFORM_LIGHTFIELD_LEVEL_COUNT],
+			               sparse.levelCnt);
+		glProgramUniform1i(program,
+			uniformLocations[UNIFORM_LIGHTFIELD_TILE_SIZE],
+			               sparse.tileSize);
+		glProgramUniform1i(program,
+			uniformLocations[UNIFORM_LIGHTFIELD_TILES_PER_ROW],
+			               sparse.tilesPerRow);
+		glProgramUniform1iv(program,
+			uniformLocations[UNIFORM_LIGHTFIELD_LEVEL_OFFSETS],
+			                sparse.levelCnt,
+			                &sparse.levelOffsets[0]);
+	}
+	else {
+		renew_texture(TEXTURE_LIGHFIELD);
+		glActiveTexture(GL_TEXTURE0+TEXTURE_LIGHFIELD);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, textures[TEXTURE_LIGHFIELD]);
+			lf::tex_atlas(atlas);
+		fw::track_texture(GL_TEXTURE_2D_ARRAY,
+		                  textures[TEXTURE_LIGHFIELD],
+		                  "lightfield");
+	}
 
 	// upload matrices
 	glBindBuffer(GL_UNIFORM_BUFFER, buffers[BUFFER_LIGHTFIELD_AXIS]);
 		glBufferData(GL_UNIFORM_BUFFER,
-		             sizeof(Vector4)*axis.size(),
-		             &axis[0],
+		             sizeof(lf::View)*atlas.views.size(),
+		             &atlas.views[0],
 		             GL_STATIC_DRAW);
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	fw::track_buffer(buffers[BUFFER_LIGHTFIELD_AXIS], "views");
+	glProgramUniform1i(programs[PROGRAM_LIGHTFIELD],
+		uniformLocations[UNIFORM_LIGHTFIELD_VIEW_COUNT],
+		               atlas.viewN);
+}
 
-	glDeleteFramebuffers(1, &framebuffer);
-	glDeleteRenderbuffers(1, &renderbuffer);
+
+// Bake, compress and save the full atlas (checkpointed, so that it
+// resumes if the viewer exits before the end)
+GLvoid refine_lightfield(GLvoid *data) {
+	FW_PROFILE_SCOPE("refine_lightfield");
+	LightfieldRefinement& task = *reinterpret_cast<LightfieldRefinement*>(data);
+	try {
+		lf::AtlasCheckpoint checkpoint;
+		checkpoint.filename = lf::checkpoint_file(task.cache);
+		lf::bake_atlas(task.mesh,
+		               task.viewN,
+		               task.resolution,
+		               task.normals,
+		               task.mipmapFilter,
+		               checkpoint.filename,
+		               &task.cancel,
+		               task.atlas);
+		lf::compress_atlas(task.atlas, task.format, task.quality);
+		lf::save_atlas(task.atlas, task.cache);
+		lf::remove_checkpoint(checkpoint);
+	}
+	catch(std::exception& e) {
+		task.error = e.what();
+	}
+}
+
+
+// Draw a coarse atlas, baked at once on the CPU, while the full one is
+// baked in the background
+void start_refinement() {
+	FW_PROFILE_SCOPE("coarse_lightfield");
+	lf::Atlas coarse;
+	GLsizei coarseResolution = std::min(progressiveResolution,
+	                                    lightfieldResolution);
+	lf::bake_atlas(mesh,
+	               std::min(progressiveViewN, GLint(viewN)),
+	               coarseResolution,
+	               normalEncoding,
+	               mipmapFilter,
+	               coarse);
+	lf::compress_atlas(coarse, lightfieldFormat, fw::BC_QUALITY_FAST);
+	upload_lightfield(coarse);
+
+	refinement = new LightfieldRefinement;
+	refinement->mesh         = mesh;
+	refinement->hostMesh.SetBytes(lf::mesh_bytes(mesh));
+	refinement->cache        = lightfieldCache;
+	refinement->cancel       = 0;
+	refinement->viewN        = viewN;
+	refinement->resolution   = lightfieldResolution;
+	refinement->normals      = normalEncoding;
+	refinement->mipmapFilter = mipmapFilter;
+	refinement->format       = lightfieldFormat;
+	refinement->quality      = compressionQuality;
+	refineTask.Start(&refine_lightfield, refinement);
+	std::cout << "lightfield: drawing viewN " << coarse.viewN << " at "
+	          << coarseResolution << "^2, refining" << std::endl;
+}
+
+
+// Swap the full atlas in once it is baked, before the draws of a frame
+void update_lightfield() {
+	if(refinement == NULL || !refineTask.Done())
+		return;
+	if(refinement->error.empty()) {
+		fw::HostResource hostAtlas("lightfield atlas");
+		hostAtlas.SetBytes(level_bytes(refinement->atlas.levels));
+		upload_lightfield(refinement->atlas);
+		std::cout << "lightfield: refined" << std::endl;
+	}
+	else
+		std::cerr << "lightfield: refinement failed: "
+		          << refinement->error << std::endl;
+	delete refinement;
+	refinement = NULL;
+}
+
+
+void load_lightfield() {
+	lf::Atlas atlas;
+	fw::HostResource hostAtlas("lightfield atlas");
+
+	// pick the smallest resolution meeting the target texel density
+	if(texelDensity > 0.0f) {
+		std::vector<lf::View> views;
+		lf::build_views(viewN, mesh.positions, views);
+		GLsizei fixedResolution = GLsizei(ceil(SQRT_2*texelDensity));
+		lightfieldResolution = lf::fit_resolution(views, texelDensity);
+		std::cout << "lightfield resolution: " << lightfieldResolution
+		          << " (fixed bounds: " << fixedResolution << ", "
+		          << 100.0f * lightfieldResolution * lightfieldResolution
+		                    / (fixedResolution * fixedResolution)
+		          << "% of the texels)" << std::endl;
+	}
+
+	// reuse the cache if it was baked with the current settings
+	try {
+		lf::load_atlas(atlas, lightfieldCache);
+	}
+	catch(fw::FWException& e) {
+		atlas.levels.clear();
+	}
+	const bool current = atlas_is_current(atlas, mesh);
+	if(!current && progressiveViewN > 0) {
+		start_refinement();
+		return;
+	}
+	if(!current) {
+		lf::AtlasCheckpoint checkpoint;
+		checkpoint.filename = lf::checkpoint_file(lightfieldCache);
+		build_lighfield(checkpoint, atlas);
+		hostAtlas.SetBytes(level_bytes(atlas.levels));
+		lf::compress_atlas(atlas, lightfieldFormat, compressionQuality);
+		lf::save_atlas(atlas, lightfieldCache);
+		lf::remove_checkpoint(checkpoint);
+	}
+	hostAtlas.SetBytes(level_bytes(atlas.levels));
+	upload_lightfield(atlas);
+}
+
+
+// cull the instances and upload the visible ones with their draws (the
+// buffers are orphaned, so that the draws of the previous frame do not
+// stall the upload)
+void fill_instances(const Matrix4x4& viewProjection, const Vector3& eye) {
+	FW_PROFILE_SCOPE("fill_instances");
+	lf::CullParameters parameters;
+	lf::frustum_planes(viewProjection, parameters.planes);
+	parameters.eye             = eye;
+	parameters.maxDistance     = maxDistance;
+	parameters.projectionScale = lf::projection_scale(FOVY,
+	                                                  lightfieldResolution);
+	parameters.lodSize         = FLT_MAX; // no mesh LOD in the viewer
+	parameters.hysteresis      = 0.1f;
+	lf::cull_bvh(instanceBvh, instances, cullAssets, parameters,
+	             instanceLods, culled);
+
+	const std::vector<lf::Instance>& impostors = culled.impostors;
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[BUFFER_ASSET_INSTANCES]);
+		glBufferData(GL_ARRAY_BUFFER,
+		             sizeof(lf::Instance)*impostors.size(),
+		             NULL,
+		             GL_STREAM_DRAW);
+		if(!impostors.empty())
+			glBufferSubData(GL_ARRAY_BUFFER,
+			                0,
+			                sizeof(lf::Instance)*impostors.size(),
+			                &impostors[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers[BUFFER_ASSET_DRAWS]);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER,
+		             sizeof(fw::DrawArraysIndirectCommand)
+		             * culled.impostorDraws.size(),
+		             &culled.impostorDraws[0],
+		             GL_STREAM_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	fw::track_resource(fw::RESOURCE_BUFFER,
+	                   buffers[BUFFER_ASSET_INSTANCES],
+	                   sizeof(lf::Instance)*impostors.size(),
+	                   0, 0, "instances");
+	fw::track_resource(fw::RESOURCE_BUFFER,
+	                   buffers[BUFFER_ASSET_DRAWS],
+	                   sizeof(fw::DrawArraysIndirectCommand)
+	                   * culled.impostorDraws.size(),
+	                   0, 0, "instances");
+}
+
+
+void load_assets() {
+	FW_PROFILE_SCOPE("load_assets");
+	lf::MultiAtlas multi;
+	fw::HostResource hostAtlases("asset atlases");
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &multi.maxLayers);
+
+	// load or bake each asset (on the CPU), next to its OBJ file
+	for(size_t i=0; i<assetFiles.size(); ++i) {
+		const std::string& file = assetFiles[i];
+		const std::string cache = lf::cache_file(file);
+		lf::Atlas atlas;
+		lf::Mesh assetMesh;
+		fw::HostResource hostMesh("asset mesh");
+		lf::load_mesh(file, assetMesh);
+		hostMesh.SetBytes(lf::mesh_bytes(assetMesh));
+		try {
+			lf::load_atlas(atlas, cache);
+		}
+		catch(fw::FWException& e) {
+			atlas.levels.clear();
+		}
+		if(!atlas_is_current(atlas, assetMesh)) {
+			lf::AtlasCheckpoint checkpoint;
+			checkpoint.filename = lf::checkpoint_file(cache);
+			lf::bake_atlas(assetMesh,
+			               viewN,
+			               lightfieldResolution,
+			               normalEncoding,
+			               mipmapFilter,
+			               checkpoint.filename,
+			               NULL,
+			               atlas);
+			lf::compress_atlas(atlas, lightfieldFormat, compressionQuality);
+			lf::save_atlas(atlas, cache);
+			lf::remove_checkpoint(checkpoint);
+		}
+		lf::add_atlas(multi, atlas);
+		// the layers of the asset take as much memory in its page
+		std::cout << "asset " << file << ": "
+		          << level_bytes(atlas.levels)/1024 << " KiB" << std::endl;
+		GLuint64 bytes = 0;
+		for(size_t j=0; j<multi.pages.size(); ++j)
+			bytes+= level_bytes(multi.pages[j]);
+		hostAtlases.SetBytes(bytes);
+	}
+
+	// upload the pages
+	pageTextures.resize(multi.pages.size());
+	glGenTextures(GLsizei(pageTextures.size()), &pageTextures[0]);
+	glActiveTexture(GL_TEXTURE0+TEXTURE_LIGHFIELD);
+	for(size_t i=0; i<pageTextures.size(); ++i) {
+		glBindTexture(GL_TEXTURE_2D_ARRAY, pageTextures[i]);
+			lf::tex_multi_atlas(multi, GLint(i));
+		fw::track_texture(GL_TEXTURE_2D_ARRAY, pageTextures[i], "asset pages");
+	}
+	pageAssets.clear();
+	for(size_t i=0; i<multi.assets.size(); ++i)
+		if(i == 0 || multi.assets[i].page != multi.assets[i-1].page)
+			pageAssets.push_back(GLint(i));
+	pageAssets.push_back(GLint(multi.assets.size()));
+	std::cout << "assets: " << multi.assets.size() << " in "
+	          << pageTextures.size() << " page(s)" << std::endl;
+
+	// instances: a gallery of the assets, or the benchmark scene
+	GLint assetCnt = GLint(multi.assets.size());
+	if(benchInstanceCount > 0) {
+		GLfloat extent = 0.5f*sqrt(GLfloat(benchInstanceCount));
+		lf::scatter_instances(benchInstanceCount, assetCnt, extent, 1u,
+		                      instances);
+	}
+	else {
+		GLint gridSize = GLint(ceil(sqrt(GLfloat(assetCnt))));
+		instances.resize(assetCnt);
+		for(GLint i=0; i<assetCnt; ++i) {
+			instances[i].position = Vector3(2.0f*(i%gridSize)-gridSize+1,
+			                                0.0f,
+			                                2.0f*(i/gridSize)-gridSize+1);
+			instances[i].scale    = 1.0f;
+			instances[i].rotation = 0.0f;
+			instances[i].asset    = i;
+		}
+	}
+	cullAssets.resize(assetCnt);
+	for(GLint i=0; i<assetCnt; ++i) {
+		cullAssets[i].bounds     = multi.assets[i].bounds;
+		cullAssets[i].indexCount = 0; // impostors only
+		cullAssets[i].firstIndex = 0;
+		cullAssets[i].baseVertex = 0;
+	}
+	// the instances are static, the hierarchy is built once (and sorts them)
+	lf::build_bvh(instances, cullAssets, instanceBvh);
+	instanceLods.clear();
+	fw::track_resource(fw::RESOURCE_HOST,
+	                   reinterpret_cast<size_t>(&instances),
+	                   sizeof(lf::Instance)*instances.size()
+	                   + sizeof(lf::BvhNode)*instanceBvh.nodes.size()
+	                   + sizeof(GLint)*instanceBvh.indexes.size()
+	                   + sizeof(GLfloat)*instanceBvh.radii.size(),
+	                   0, 0, "instances");
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[BUFFER_ASSET_INSTANCES]);
+	glBindVertexArray(vertexArrays[VERTEX_ARRAY_LIGHFIELD]);
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+		glEnableVertexAttribArray(2);
+		glVertexAttribIPointer(0,1,GL_INT,sizeof(lf::Instance),
+		                       FW_BUFFER_OFFSET(20));
+		glVertexAttribPointer(1,4,GL_FLOAT,0,sizeof(lf::Instance),0);
+		glVertexAttribPointer(2,1,GL_FLOAT,0,sizeof(lf::Instance),
+		                      FW_BUFFER_OFFSET(16));
+		glVertexAttribDivisor(0,1);
+		glVertexAttribDivisor(1,1);
+		glVertexAttribDivisor(2,1);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// upload the asset records and the view table
+	glBindBuffer(GL_UNIFORM_BUFFER, buffers[BUFFER_ASSET_RECORDS]);
+		glBufferData(GL_UNIFORM_BUFFER,
+		             sizeof(lf::AssetRecord)*multi.assets.size(),
+		             &multi.assets[0],
+		             GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[BUFFER_LIGHTFIELD_AXIS]);
+		glBufferData(GL_TEXTURE_BUFFER,
+		             sizeof(lf::View)*multi.views.size(),
+		             &multi.views[0],
+		             GL_STATIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0+TEXTURE_ASSET_VIEWS);
+	glBindTexture(GL_TEXTURE_BUFFER, textures[TEXTURE_ASSET_VIEWS]);
+		glTexBuffer(GL_TEXTURE_BUFFER,
+		            GL_RGBA32F,
+		            buffers[BUFFER_LIGHTFIELD_AXIS]);
+	fw::track_buffer(buffers[BUFFER_ASSET_RECORDS], "asset records");
+	fw::track_buffer(buffers[BUFFER_LIGHTFIELD_AXIS], "views");
+}
+
+
+// draw the billboards of all the assets: one multi draw per page
+void draw_assets() {
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers[BUFFER_ASSET_DRAWS]);
+	glActiveTexture(GL_TEXTURE0+TEXTURE_LIGHFIELD);
+	for(size_t i=0; i<pageTextures.size(); ++i) {
+		const GLint first = pageAssets[i];
+		const GLint count = pageAssets[i+1]-first;
+		const GLsizei stride = sizeof(fw::DrawArraysIndirectCommand);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, pageTextures[i]);
+		if(GLEW_ARB_multi_draw_indirect)
+			glMultiDrawArraysIndirect(GL_TRIANGLE_STRIP,
+			                          FW_BUFFER_OFFSET(first*stride),
+			                          count,
+			                          0);
+		else
+			for(GLint j=first; j<first+count; ++j)
+				glDrawArraysIndirect(GL_TRIANGLE_STRIP,
+				                     FW_BUFFER_OFFSET(j*stride));
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+
+// camera of a frame of the path benchmark
+lf::CameraKey path_camera(GLint frame) {
+	return lf::camera_on_path(cameraPath,
+	                          pathFrames > 1 ? GLfloat(frame)/(pathFrames-1)
+	                                         : 0.0f);
+}
+
+
+// direction from the object to the camera, as used by the impostor in
+// on_update (the billboard faces it whatever the radius)
+Vector3 camera_direction(const lf::CameraKey& camera) {
+	Affine objectAxis;
+	objectAxis.RotateAboutWorldX(PI*0.5f-camera.theta * PI / 180.0f);
+	objectAxis.RotateAboutWorldY(camera.phi * PI / 180.0f);
+	Matrix3x3 axis = objectAxis.GetUnitAxis();
+	return -Vector3(axis[2][0], axis[2][1], axis[2][2]);
+}
+
+
+// parse "<frames> <report> [path]" and build the camera path
+void parse_path_benchmark(int argc, char **argv) throw(fw::FWException) {
+	pathFrames = std::max(atoi(argv[2]), 1);
+	pathReport = argv[3];
+	if(argc > 4) {
+		pathName = argv[4];
+		lf::load_camera_path(pathName, cameraPath);
+	}
+	else
+		lf::sweep_camera_path(pathFrames, 1.5f, 4.0f, cameraPath);
+}
+
+
+// write the per-frame times (gpuTimes is empty if there is no GPU) and
+// their percentiles as JSON
+void write_path_report(const std::string& renderer,
+                       const std::vector<GLdouble>& cpuTimes,
+                       const std::vector<GLdouble>& gpuTimes) {
+	std::ofstream file(pathReport.c_str());
+	if(!file) {
+		std::cerr << "Cannot write " << pathReport << std::endl;
+		return;
+	}
+	fw::TimeStats cpu(GLint(cpuTimes.size()));
+	fw::TimeStats gpu(GLint(cpuTimes.size()));
+	for(size_t i=0; i<cpuTimes.size(); ++i) {
+		cpu.Add(cpuTimes[i]);
+		if(i < gpuTimes.size())
+			gpu.Add(gpuTimes[i]);
+	}
+	cpu.Update();
+	gpu.Update();
+
+	file << "{\"renderer\":\"" << renderer << "\",\"path\":\"";
+	for(size_t i=0; i<pathName.size(); ++i)
+		file << (pathName[i] == '"' || pathName[i] == '\\' ? "\\" : "")
+		     << pathName[i];
+	file << "\",\"frames\":" << cpuTimes.size()
+	     << ",\"resolution\":" << lightfieldResolution
+	     << ",\n\"cpu\":";
+	cpu.WriteJson(file);
+	file << ",\n\"gpu\":";
+	if(gpuTimes.empty())
+		file << "null";
+	else
+		gpu.WriteJson(file);
+	file << ",\n\"per_frame\":[";
+	for(size_t i=0; i<cpuTimes.size(); ++i) {
+		lf::CameraKey camera = path_camera(GLint(i));
+		file << (i ? ",\n" : "\n")
+		     << "{\"theta\":" << camera.theta
+		     << ",\"phi\":" << camera.phi
+		     << ",\"radius\":" << camera.radius
+		     << ",\"cpu_ms\":" << 1e3*cpuTimes[i] << ",\"gpu_ms\":";
+		if(i < gpuTimes.size())
+			file << 1e3*gpuTimes[i];
+		else
+			file << "null";
+		file << '}';
+	}
+	file << "]}\n";
+	std::cout << renderer << " benchmark, " << cpuTimes.size() << " frames:"
+	          << " cpu p50 " << 1e3*cpu.Percentile(50.0)
+	          << " p99 " << 1e3*cpu.Percentile(99.0) << " ms";
+	if(!gpuTimes.empty())
+		std::cout << ", gpu p50 " << 1e3*gpu.Percentile(50.0)
+		          << " p99 " << 1e3*gpu.Percentile(99.0) << " ms";
+	std::cout << " (" << pathReport << ")" << std::endl;
+}
+
+
+// path benchmark of the CPU impostor renderer (lf::render_impostor), for
+// machines without a GPU: the atlas is loaded from the cache, or baked on
+// the CPU
+void run_cpu_path_benchmark() throw(fw::FWException) {
+	lf::Atlas atlas;
+	lf::Mesh cpuMesh;
+	lf::load_mesh("models/Stone_Forest_1.obj", cpuMesh);
+	try {
+		lf::load_atlas(atlas, lightfieldCache);
+	}
+	catch(fw::FWException& e) {
+		atlas.levels.clear();
+	}
+	// a stale cache would time other settings (or another mesh)
+	if(!atlas_is_current(atlas, cpuMesh))
+		lf::bake_atlas(cpuMesh,
+		               viewN,
+		               lightfieldResolution,
+		               normalEncoding,
+		               mipmapFilter,
+		               atlas);
+	lf::decompress_atlas(atlas);
+
+	std::vector<GLdouble> cpuTimes(pathFrames);
+	std::vector<GLubyte> image;
+	for(GLint i=0; i<pathFrames; ++i) {
+		FW_PROFILE_SCOPE("render_impostor");
+		fw::Timer timer;
+		timer.Start();
+		lf::render_impostor(atlas,
+		                    camera_direction(path_camera(i)),
+		                    lightfieldResolution,
+		                    image);
+		timer.Stop();
+		cpuTimes[i] = timer.Ticks();
+	}
+	write_path_report("cpu", cpuTimes, std::vector<GLdouble>());
+}
+
+
+// let the swaps run as fast as possible
+void disable_vsync() {
+	bool disabled = false;
+#ifdef _WIN32
+	if(WGLEW_EXT_swap_control)
+		disabled = wglSwapIntervalEXT(0);
+#else
+	if(GLXEW_EXT_swap_control) {
+		glXSwapIntervalEXT(glXGetCurrentDisplay(), glXGetCurrentDrawable(), 0);
+		disabled = true;
+	}
+	else if(GLXEW_MESA_swap_control)
+		disabled = glXSwapIntervalMESA(0) == 0;
+#endif // _WIN32
+	if(!disabled)
+		std::cerr << "warning: vsync could not be disabled" << std::endl;
+}
+
+
+// benchmark scene: the camera circles above the instances, which spin so
+// that their buffer is filled on the CPU every frame. Returns the view
+// matrix of the frame.
+Matrix4x4 bench_update() {
+	for(size_t i=0; i<instances.size(); ++i)
+		instances[i].rotation+= 0.01f;
+
+	GLfloat extent = 0.5f*sqrt(GLfloat(benchInstanceCount));
+	GLfloat angle = 2.0f*PI*benchFrame/benchFrames;
+	Vector3 eye(0.5f*extent*cos(angle),
+	            0.1f*extent+2.0f,
+	            0.5f*extent*sin(angle));
+	return Matrix4x4::LookAt(eye, Vector3(0,0,0), Vector3(0,1,0));
+}
+
+
+void bench_report() {
+	const GLdouble frameMs = 1000.0*benchFrameTime/benchFrames;
+	const GLdouble drawn = benchDrawnCount/benchFrames;
+	std::cout << "instances: " << instances.size()
+	          << ", frames: " << benchFrames << "\n"
+	          << "  cpu (animation, culling, fill): "
+	          << 1000.0*benchFillTime/benchFrames << " ms/frame\n"
+	          << "  frame: " << frameMs << " ms, " << drawn
+	          << " impostors drawn (" << drawn/(frameMs*1e3)
+	          << " M impostors/s)" << std::endl;
 }
 
 
@@ -322,6 +1055,7 @@ static void TW_CALL toggle_fullscreen(void *data) {
 ////////////////////////////////////////////////////////////////////////////////
 // on init cb
 void on_init() {
+	FW_PROFILE_SCOPE("init");
 	// alloc names
 	buffers      = new GLuint[BUFFER_COUNT];
 	vertexArrays = new GLuint[VERTEX_ARRAY_COUNT];
@@ -330,6 +1064,11 @@ void on_init() {
 	programs     = new GLuint[PROGRAM_COUNT];
 
 	fw::init_debug_output(std::cout);
+	gpuProfiler.Init(64);
+	if(pathFrames > 0) {
+		pathQueries.resize(pathFrames);
+		glGenQueries(pathFrames, &pathQueries[0]);
+	}
 
 	// gen names
 	glGenBuffers(BUFFER_COUNT, buffers);
@@ -342,9 +1081,45 @@ void on_init() {
 	glEnable(GL_DEPTH_TEST);
 
 	// build programs
+	std::string normalOptions;
+	if(normalEncoding == lf::NORMAL_OCTAHEDRAL)
+		normalOptions = "#define OCTAHEDRAL_NORMALS\n";
+	std::string lightfieldOptions = normalOptions;
+	if(multi_asset()) {
+		std::stringstream assetCount;
+		assetCount << "#define MULTI_ASSET\n#define ASSETCNT "
+		           << assetFiles.size() << "\n";
+		lightfieldOptions+= assetCount.str();
+	}
+	else {
+		// the views are a uniform block, which may hold as little as 16 KiB
+		GLint maxBlockSize = 0;
+		glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &maxBlockSize);
+		const GLint viewCapacity = std::min(GLint(lf::MAX_VIEW_COUNT),
+		                                    GLint(maxBlockSize
+		                                          / sizeof(lf::View)));
+		if(lf::view_count(viewN) > viewCapacity) {
+			std::stringstream error;
+			error << "viewN " << viewN << " needs "
+			      << lf::view_count(viewN) << " views, the ViewAxis block "
+			      << "holds " << viewCapacity << " (GL_MAX_UNIFORM_BLOCK_SIZE "
+			      << maxBlockSize << ")";
+			throw std::runtime_error(error.str());
+		}
+		std::stringstream viewCount;
+		viewCount << "#define VIEWCNT " << viewCapacity << "\n";
+		lightfieldOptions+= viewCount.str();
+	}
+	if(lightfieldFormat == lf::FORMAT_BC5)
+		lightfieldOptions+= "#define SPLIT_LAYERS\n";
+	if(sparse_lightfield())
+		lightfieldOptions+= "#define SPARSE_TILES\n";
+	fw::Timer programTimer;
+	programTimer.Start();
+	fw::set_program_cache(programCache);
 	fw::build_glsl_program(programs[PROGRAM_MESH],
 	                       "mesh.glsl",
-	                       "",
+	                       normalOptions,
 	                       GL_TRUE);
 	fw::build_glsl_program(programs[PROGRAM_PREVIEW],
 	                       "preview.glsl",
@@ -352,25 +1127,79 @@ void on_init() {
 	                       GL_TRUE);
 	fw::build_glsl_program(programs[PROGRAM_LIGHTFIELD],
 	                       "lightfield.glsl",
-	                       "#define VIEWCNT 512",
+	                       lightfieldOptions,
 	                       GL_TRUE);
-
+	programTimer.Stop();
+	GLint cacheLoads = 0, cacheStores = 0;
+	fw::program_cache_stats(cacheLoads, cacheStores);
+	std::cout << "programs: " << 1000.0*programTimer.Ticks() << " ms ("
+	          << cacheLoads << " loaded from the cache, "
+	          << cacheStores << " stored)" << std::endl;
+
+	// resolve the uniforms
+	fw::ProgramReflection meshProgram(programs[PROGRAM_MESH]);
+	fw::ProgramReflection previewProgram(programs[PROGRAM_PREVIEW]);
+	fw::ProgramReflection lightfieldProgram(programs[PROGRAM_LIGHTFIELD]);
+	uniformLocations[UNIFORM_MESH_DEPTH_RANGE] =
+		meshProgram.UniformLocation("uDepthRange");
+	uniformLocations[UNIFORM_MESH_MODELVIEW] =
+		meshProgram.UniformLocation("uModelView");
+	uniformLocations[UNIFORM_MESH_MODELVIEW_PROJECTION] =
+		meshProgram.UniformLocation("uModelViewProjection");
+	uniformLocations[UNIFORM_PREVIEW_LAYER] =
+		previewProgram.UniformLocation("uLayer");
+	uniformLocations[UNIFORM_LIGHTFIELD_RESOLUTION] =
+		lightfieldProgram.UniformLocation("uResolution");
+	uniformLocations[UNIFORM_LIGHTFIELD_LEVEL_COUNT] =
+		lightfieldProgram.UniformLocation("uLevelCount");
+	uniformLocations[UNIFORM_LIGHTFIELD_TILE_SIZE] =
+		lightfieldProgram.UniformLocation("uTileSize");
+	uniformLocations[UNIFORM_LIGHTFIELD_TILES_PER_ROW] =
+		lightfieldProgram.UniformLocation("uTilesPerRow");
+	uniformLocations[UNIFORM_LIGHTFIELD_LEVEL_OFFSETS] =
+		lightfieldProgram.UniformLocation("uLevelOffsets");
+	uniformLocations[UNIFORM_LIGHTFIELD_VIEW_COUNT] =
+		lightfieldProgram.UniformLocation("uViewCount");
+	const char *frameMembers[FRAME_COUNT] = {"uModelViewProjection",
+	                                         "uBillboardAxis",
+	                                         "uCamPos",
+	                                         "uViewProjection",
+	                                         "uEyePosition"};
+	for(GLint i=0; i<FRAME_COUNT; ++i)
+		frameOffsets[i] = lightfieldProgram.UniformOffset(frameMembers[i]);
+	frameData.assign(lightfieldProgram.UniformBlockSize("Frame"), 0);
+	frameRing.Init(buffers[BUFFER_FRAME], GLsizeiptr(frameData.size()), 3);
+	fw::track_buffer(buffers[BUFFER_FRAME], "frame uniforms");
 	glUniformBlockBinding(programs[PROGRAM_LIGHTFIELD],
-	                      glGetUniformBlockIndex(programs[PROGRAM_LIGHTFIELD],
-	                                             "ViewAxis"),
-	                      BUFFER_LIGHTFIELD_AXIS);
+	                      lightfieldProgram.UniformBlockIndex("Frame"),
+	                      BUFFER_FRAME);
+
+	if(multi_asset())
+		glUniformBlockBinding(programs[PROGRAM_LIGHTFIELD],
+		                      lightfieldProgram.UniformBlockIndex("Assets"),
+		                      BUFFER_ASSET_RECORDS);
+	else
+		glUniformBlockBinding(programs[PROGRAM_LIGHTFIELD],
+		                      lightfieldProgram.UniformBlockIndex("ViewAxis"),
+		                      BUFFER_LIGHTFIELD_AXIS);
 
 	glProgramUniform1i(programs[PROGRAM_PREVIEW],
-		glGetUniformLocation(programs[PROGRAM_PREVIEW],
-		                     "sView"),
+		previewProgram.UniformLocation("sView"),
 		               TEXTURE_LIGHFIELD);
 	glProgramUniform1i(programs[PROGRAM_LIGHTFIELD],
-		glGetUniformLocation(programs[PROGRAM_LIGHTFIELD],
-		                     "sView"),
+		lightfieldProgram.UniformLocation("sView"),
 		               TEXTURE_LIGHFIELD);
 	glProgramUniform1i(programs[PROGRAM_LIGHTFIELD],
-		glGetUniformLocation(programs[PROGRAM_LIGHTFIELD],
-		                     "uViewCount"),
+		lightfieldProgram.UniformLocation("sTiles"),
+		               TEXTURE_LIGHFIELD_TILES);
+	glProgramUniform1i(programs[PROGRAM_LIGHTFIELD],
+		lightfieldProgram.UniformLocation("sIndirection"),
+		               TEXTURE_LIGHFIELD_INDIRECTION);
+	glProgramUniform1i(programs[PROGRAM_LIGHTFIELD],
+		lightfieldProgram.UniformLocation("sViewTable"),
+		               TEXTURE_ASSET_VIEWS);
+	glProgramUniform1i(programs[PROGRAM_LIGHTFIELD],
+		uniformLocations[UNIFORM_LIGHTFIELD_VIEW_COUNT],
 		               viewN);
 
 	// vertex arrays
@@ -384,12 +1213,19 @@ void on_init() {
 	glBindVertexArray(vertexArrays[VERTEX_ARRAY_LIGHFIELD]);
 	glBindVertexArray(0);
 
-	load_mesh();
-	build_lighfield();
-
-	glBindBufferBase(GL_UNIFORM_BUFFER,
-	                 BUFFER_LIGHTFIELD_AXIS,
-	                 buffers[BUFFER_LIGHTFIELD_AXIS]);
+	if(multi_asset()) {
+		load_assets();
+		glBindBufferBase(GL_UNIFORM_BUFFER,
+		                 BUFFER_ASSET_RECORDS,
+		                 buffers[BUFFER_ASSET_RECORDS]);
+	}
+	else {
+		load_mesh();
+		load_lightfield();
+		glBindBufferBase(GL_UNIFORM_BUFFER,
+		                 BUFFER_LIGHTFIELD_AXIS,
+		                 buffers[BUFFER_LIGHTFIELD_AXIS]);
+	}
 
 	glSamplerParameteri(samplers[SAMPLER_TRILINEAR],
 	                    GL_TEXTURE_MAG_FILTER,
@@ -408,7 +1244,21 @@ void on_init() {
 //	                     GL_TEXTURE_BORDER_COLOR,
 //	                     borderColour);
 
+	glSamplerParameteri(samplers[SAMPLER_BILINEAR],
+	                    GL_TEXTURE_MAG_FILTER,
+	                    GL_LINEAR);
+	glSamplerParameteri(samplers[SAMPLER_BILINEAR],
+	                    GL_TEXTURE_MIN_FILTER,
+	                    GL_LINEAR);
+	glSamplerParameteri(samplers[SAMPLER_BILINEAR],
+	                    GL_TEXTURE_WRAP_S,
+	                    GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(samplers[SAMPLER_BILINEAR],
+	                    GL_TEXTURE_WRAP_T,
+	                    GL_CLAMP_TO_EDGE);
+
 	glBindSampler(TEXTURE_LIGHFIELD, samplers[SAMPLER_TRILINEAR]);
+	glBindSampler(TEXTURE_LIGHFIELD_TILES, samplers[SAMPLER_BILINEAR]);
 
 #ifdef _ANT_ENABLE
 	// start ant
@@ -418,7 +1268,7 @@ void on_init() {
 
 	// Create a new bar
 	TwBar* menuBar = TwNewBar("menu");
-	TwDefine("menu size='200 170'");
+	TwDefine("menu size='200 400'");
 	TwDefine("menu position='0 0'");
 	TwDefine("menu alpha='255'");
 	TwDefine("menu valueswidth=85");
@@ -429,6 +1279,57 @@ void on_init() {
 	           &speed,
 	           "");
 
+	// frame statistics
+	const char *statNames[STAT_COUNT] = {"min (ms)",
+	                                     "mean (ms)",
+	                                     "p50 (ms)",
+	                                     "p95 (ms)",
+	                                     "p99 (ms)",
+	                                     "max (ms)",
+	                                     "jitter (ms)"};
+	for(GLint i=0; i<STAT_COUNT; ++i)
+		TwAddVarRO(menuBar,
+		           statNames[i],
+		           TW_TYPE_FLOAT,
+		           &frameStatValues[i],
+		           "group='frame time' precision=2");
+	TwAddVarRW(menuBar,
+	           "window (frames)",
+	           TW_TYPE_INT32,
+	           &statsWindow,
+	           "group='frame time' min=1 max=10000");
+	frameHistogram = frameStats.Histogram();
+	const GLint bucketMs = GLint(1e3*frameStats.BucketWidth());
+	for(size_t i=0; i<frameHistogram.size(); ++i) {
+		std::stringstream label;
+		label << bucketMs*i;
+		if(i+1 < frameHistogram.size())
+			label << "-" << bucketMs*(i+1) << " ms";
+		else
+			label << "+ ms";
+		std::string definition = "group='histogram' label='" + label.str() + "'";
+		std::stringstream name;
+		name << "bucket" << i;
+		TwAddVarRO(menuBar,
+		           name.str().c_str(),
+		           TW_TYPE_INT32,
+		           &frameHistogram[i],
+		           definition.c_str());
+	}
+	TwDefine("menu/histogram group='frame time' opened=false");
+
+	// memory
+	const char *memoryNames[4] = {"gl (MiB)",
+	                              "gl peak (MiB)",
+	                              "host (MiB)",
+	                              "host peak (MiB)"};
+	for(GLint i=0; i<4; ++i)
+		TwAddVarRO(menuBar,
+		           memoryNames[i],
+		           TW_TYPE_FLOAT,
+		           &memoryValues[i],
+		           "group='memory' precision=2");
+
 	TwAddButton( menuBar,
 	             "fullscreen",
 	             &toggle_fullscreen,
@@ -454,20 +1355,48 @@ void on_init() {
 	           "min=0 max=360 step=1");
 
 #endif // _ANT_ENABLE
+	fw::report_resources(std::cout);
 	fw::check_gl_error();
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// write the profiled spans (at exit)
+void save_trace() {
+	try {
+		fw::save_profile_trace(traceFile);
+		std::cout << "trace: " << traceFile << std::endl;
+	}
+	catch(std::exception& e) {
+		std::cerr << "trace: " << e.what() << std::endl;
+	}
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // on clean cb
 void on_clean() {
-	// delete objects
+	// delete objects (and those of the globals, before the context goes)
+	frameRing.Release();
+	gpuProfiler.Release();
+	// stop the background bake before the globals are destroyed (its
+	// checkpoint is kept)
+	if(refinement != NULL) {
+		refinement->cancel = 1;
+		refineTask.Wait();
+		delete refinement;
+		refinement = NULL;
+	}
 	glDeleteBuffers(BUFFER_COUNT, buffers);
 	glDeleteVertexArrays(VERTEX_ARRAY_COUNT, vertexArrays);
 	glDeleteTextures(TEXTURE_COUNT, textures);
+	if(!pageTextures.empty())
+		glDeleteTextures(GLsizei(pageTextures.size()), &pageTextures[0]);
 	glDeleteSamplers(SAMPLER_COUNT, samplers);
 	for(GLuint i=0; i<PROGRAM_COUNT;++i)
 		glDeleteProgram(programs[i]);
+	if(!pathQueries.empty())
+		glDeleteQueries(GLsizei(pathQueries.size()), &pathQueries[0]);
 
 	// release memory
 	delete[] buffers;
@@ -484,11 +1413,75 @@ void on_clean() {
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+// refresh the frame statistics shown in the menu and dump them periodically
+void update_frame_stats() {
+	static fw::Timer dumpTimer;
+	if(statsWindow != frameStats.Window()) {
+		statsWindow = std::max(statsWindow, 1);
+		frameStats.SetWindow(statsWindow);
+		cpuStats.SetWindow(statsWindow);
+	}
+	frameStats.Update();
+	cpuStats.Update();
+
+#ifdef _ANT_ENABLE
+	frameStatValues[STAT_MIN]    = 1e3*frameStats.Min();
+	frameStatValues[STAT_MEAN]   = 1e3*frameStats.Mean();
+	frameStatValues[STAT_P50]    = 1e3*frameStats.Percentile(50.0);
+	frameStatValues[STAT_P95]    = 1e3*frameStats.Percentile(95.0);
+	frameStatValues[STAT_P99]    = 1e3*frameStats.Percentile(99.0);
+	frameStatValues[STAT_MAX]    = 1e3*frameStats.Max();
+	frameStatValues[STAT_JITTER] = 1e3*frameStats.Jitter();
+	frameHistogram = frameStats.Histogram();
+#endif
+
+	if(!statsStream.is_open())
+		return;
+	dumpTimer.Start(); // no-op once ticking
+	if(dumpTimer.Ticks() < statsPeriod)
+		return;
+	static GLdouble time = 0.0;
+	time+= dumpTimer.Ticks();
+	statsStream << "{\"time_s\":" << time << ",\"frame\":";
+	frameStats.WriteJson(statsStream);
+	statsStream << ",\"cpu\":";
+	cpuStats.WriteJson(statsStream);
+	statsStream << "}" << std::endl;
+	dumpTimer.Stop();
+	dumpTimer.Start();
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// copy a column major matrix (or a vector if columns is 1) to the Frame
+// block, with the std140 column stride of 16 bytes
+void set_frame_member(GLint member,
+                      const GLfloat *data,
+                      GLint rows,
+                      GLint columns) {
+	if(frameOffsets[member] < 0)
+		return; // inactive
+	for(GLint i=0; i<columns; ++i)
+		memcpy(&frameData[frameOffsets[member] + 16*i],
+		       data + rows*i,
+		       sizeof(GLfloat)*rows);
+}
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // on update cb
 void on_update() {
 	// Variables
 	static fw::Timer deltaTimer;
+	static fw::Timer intervalTimer; // since the start of the last frame
+	fw::ProfileScope frameScope("frame");
+	fw::Timer cpuTimer;
+	cpuTimer.Start();
+	intervalTimer.Stop();
+	if(intervalTimer.Nanoseconds() > 0)
+		frameStats.Add(intervalTimer.Ticks());
+	intervalTimer.Start();
 
 	// stop timing and set delta
 	deltaTimer.Stop();
@@ -497,10 +1490,19 @@ void on_update() {
 	speed = deltaTicks*1000.0f;
 #endif
 
+	update_lightfield();
 	glProgramUniform1f(programs[PROGRAM_PREVIEW],
-		glGetUniformLocation(programs[PROGRAM_PREVIEW],
-		                     "uLayer"),
-		               layer);
+	                   uniformLocations[UNIFORM_PREVIEW_LAYER],
+	                   layer);
+
+	// the camera follows the path of the benchmark
+	if(pathFrame < pathFrames) {
+		lf::CameraKey camera = path_camera(pathFrame);
+		theta  = camera.theta;
+		phi    = camera.phi;
+		radius = camera.radius;
+		glBeginQuery(GL_TIME_ELAPSED, pathQueries[pathFrame]);
+	}
 
 	float thetaR = PI*0.5f-theta * PI / 180.0f;
 	float phiR   = phi   * PI / 180.0f;
@@ -519,46 +1521,107 @@ void on_update() {
 
 	Vector3 camPos = objectAxis.GetUnitAxis() * objectAxis.GetPosition();
 
-	glProgramUniform3f(programs[PROGRAM_LIGHTFIELD],
-		glGetUniformLocation(programs[PROGRAM_LIGHTFIELD],
-		                     "uCamPos"),
-		               camPos[0],camPos[1],camPos[2]);
-	glProgramUniformMatrix3fv(programs[PROGRAM_LIGHTFIELD],
-		glGetUniformLocation(programs[PROGRAM_LIGHTFIELD],
-		                     "uBillboardAxis"),
-		                      1,
-		                      GL_FALSE,
-		                      &objectAxis.GetUnitAxis()[0][0]);
-	glProgramUniformMatrix4fv(programs[PROGRAM_LIGHTFIELD],
-		glGetUniformLocation(programs[PROGRAM_LIGHTFIELD],
-		                     "uModelViewProjection"),
-		                      1,
-		                      GL_FALSE,
-		                      &mvp[0][0]);
+	fw::Timer frameTimer;
+	frameTimer.Start();
+	if(multi_asset()) {
+		fw::Timer fillTimer;
+		fillTimer.Start();
+		Matrix4x4 view = benchFrames > 0 ? bench_update()
+		               : objectAxis.ExtractTransformMatrix();
+		Matrix4x4 viewProjection = Matrix4x4::Perspective(FOVY,1,0.05f,1000.0f)
+		                         * view;
+		Vector4 eye = view.Inverse() * Vector4(0,0,0,1);
+		fill_instances(viewProjection, Vector3(eye[0],eye[1],eye[2]));
+		fillTimer.Stop();
+		benchFillTime+= fillTimer.Ticks();
+		benchDrawnCount+= culled.impostors.size();
+		set_frame_member(FRAME_EYE_POSITION, &eye[0], 3, 1);
+		set_frame_member(FRAME_VIEW_PROJECTION, &viewProjection[0][0], 4, 4);
+	}
+	else {
+		Matrix3x3 billboardAxis = objectAxis.GetUnitAxis();
+		set_frame_member(FRAME_CAM_POS, &camPos[0], 3, 1);
+		set_frame_member(FRAME_BILLBOARD_AXIS, &billboardAxis[0][0], 3, 3);
+		set_frame_member(FRAME_MODELVIEW_PROJECTION, &mvp[0][0], 4, 4);
+	}
+	frameRing.Write(&frameData[0], BUFFER_FRAME);
 
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glViewport(200,lightfieldResolution,lightfieldResolution, lightfieldResolution);
 
 	glUseProgram(programs[PROGRAM_LIGHTFIELD]);
 	glBindVertexArray(vertexArrays[VERTEX_ARRAY_LIGHFIELD]);
+	gpuProfiler.Begin("impostors");
+	if(multi_asset())
+		draw_assets();
+	else
 		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	gpuProfiler.End();
+	frameRing.Fence();
+
+	if(benchFrames > 0) {
+		glFinish();
+		frameTimer.Stop();
+		benchFrameTime+= frameTimer.Ticks();
+		if(++benchFrame == benchFrames) {
+			bench_report();
+			glutLeaveMainLoop();
+		}
+	}
 
-	glViewport(200,0,lightfieldResolution, lightfieldResolution);
-	glUseProgram(programs[PROGRAM_PREVIEW]);
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	// preview of the dense layers
+	if(!sparse_lightfield()) {
+		glViewport(200,0,lightfieldResolution, lightfieldResolution);
+		glUseProgram(programs[PROGRAM_PREVIEW]);
+		gpuProfiler.Begin("preview");
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		gpuProfiler.End();
+	}
+	if(pathFrame < pathFrames)
+		glEndQuery(GL_TIME_ELAPSED);
 
 	// start ticking
 	deltaTimer.Start();
 
 #ifdef _ANT_ENABLE
+	GLuint64 live = 0, peak = 0;
+	fw::resource_bytes(fw::RESOURCE_GL, live, peak);
+	memoryValues[0] = live/1048576.0f;
+	memoryValues[1] = peak/1048576.0f;
+	fw::resource_bytes(fw::RESOURCE_HOST, live, peak);
+	memoryValues[2] = live/1048576.0f;
+	memoryValues[3] = peak/1048576.0f;
 	glBindSampler(TEXTURE_LIGHFIELD, 0);
+	gpuProfiler.Begin("ui");
 	TwDraw();
+	gpuProfiler.End();
 	glBindSampler(TEXTURE_LIGHFIELD, samplers[SAMPLER_TRILINEAR]);
 #endif // _ANT_ENABLE
 
 	fw::check_gl_error();
+	gpuProfiler.Collect();
+	cpuTimer.Stop();
+	cpuStats.Add(cpuTimer.Ticks());
+	update_frame_stats();
+	if(pathFrame < pathFrames) {
+		pathCpuTimes.push_back(cpuTimer.Ticks());
+		if(++pathFrame == pathFrames) {
+			// the results of the last frames wait for the GPU
+			std::vector<GLdouble> gpuTimes(pathFrames);
+			for(GLint i=0; i<pathFrames; ++i) {
+				GLuint64 elapsed = 0;
+				glGetQueryObjectui64v(pathQueries[i], GL_QUERY_RESULT, &elapsed);
+				gpuTimes[i] = GLdouble(elapsed)*1e-9;
+			}
+			write_path_report("gpu", pathCpuTimes, gpuTimes);
+			glutLeaveMainLoop();
+		}
+	}
 
-	glutSwapBuffers();
+	{
+		FW_PROFILE_SCOPE("swap");
+		glutSwapBuffers();
+	}
 	glutPostRedisplay();
 }
 
@@ -655,6 +1718,129 @@ int main(int argc, char** argv) {
 	const GLuint CONTEXT_MAJOR = 4;
 	const GLuint CONTEXT_MINOR = 2;
 
+	// options of any of the modes below
+	while(argc > 2) {
+		const std::string option = argv[1];
+		if(option == "--trace") {
+			// profile and write a trace on exit
+			traceFile = argv[2];
+			fw::set_profiling(true);
+			atexit(&save_trace);
+		}
+		else if(option == "--progressive")
+			// draw a coarse atlas until the full one is baked
+			progressiveViewN = std::max(atoi(argv[2]), 1);
+		else if(option == "--frame-stats") {
+			// dump the frame statistics every statsPeriod seconds
+			statsStream.open(argv[2]);
+			if(!statsStream) {
+				std::cerr << "Cannot write " << argv[2] << std::endl;
+				return 1;
+			}
+		}
+		else
+			break;
+		argv[2] = argv[0];
+		argv+= 2;
+		argc-= 2;
+	}
+
+	// offline modes (no window)
+	try {
+		if(argc == 3 && std::string(argv[1]) == "--bench-compression") {
+			lf::Atlas atlas;
+			lf::load_atlas(atlas, argv[2]);
+			lf::benchmark_compression(atlas, std::cout);
+			return 0;
+		}
+		if(argc == 4 && std::string(argv[1]) == "--bench-sparse") {
+			lf::Atlas atlas;
+			lf::load_atlas(atlas, argv[2]);
+			lf::benchmark_sparse_atlas(atlas, atoi(argv[3]), std::cout);
+			return 0;
+		}
+		if(argc == 4 && std::string(argv[1]) == "--bench-dedup") {
+			lf::Atlas atlas;
+			lf::load_atlas(atlas, argv[2]);
+			lf::benchmark_tile_dedup(atlas, atoi(argv[3]), std::cout);
+			return 0;
+		}
+		if(argc == 3 && std::string(argv[1]) == "--bench-eigen") {
+			lf::Atlas atlas;
+			lf::load_atlas(atlas, argv[2]);
+			lf::benchmark_eigen_atlas(atlas, std::cout);
+			return 0;
+		}
+		if((argc == 5 || argc == 6) && std::string(argv[1]) == "--tune") {
+			lf::Mesh tuneMesh;
+			lf::BakeParameters parameters;
+			lf::load_mesh(argv[2], tuneMesh);
+			// held-out directions (32 by default)
+			const GLint dirCnt = argc == 6 ? atoi(argv[5]) : 32;
+			bool met = lf::tune_bake_parameters(tuneMesh,
+			                                    atof(argv[3]),
+			                                    atof(argv[4]),
+			                                    normalEncoding,
+			                                    dirCnt,
+			                                    std::cout,
+			                                    parameters);
+			const char* formatNames[] = {"RGBA8", "BC5", "BC7"};
+			std::cout << (met ? "" : "target not met, best: ")
+			          << "viewN=" << parameters.viewN
+			          << " resolution=" << parameters.resolution
+			          << " format=" << formatNames[parameters.format]
+			          << std::endl;
+			return met ? 0 : 1;
+		}
+		if(argc > 2 && std::string(argv[1]) == "--assets")
+			assetFiles.assign(argv+2, argv+argc); // run the viewer
+		if(argc >= 4 && std::string(argv[1]) == "--bench-instances") {
+			// scripted scene, runs the viewer for a fixed frame count
+			benchInstanceCount = std::max(atoi(argv[2]), 1);
+			benchFrames = std::max(atoi(argv[3]), 1);
+			if(argc > 4)
+				assetFiles.assign(argv+4, argv+argc);
+			else {
+				assetFiles.push_back("models/Stone_Forest_1.obj");
+				assetFiles.push_back("models/Stone_F_3.obj");
+			}
+		}
+		if(argc >= 4 && std::string(argv[1]) == "--benchmark")
+			parse_path_benchmark(argc, argv); // runs the viewer
+		if(argc >= 4 && std::string(argv[1]) == "--benchmark-cpu") {
+			parse_path_benchmark(argc, argv);
+			run_cpu_path_benchmark();
+			return 0;
+		}
+		if(argc == 3 && std::string(argv[1]) == "--bench-culling") {
+			lf::benchmark_culling(atoi(argv[2]), std::cout);
+			return 0;
+		}
+		if(argc == 3 && std::string(argv[1]) == "--bench-bvh") {
+			lf::benchmark_bvh(atoi(argv[2]), std::cout);
+			return 0;
+		}
+		if(argc == 2 && std::string(argv[1]) == "--bench-checksum")
+			return fw::benchmark_checksums(std::cout) > 0 ? 1 : 0;
+		if(argc == 2 && std::string(argv[1]) == "--bench-normals") {
+			// uniform directions (spherical Fibonacci points)
+			const GLint count = 1 << 20;
+			std::vector<Vector3> normals(count);
+			for(GLint i=0; i<count; ++i) {
+				GLfloat y = 1.0f - (2.0f*i+1.0f)/count;
+				GLfloat r = sqrt(1.0f-y*y);
+				GLfloat phi = i*PI*(3.0f-sqrt(5.0f));
+				normals[i] = Vector3(r*cos(phi), y, r*sin(phi));
+			}
+			lf::benchmark_normal_encodings(normals, std::cout);
+			return 0;
+		}
+	}
+	catch(std::exception& e) {
+		std::cerr << "Fatal exception: " << e.what() << std::endl;
+		return 1;
+	}
+
 	// init glut
 	glutInit(&argc, argv);
 	glutInitContextVersion(CONTEXT_MAJOR ,CONTEXT_MINOR);
@@ -680,6 +1866,8 @@ int main(int argc, char** argv) {
 
 	// glewInit generates an INVALID_ENUM error for some reason...
 	glGetError();
+	if(pathFrames > 0)
+		disable_vsync();
 
 	// set callbacks
 	glutCloseFunc(&on_clean);
@@ -11,6 +11,7 @@
 //------------------------------------------------------------------------------
 uniform mat4 uModelView;
 uniform mat4 uModelViewProjection;
+uniform vec2 uDepthRange; // view space depth of the object (near, far)
 
 
 //------------------------------------------------------------------------------
@@ -23,7 +24,8 @@ void main() {
 	vec4 viewPos = uModelView * vec4(iPosition,1.0);
 	gl_Position  = uModelViewProjection * vec4(iPosition,1.0);
 	oData.xyz = iNormal;                            // normal in world space
-	oData.w   = (-viewPos.z+INV_SQRT_2) * SQRT_2; // depth in view space
+	oData.w   = (-viewPos.z-uDepthRange.x)
+	          / (uDepthRange.y-uDepthRange.x); // depth in view space
 }
 #endif
 
@@ -35,12 +37,25 @@ layout(location=0) in vec4 iData;
 #define iDepth  iData.w
 layout(location=0) out vec4 oData; // in [0,1]
 
+// project on the octahedron, fold the lower half over the upper one
+vec2 octahedral_encode(vec3 n) {
+	vec2 p = n.xz / (abs(n.x)+abs(n.y)+abs(n.z));
+	if(n.y < 0.0)
+		p = (1.0-abs(p.yx)) * vec2(p.x >= 0.0 ? 1.0 : -1.0,
+		                           p.y >= 0.0 ? 1.0 : -1.0);
+	return p*0.5+0.5;
+}
+
 void main() {
 #if 1
 	vec3 n = normalize(iNormal);
 	oData.r = iDepth; // depth 
+#ifdef OCTAHEDRAL_NORMALS
+	oData.gb = octahedral_encode(n);
+#else
 	oData.g = acos(n.y) * INV_PI; // theta 
 	oData.b = fma(atan(n.x,-n.z), INV_TWO_PI, 0.5); // phi
+#endif
 	oData.a = 1.0; // opacity
 #else // for debug
 	oData.rgb = normalize(iNormal);
@@ -36,7 +36,7 @@ solution "OpenGL"
 -- Linux x86 platform gmake
 		configuration {"linux", "gmake", "x32"}
 			linkoptions {
-			"-Wl,-rpath,./lib/linux/lin32 -L./lib/linux/lin32 -lGLEW -lglut -lAntTweakBar"
+			"-Wl,-rpath,./lib/linux/lin32 -L./lib/linux/lin32 -lGLEW -lglut -lAntTweakBar -lpthread -lrt"
 			}
 			libdirs {
 			"lib/linux/lin32"
@@ -45,7 +45,7 @@ solution "OpenGL"
 -- Linux x64 platform gmake
 		configuration {"linux", "gmake", "x64"}
 			linkoptions {
-			"-Wl,-rpath,./lib/linux/lin64 -L./lib/linux/lin64 -lGLEW -lglut -lAntTweakBar"
+			"-Wl,-rpath,./lib/linux/lin64 -L./lib/linux/lin64 -lGLEW -lglut -lAntTweakBar -lpthread -lrt"
 			}
 			libdirs {
 			"lib/linux/lin64"
@@ -73,3 +73,61 @@ solution "OpenGL"
 --			}
 
 
+-- ---------------------------------------------------------
+-- Batch baker (CPU only, no window)
+	project "lfbake"
+		basedir "./"
+		language "C++"
+		location "./"
+		kind "ConsoleApp"
+		files { "tools/lfbake.cpp" }
+		files { "Framework.*", "Lightfield.*", "Bake.*", "Farm.*" }
+		files { "glm.hpp", "glm.cpp", "glew.hpp" }
+		files { "core/*.cpp" }
+		files { "libpng/*.c", "libpng/zlib/*.c" }
+		includedirs {
+		"./",
+		"include",
+		"core",
+		"libpng",
+		"libpng/zlib"
+		}
+		objdir "obj/lfbake"
+
+-- Debug configurations
+		configuration {"debug"}
+			defines {"DEBUG"}
+			flags {"Symbols", "ExtraWarnings"}
+
+-- Release configurations
+		configuration {"release"}
+			defines {"NDEBUG"}
+			flags {"Optimize"}
+
+-- Linux x86 platform gmake (GL is linked, but no context is created)
+		configuration {"linux", "gmake", "x32"}
+			linkoptions {
+			"-Wl,-rpath,./lib/linux/lin32 -L./lib/linux/lin32 -lGLEW -lGL -lpthread -lrt"
+			}
+			libdirs {
+			"lib/linux/lin32"
+			}
+
+-- Linux x64 platform gmake
+		configuration {"linux", "gmake", "x64"}
+			linkoptions {
+			"-Wl,-rpath,./lib/linux/lin64 -L./lib/linux/lin64 -lGLEW -lGL -lpthread -lrt"
+			}
+			libdirs {
+			"lib/linux/lin64"
+			}
+
+-- Visual x86
+		configuration {"vs2010", "x32"}
+			libdirs {
+			"lib/windows/win32"
+			}
+			links {
+			"glew32s",
+			"opengl32"
+			}
@@ -0,0 +1,216 @@
+////////////////////////////////////////////////////////////////////////////////
+// \author   Jonathan Dupuy
+// \brief Batch baker: bakes the cache files of OBJ files on the CPU with a
+// bake farm, without a window or a GL context.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#include "Framework.hpp"    // utility classes/functions
+#include "Lightfield.hpp"   // lightfield atlases
+#include "Farm.hpp"         // multi-process baker
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Global variables
+//
+////////////////////////////////////////////////////////////////////////////////
+
+const char *normalNames[]  = {"spherical", "octahedral"};
+const char *formatNames[]  = {"rgba8", "bc5", "bc7"};
+const char *qualityNames[] = {"fast", "normal", "high"};
+const char *mipmapNames[]  = {"box", "kaiser"};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Functions
+//
+////////////////////////////////////////////////////////////////////////////////
+
+void usage(const char *program) {
+	std::cerr
+	<< "usage: " << program << " [options] <obj files>\n"
+	<< "Bakes the cache file (.lfa) of each OBJ file, next to it.\n"
+	<< "  --view-n <n>           views along each half axis (9)\n"
+	<< "  --resolution <texels>  texels along each side of a layer (256)\n"
+	<< "  --normals <encoding>   spherical, octahedral (spherical)\n"
+	<< "  --format <format>      rgba8, bc5 (1/2 size), bc7 (1/4 size) (rgba8)\n"
+	<< "  --quality <quality>    fast, normal, high (normal)\n"
+	<< "  --mipmap <filter>      box, kaiser (box)\n"
+	<< "  --workers <n>          worker processes (hardware threads)\n"
+	<< "  --shard-views <n>      views per shard, 0 for whole assets (8)\n"
+	<< "  --attempts <n>         of a shard before its asset fails (3)\n"
+	<< "  --report <file>        JSON report of timings and sizes\n";
+}
+
+
+// Get the index of name in names, -1 if missing
+GLint find_name(const char *names[], GLint count, const std::string& name) {
+	for(GLint i=0; i<count; ++i)
+		if(name == names[i])
+			return i;
+	return -1;
+}
+
+
+// Write a JSON string (control characters are escaped as \uXXXX)
+void write_json_string(std::ostream& stream, const std::string& string) {
+	static const char hex[] = "0123456789abcdef";
+	stream << '"';
+	for(size_t i=0; i<string.size(); ++i) {
+		const unsigned char c = string[i];
+		if(c == '"' || c == '\\')
+			stream << '\\' << c;
+		else if(c < 0x20)
+			stream << "\\u00" << hex[c >> 4] << hex[c & 0xF];
+		else
+			stream << c;
+	}
+	stream << '"';
+}
+
+
+void write_report(const std::string& filename,
+                  const std::vector<lf::FarmJob>& jobs,
+                  const lf::FarmParameters& parameters,
+                  const std::vector<lf::FarmResult>& results,
+                  GLdouble seconds) {
+	std::ofstream file(filename.c_str());
+	if(!file) {
+		std::cerr << "Cannot write " << filename << std::endl;
+		return;
+	}
+	GLuint64 bytes = 0;
+	GLint bakedCnt = 0;
+	for(size_t i=0; i<results.size(); ++i) {
+		bytes+= results[i].bytes;
+		bakedCnt+= results[i].baked ? 1 : 0;
+	}
+	file << "{\"view_n\":" << parameters.viewN
+	     << ",\"resolution\":" << parameters.resolution
+	     << ",\"normals\":\"" << normalNames[parameters.normals]
+	     << "\",\"format\":\"" << formatNames[parameters.format]
+	     << "\",\"quality\":\"" << qualityNames[parameters.quality]
+	     << "\",\"mipmap\":\"" << mipmapNames[parameters.mipmapFilter]
+	     << "\",\"workers\":" << parameters.workerCnt
+	     << ",\"shard_views\":" << parameters.shardViews
+	     << ",\n\"seconds\":" << seconds
+	     << ",\"baked\":" << bakedCnt
+	     << ",\"failed\":" << GLint(results.size())-bakedCnt
+	     << ",\"bytes\":" << bytes
+	     << ",\n\"assets\":[";
+	for(size_t i=0; i<results.size(); ++i) {
+		file << (i ? ",\n" : "\n") << "{\"mesh\":";
+		write_json_string(file, jobs[i].meshFile);
+		file << ",\"cache\":";
+		write_json_string(file, jobs[i].cacheFile);
+		file << ",\"baked\":" << (results[i].baked ? "true" : "false")
+		     << ",\"seconds\":" << results[i].seconds
+		     << ",\"bytes\":" << results[i].bytes
+		     << ",\"resumed_layers\":" << results[i].resumedLayers
+		     << ",\"retries\":" << results[i].retries << '}';
+	}
+	file << "]}\n";
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Main
+//
+////////////////////////////////////////////////////////////////////////////////
+int main(int argc, char** argv) {
+	lf::FarmParameters parameters;
+	parameters.workerCnt    = fw::hardware_thread_count();
+	parameters.shardViews   = 8;
+	parameters.maxAttempts  = 3;
+	parameters.viewN        = 9;
+	parameters.resolution   = 256;
+	parameters.normals      = lf::NORMAL_SPHERICAL;
+	parameters.mipmapFilter = fw::MIPMAP_FILTER_BOX;
+	parameters.format       = lf::FORMAT_RGBA8;
+	parameters.quality      = fw::BC_QUALITY_NORMAL;
+	std::string report;
+	std::vector<lf::FarmJob> jobs;
+
+	// options, then OBJ files
+	for(int i=1; i<argc; ++i) {
+		const std::string option = argv[i];
+		if(option.compare(0, 2, "--") != 0) {
+			lf::FarmJob job;
+			job.meshFile = option;
+			job.cacheFile = lf::cache_file(option);
+			jobs.push_back(job);
+			continue;
+		}
+		if(i+1 == argc) {
+			usage(argv[0]);
+			return 2;
+		}
+		const std::string value = argv[++i];
+		GLint name = 0;
+		if(option == "--view-n")
+			parameters.viewN = atoi(value.c_str());
+		else if(option == "--resolution")
+			parameters.resolution = atoi(value.c_str());
+		else if(option == "--normals")
+			name = parameters.normals
+			     = find_name(normalNames, lf::NORMAL_COUNT, value);
+		else if(option == "--format")
+			name = parameters.format
+			     = find_name(formatNames, lf::FORMAT_COUNT, value);
+		else if(option == "--quality")
+			name = parameters.quality = find_name(qualityNames, 3, value);
+		else if(option == "--mipmap") {
+			name = find_name(mipmapNames, 2, value);
+			parameters.mipmapFilter = GLenum(std::max(name, 0));
+		}
+		else if(option == "--workers")
+			parameters.workerCnt = atoi(value.c_str());
+		else if(option == "--shard-views")
+			parameters.shardViews = atoi(value.c_str());
+		else if(option == "--attempts")
+			parameters.maxAttempts = atoi(value.c_str());
+		else if(option == "--report")
+			report = value;
+		else
+			name = -1;
+		if(name < 0) {
+			std::cerr << "Invalid option " << option << ' ' << value << '\n';
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if(jobs.empty() || parameters.viewN < 1 || parameters.resolution < 1
+	   || parameters.viewN > lf::MAX_VIEW_COUNT
+	   || lf::view_count(parameters.viewN) > lf::MAX_VIEW_COUNT
+	   || parameters.resolution > lf::MAX_RESOLUTION
+	   || parameters.workerCnt < 1
+	   || parameters.shardViews < 0 || parameters.maxAttempts < 1) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	std::vector<lf::FarmResult> results;
+	GLint failedCnt = 0;
+	GLuint64 startTime = fw::clock_nanoseconds();
+	try {
+		failedCnt = lf::farm_bake(jobs, parameters, std::cout, results);
+	}
+	catch(std::exception& e) {
+		std::cerr << "Fatal exception: " << e.what() << std::endl;
+		return 1;
+	}
+	GLdouble seconds = 1e-9*(fw::clock_nanoseconds()-startTime);
+	std::cout << jobs.size()-failedCnt << '/' << jobs.size()
+	          << " assets baked in " << seconds << " s" << std::endl;
+	if(!report.empty())
+		write_report(report, jobs, parameters, results, seconds);
+	return failedCnt > 0 ? 1 : 0;
+}
+